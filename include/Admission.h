@@ -0,0 +1,111 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <boost/asio/thread_pool.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include "Packet.h"
+#include "PeerExchange.h"
+
+// Proof-of-work puzzle a server may set a connecting peer before doing any
+// real work for it. Both the challenge and its solution travel in
+// Admission packets, always unsealed:
+//
+//   challenge: ADMISSION_CHALLENGE, difficulty u8, issued u64, mac[16]
+//   solution:  ADMISSION_SOLUTION, difficulty u8, issued u64, mac[16], nonce u64
+//
+// The mac binds difficulty and issue time to the peer's address under a
+// secret only the server knows, so the server keeps no record of the
+// challenges it hands out. A solution is a nonce for which SHA-256 of the
+// challenge body followed by the nonce starts with difficulty zero bits.
+struct AdmissionChallenge {
+    static constexpr size_t MAC_SIZE = 16;
+    static constexpr size_t BODY_SIZE = 1 + 8 + MAC_SIZE;
+
+    uint8_t difficulty = 0;
+    uint64_t issued = 0;  // Server's wall clock, in seconds
+    std::array<uint8_t, MAC_SIZE> mac{};
+
+    Packet toPacket() const;
+    // Throws unless packet is an Admission challenge
+    static AdmissionChallenge fromPacket(const Packet& packet);
+
+    // Searches for a nonce and returns the solution packet. Takes about
+    // 2^difficulty hashes, so callers keep it off their I/O thread.
+    Packet solve() const;
+};
+
+// Solves the challenges servers set this process's outbound connections on
+// a few shared threads, so however many challenges arrive they cannot take
+// more CPU than THREADS cores. At most MAX_PENDING solves are queued or
+// running at once.
+class AdmissionSolver {
+public:
+    using Callback = std::function<void(Packet solution)>;
+
+    static constexpr size_t THREADS = 2;
+    static constexpr size_t MAX_PENDING = 64;
+
+    static AdmissionSolver& shared();
+
+    // Calls done with the solution on one of the solver's threads. False,
+    // without solving, if MAX_PENDING solves are already under way.
+    bool submit(const AdmissionChallenge& challenge, Callback done);
+
+private:
+    boost::asio::thread_pool pool_{THREADS};
+    std::atomic<size_t> pending_{0};
+};
+
+// Server side of admission: issues and checks challenges, and sets their
+// difficulty from how loaded the server is. In normal times the difficulty
+// is zero and peers are admitted without a puzzle. Each load sample at or
+// above HIGH_LOAD raises it a step, up to MAX_DIFFICULTY; it comes down a
+// step only after RELAX_SAMPLES samples in a row below LOW_LOAD, so a brief
+// lull does not let a flood straight back in.
+class AdmissionControl {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int MIN_DIFFICULTY = 8;  // First step above zero, in bits
+    static constexpr int DIFFICULTY_STEP = 4;
+    static constexpr int MAX_DIFFICULTY = 20;
+    static constexpr double HIGH_LOAD = 0.85;
+    static constexpr double LOW_LOAD = 0.5;
+    static constexpr int RELAX_SAMPLES = 8;
+    static constexpr std::chrono::seconds CHALLENGE_LIFETIME{30};
+
+    AdmissionControl();
+
+    int difficulty() const { return difficulty_; }
+    AdmissionChallenge challengeFor(const PeerAddress& peer, std::time_t now) const;
+    // True if solution answers a challenge we issued to peer that is still
+    // within CHALLENGE_LIFETIME
+    bool verify(const Packet& solution, const PeerAddress& peer, std::time_t now) const;
+
+    // Feeds one load sample, from 0 for idle to 1 for saturated
+    void updateLoad(double load);
+    // Load of a server whose work runs on the calling thread: the largest of
+    // that thread's CPU use since the last call, the whole machine's, and
+    // how full listen_fd's accept queue is
+    double sampleLoad(int listen_fd);
+
+private:
+    std::array<uint8_t, 32> secret_;
+    int difficulty_ = 0;
+    int calm_samples_ = 0;
+    Clock::time_point last_sample_;
+    Clock::duration last_cpu_{0};
+    uint64_t last_machine_busy_ = 0;
+    uint64_t last_machine_total_ = 0;
+
+    std::array<uint8_t, AdmissionChallenge::MAC_SIZE> macFor(uint8_t difficulty, uint64_t issued,
+                                                             const PeerAddress& peer) const;
+};
+
+#endif // ADMISSION_H
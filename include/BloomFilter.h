@@ -2,22 +2,31 @@
 #define BLOOMFILTER_H
 
 #include <vector>
-#include <string>
-#include <functional>
+#include "MemoryAccounting.h"
+#include "MessageId.h"
 
 class BloomFilter {
 public:
-    BloomFilter(size_t size, size_t num_hashes);
-    void add(const std::string& item);
-    bool probably_contains(const std::string& item) const;
+    // The bit arrays are charged to account, when one is given
+    BloomFilter(size_t size, size_t num_hashes, MemoryAccount* account = nullptr);
+    void add(const MessageId& item);
+    bool probably_contains(const MessageId& item) const;
+
+    // Starts a fresh bit array of the new size. The old one is kept and still
+    // consulted until the next resize, so ids seen just before are not
+    // forwarded again.
+    void resize(size_t size);
+    size_t size() const { return bits_.size(); }
 
 private:
-    std::vector<bool> bits_;
+    using Bits = std::vector<bool, TrackingAllocator<bool>>;
+
+    Bits bits_;
+    Bits previous_bits_;
     size_t num_hashes_;
-    std::hash<std::string> hash_func_;
 
-    size_t hash(const std::string& item, size_t index) const;
+    bool contains(const Bits& bits, const MessageId& item) const;
+    size_t hash(const MessageId& item, size_t index, size_t size) const;
 };
 
 #endif // BLOOMFILTER_H
-
@@ -0,0 +1,124 @@
+#ifndef DATAGRAM_H
+#define DATAGRAM_H
+
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "HandlerAllocator.h"
+#include "Packet.h"
+#include "Reliability.h"
+#include "SecureSession.h"
+#include "TimerWheel.h"
+
+// Small frames of one connection sent as UDP datagrams beside its TCP
+// stream, so a lost packet delays only its own frame instead of everything
+// queued behind it: short messages, peer requests and piece announcements
+// and requests. Bulk frames stay on the stream.
+//
+// Each side opens a socket and tells the other its port in a Datagram
+// frame over the stream; a side that gets the other's port first answers
+// with its own. A datagram is one whole frame, header and payload as on the
+// stream, CRC included; nothing is fragmented. On a secure connection each
+// datagram is sealed with the session keys, see SecureSession.
+//
+// Datagrams are sequenced apart from the stream and acknowledged with the
+// stream's Ack format, so only the frames an ack leaves out are sent again,
+// once the round trip measured from earlier acks has passed. An ack also
+// carries, after its ranges, the sequence below which its sender has
+// nothing left to resend. A frame still unacknowledged after MAX_ATTEMPTS
+// goes back to the owner to send on the stream, and the peer, told by the
+// next ack, stops waiting for it.
+//
+// A firewall or NAT may drop datagrams for the life of the connection, so
+// until the first ack arrives only one frame at a time is sent this way.
+// If it comes back, or MAX_FALLBACKS frames in a row do, the channel stops
+// sending and leaves everything to the stream; it still receives and acks.
+class DatagramChannel : public std::enable_shared_from_this<DatagramChannel> {
+public:
+    using Clock = std::chrono::steady_clock;
+    // Takes each frame that passed its checks, once; acks are kept here. A
+    // frame refused by returning false is left unacknowledged, so the
+    // sender's retries and fallback to the stream throttle it.
+    using FrameHandler = std::function<bool(const Packet&)>;
+    // Takes back a frame the channel gave up on
+    using Fallback = std::function<void(FramePtr)>;
+
+    struct Stats {
+        uint64_t sent = 0;
+        uint64_t retransmitted = 0;
+        uint64_t received = 0;
+        uint64_t duplicates = 0;
+        uint64_t rejected = 0;    // Malformed, corrupt or from the wrong address
+        uint64_t fell_back = 0;   // Given up on and handed back
+    };
+
+    // Fits in one packet on any path that carries IPv6
+    static constexpr size_t MAX_DATAGRAM_SIZE = 1200;
+    static constexpr size_t MAX_PAYLOAD = MAX_DATAGRAM_SIZE - PACKET_HEADER_SIZE - SecureSession::DATAGRAM_OVERHEAD;
+    static constexpr size_t WINDOW = 256;
+    static constexpr int MAX_ATTEMPTS = 3;
+    static constexpr int MAX_FALLBACKS = 3;
+    static constexpr std::chrono::milliseconds MIN_RTO{50};
+
+    DatagramChannel(boost::asio::io_context& io_context, FrameHandler handler, Fallback fallback);
+
+    // Binds to a free port on address and starts receiving; returns the
+    // port. Throws boost::system::system_error if the socket cannot be opened.
+    uint16_t open(const boost::asio::ip::address& address);
+    // Datagrams go to, and are only taken from, remote
+    void connect(const boost::asio::ip::udp::endpoint& remote);
+    // Seals and opens every datagram with session, which must outlive the
+    // channel or be cleared by close()
+    void setSession(SecureSession* session) { session_ = session; }
+    bool isOpen() const { return socket_.is_open(); }
+    bool ready() const { return socket_.is_open() && connected_; }
+    // Small, and of a type that may arrive out of order
+    static bool carries(const EncodedFrame& frame);
+    // False if the channel is not ready, has given up on the path or has no
+    // room for the frame, in which case the frame should go on the stream
+    bool send(FramePtr frame);
+    void close();
+
+    const Stats& stats() const { return stats_; }
+    size_t memoryUsage() const { return window_.retainedBytes() + sealed_.capacity(); }
+
+private:
+    static constexpr std::chrono::milliseconds ACK_DELAY{10};
+    static constexpr std::chrono::milliseconds RETRANSMIT_TICK{20};
+    static constexpr size_t ACK_EVERY_FRAMES = 16;
+
+    boost::asio::ip::udp::socket socket_;
+    boost::asio::ip::udp::endpoint remote_;
+    boost::asio::ip::udp::endpoint sender_;
+    bool connected_ = false;
+    bool confirmed_ = false;  // An ack has arrived
+    bool disabled_ = false;
+    int fallbacks_ = 0;       // In a row, since the last ack that settled anything
+    std::array<uint8_t, MAX_DATAGRAM_SIZE + 1> buffer_;  // The spare byte shows a datagram was too long
+    std::vector<uint8_t> sealed_;
+    SecureSession* session_ = nullptr;
+    FrameHandler handler_;
+    Fallback fallback_;
+    SendWindow window_;
+    AckTracker acks_;
+    TimerWheel::Timer ack_timer_;
+    TimerWheel::Timer retransmit_timer_;
+    HandlerMemory handler_memory_;
+    Stats stats_;
+
+    static bool carriesType(PacketType type);
+    void receive();
+    void handleDatagram(size_t size);
+    void transmit(const EncodedFrame& frame, uint32_t sequence);
+    void scheduleAck();
+    void sendAck();
+    void armRetransmitTimer();
+    void retransmitExpired();
+};
+
+#endif // DATAGRAM_H
@@ -0,0 +1,44 @@
+#ifndef FRAMEPARSER_H
+#define FRAMEPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Packet.h"
+
+// Cuts a received byte stream into frames for the io_uring path, where
+// bytes arrive in whatever pieces the kernel filled rather than as exact
+// header and payload reads. Frames that lie wholly inside one fed piece
+// are read straight from it; only a frame split across pieces is gathered
+// in the parser's own buffer.
+class FrameParser {
+public:
+    // data must stay valid until keepRest
+    void feed(const uint8_t* data, size_t size) {
+        view_ = data;
+        view_size_ = size;
+    }
+    // Copies out the next header once all of it has arrived
+    bool peekHeader(PacketHeader& header);
+    // Once the header and length bytes of payload have arrived, copies the
+    // payload out and consumes both
+    bool takeFrame(size_t length, std::vector<uint8_t>& payload);
+    // Drops bytes already available, e.g. to resynchronise on a bad header
+    void skip(size_t bytes);
+    // Saves what is left of the fed piece before it is reused
+    void keepRest();
+    size_t bufferedBytes() const { return buffer_.capacity(); }
+    // Bytes fed but not yet taken
+    size_t unreadBytes() const { return buffer_.size() - offset_ + view_size_; }
+
+private:
+    std::vector<uint8_t> buffer_;
+    size_t offset_ = 0;  // Start of unread bytes in buffer_
+    const uint8_t* view_ = nullptr;
+    size_t view_size_ = 0;
+
+    const uint8_t* contiguous(size_t bytes);
+    void consume(size_t bytes);
+};
+
+#endif // FRAMEPARSER_H
@@ -0,0 +1,119 @@
+#ifndef HANDLERALLOCATOR_H
+#define HANDLERALLOCATOR_H
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Recycling storage for the completion handlers of one connection. A
+// connection has at most a read, a write, a connect and a couple of timer
+// waits in flight at a time, so a few fixed slots cover every async
+// operation and the heap is only touched if a handler is unusually large.
+class HandlerMemory {
+public:
+    static constexpr size_t SLOT_SIZE = 512;
+    static constexpr size_t SLOT_COUNT = 6;
+
+    HandlerMemory() { in_use_.fill(false); }
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* allocate(size_t size) {
+        ++allocations_;
+        if (size <= SLOT_SIZE) {
+            for (size_t i = 0; i < SLOT_COUNT; ++i) {
+                if (!in_use_[i]) {
+                    in_use_[i] = true;
+                    return &storage_[i];
+                }
+            }
+        }
+        ++heap_allocations_;
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer) {
+        for (size_t i = 0; i < SLOT_COUNT; ++i) {
+            if (pointer == &storage_[i]) {
+                in_use_[i] = false;
+                return;
+            }
+        }
+        ::operator delete(pointer);
+    }
+
+    size_t allocationCount() const { return allocations_; }
+    size_t heapAllocationCount() const { return heap_allocations_; }
+
+private:
+    typename std::aligned_storage<SLOT_SIZE, alignof(std::max_align_t)>::type storage_[SLOT_COUNT];
+    std::array<bool, SLOT_COUNT> in_use_;
+    size_t allocations_ = 0;
+    size_t heap_allocations_ = 0;
+};
+
+// Minimal allocator handed to Asio through the associated-allocator hook.
+template <typename T>
+class HandlerAllocator {
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory) : memory_(memory) {}
+
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+    T* allocate(size_t n) const {
+        return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, size_t /*n*/) const {
+        memory_.deallocate(pointer);
+    }
+
+    bool operator==(const HandlerAllocator& other) const noexcept {
+        return &memory_ == &other.memory_;
+    }
+
+    bool operator!=(const HandlerAllocator& other) const noexcept {
+        return &memory_ != &other.memory_;
+    }
+
+private:
+    template <typename> friend class HandlerAllocator;
+
+    HandlerMemory& memory_;
+};
+
+// Wraps a completion handler so that Asio allocates its operation state
+// from the given HandlerMemory instead of the heap.
+template <typename Handler>
+class CustomAllocHandler {
+public:
+    using allocator_type = HandlerAllocator<Handler>;
+
+    CustomAllocHandler(HandlerMemory& memory, Handler handler)
+        : memory_(memory), handler_(std::move(handler)) {}
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type(memory_);
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    HandlerMemory& memory_;
+    Handler handler_;
+};
+
+template <typename Handler>
+inline CustomAllocHandler<Handler> makeCustomAllocHandler(HandlerMemory& memory, Handler handler) {
+    return CustomAllocHandler<Handler>(memory, std::move(handler));
+}
+
+#endif // HANDLERALLOCATOR_H
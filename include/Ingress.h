@@ -0,0 +1,42 @@
+#ifndef INGRESS_H
+#define INGRESS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Per-peer admission control for inbound frames. Tokens refill at rate_ per
+// second up to burst_. A connection stops reading from a peer whose bucket
+// is empty until a token is due, before any checksum or parsing work is
+// spent on its next frame.
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket(double rate, double burst);
+
+    bool consume(Clock::time_point now, double tokens = 1.0);
+    // How long until tokens are available
+    Clock::duration timeUntil(Clock::time_point now, double tokens = 1.0);
+    double available() const { return tokens_; }
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    Clock::time_point last_refill_;
+
+    void refill(Clock::time_point now);
+};
+
+// Where inbound frames left the staged ingress path. Each stage is cheaper
+// than the next, so junk is rejected before it costs a CRC pass or a parse.
+struct IngressStats {
+    uint64_t bad_headers = 0;   // Wrong magic, unknown type or oversized length
+    uint64_t duplicates = 0;    // Id already seen, dropped after peeking at it
+    uint64_t rate_limited = 0;  // Reading paused until the peer's token bucket refilled
+    uint64_t corrupt = 0;       // Checksum or parse failure
+    uint64_t accepted = 0;
+};
+
+#endif // INGRESS_H
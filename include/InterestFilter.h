@@ -0,0 +1,60 @@
+#ifndef INTERESTFILTER_H
+#define INTERESTFILTER_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include "Packet.h"
+
+// Fixed-size Bloom filter of group ids. Group hashing is FNV-1a so every
+// build agrees on the bits a group sets.
+class InterestFilter {
+public:
+    static constexpr size_t BITS = 2048;
+    static constexpr size_t BYTES = BITS / 8;
+    static constexpr size_t NUM_HASHES = 4;
+
+    // A group's bit positions, computed once and tested against many filters
+    struct Key {
+        uint64_t h1;
+        uint64_t h2;
+    };
+    static Key keyFor(const std::string& group);
+
+    void add(const Key& key);
+    bool contains(const Key& key) const;
+    void merge(const InterestFilter& other);
+    bool empty() const;
+
+    bool operator==(const InterestFilter& other) const { return words_ == other.words_; }
+    bool operator!=(const InterestFilter& other) const { return words_ != other.words_; }
+
+    void appendTo(std::vector<uint8_t>& out) const;
+    static InterestFilter read(const uint8_t* data);
+
+private:
+    std::array<uint64_t, BITS / 64> words_{};
+};
+
+// Attenuated interest summary sent to one neighbour. Layer 0 holds the
+// sender's own groups and layer i the groups subscribed i hops behind it,
+// aggregated from what its other neighbours advertised. Every hop pushes a
+// group one layer deeper, so interests that loop around a cycle, or that
+// outlive a leave, fall off the end after DEPTH hops.
+struct InterestAdvert {
+    static constexpr size_t DEPTH = 4;
+
+    std::array<InterestFilter, DEPTH> layers;
+
+    // Some subscriber to the group is reachable through the sender
+    bool mayReach(const InterestFilter::Key& key) const;
+    bool empty() const;
+    bool operator==(const InterestAdvert& other) const { return layers == other.layers; }
+    bool operator!=(const InterestAdvert& other) const { return layers != other.layers; }
+
+    // Payload: DEPTH layers of InterestFilter::BYTES each
+    Packet toPacket() const;
+    static InterestAdvert fromPacket(const Packet& packet);
+};
+
+#endif // INTERESTFILTER_H
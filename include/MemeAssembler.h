@@ -0,0 +1,94 @@
+#ifndef MEMEASSEMBLER_H
+#define MEMEASSEMBLER_H
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Message.h"
+#include "Peer.h"
+
+// Progressive memes passing through a node. Every node remembers the chunk
+// ids listed by recent previews, so it can check each body chunk on its
+// own, and keeps the bodies of recent memes, within MAX_BUFFERED_BYTES, so
+// it can serve their chunks to neighbours fetching them; see Swarm.h.
+// Chunks that overtake their preview are parked, within MAX_PARKED_BYTES,
+// until it turns up.
+//
+// A body is stored chunk by chunk as chunks arrive, but the size its
+// preview claims is set against MAX_BUFFERED_BYTES up front. Making room
+// for a new meme drops older ones that have received nothing first, so a
+// run of previews for bodies that never come costs only each other. A meme
+// still being fetched for delivery is never dropped to make room: a new
+// meme goes without its body instead, unless MAX_MEMES leaves no choice.
+class MemeAssembler {
+public:
+    static constexpr size_t MAX_MEMES = 256;
+    static constexpr size_t MAX_BUFFERED_BYTES = 64 * 1024 * 1024;
+    static constexpr size_t MAX_PARKED_BYTES = 4 * 1024 * 1024;
+
+    enum class Check {
+        Valid,
+        Invalid,  // Not what its preview lists
+        Unknown,  // Preview not seen yet
+    };
+
+    struct Parked {
+        std::weak_ptr<Peer> from;
+        Message chunk;
+    };
+
+    // Tracks a verified preview and buffers its body, to be handed back
+    // whole if deliver is set. Returns the chunks parked for it, to be
+    // handled now.
+    std::vector<Parked> addPreview(const Message& preview, bool deliver);
+    Check check(const Message& chunk) const;
+    void park(const std::shared_ptr<Peer>& from, const Message& chunk);
+    // Stores a valid chunk; true with the whole meme in complete once the
+    // body of a meme kept for delivery is in
+    bool addChunk(const Message& chunk, Message& complete);
+    // The stored chunk at index of a meme, rebuilt from its preview and body
+    bool piece(const MessageId& parent, uint32_t index, Message& chunk) const;
+    // Which chunks of a meme are stored; empty once its body is dropped
+    std::vector<bool> pieces(const MessageId& parent) const;
+    size_t bufferedBytes() const { return buffered_bytes_; }
+    // Drops parked chunks, then the oldest buffered bodies not awaited for
+    // delivery, until what is held fits in bytes
+    void shrinkTo(size_t bytes);
+    // Memes whose bodies were given up before they were complete since the
+    // last call, so fetching their chunks can stop
+    std::vector<MessageId> takeAbandoned() { return std::move(abandoned_); }
+    size_t parkedBytes() const { return parked_bytes_; }
+
+private:
+    struct Meme {
+        Message preview;
+        bool deliver = false;
+        bool keep_body = false;
+        std::vector<std::string> chunks;  // Empty until received
+        std::vector<bool> received;
+        size_t missing = 0;
+    };
+
+    std::unordered_map<MessageId, Meme> memes_;
+    std::deque<MessageId> order_;  // Oldest first
+    std::unordered_map<MessageId, std::vector<Parked>> parked_;
+    std::deque<MessageId> parked_order_;
+    size_t buffered_bytes_ = 0;
+    size_t reserved_bytes_ = 0;
+    size_t parked_bytes_ = 0;
+    std::vector<MessageId> abandoned_;
+
+    // The oldest meme other than keep and those awaited for delivery,
+    // preferring one that has received no chunks, and with want_body only
+    // those still keeping a body; order_.end() if there is none
+    std::deque<MessageId>::iterator victim(const MessageId& keep, bool want_body);
+    static bool awaited(const Meme& meme) { return meme.deliver && meme.missing > 0; }
+    void dropBody(Meme& meme);
+    void abandon(const Meme& meme);
+    void evictParked(const MessageId& parent);
+};
+
+#endif // MEMEASSEMBLER_H
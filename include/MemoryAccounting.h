@@ -0,0 +1,109 @@
+#ifndef MEMORYACCOUNTING_H
+#define MEMORYACCOUNTING_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Running total of the bytes one owner holds, e.g. the dedup filter or the
+// routing state. Counters are atomic so a report may be taken from any
+// thread.
+class MemoryAccount {
+public:
+    explicit MemoryAccount(std::string name) : name_(std::move(name)) {}
+    MemoryAccount(const MemoryAccount&) = delete;
+    MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+    void charge(size_t bytes) {
+        size_t now = bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        size_t peak = peak_.load(std::memory_order_relaxed);
+        while (now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+        }
+    }
+    void release(size_t bytes) { bytes_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+    const std::string& name() const { return name_; }
+    size_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+    size_t peak() const { return peak_.load(std::memory_order_relaxed); }
+
+private:
+    std::string name_;
+    std::atomic<size_t> bytes_{0};
+    std::atomic<size_t> peak_{0};
+};
+
+// Standard allocator that charges what it hands out to a MemoryAccount, for
+// containers whose own storage is the memory worth watching. Without an
+// account it allocates as std::allocator does and counts nothing.
+template <typename T>
+class TrackingAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+
+    TrackingAllocator() noexcept = default;
+    explicit TrackingAllocator(MemoryAccount* account) noexcept : account_(account) {}
+
+    template <typename U>
+    TrackingAllocator(const TrackingAllocator<U>& other) noexcept : account_(other.account_) {}
+
+    T* allocate(size_t n) const {
+        T* pointer = static_cast<T*>(::operator new(sizeof(T) * n));
+        if (account_) {
+            account_->charge(sizeof(T) * n);
+        }
+        return pointer;
+    }
+
+    void deallocate(T* pointer, size_t n) const {
+        if (account_) {
+            account_->release(sizeof(T) * n);
+        }
+        ::operator delete(pointer);
+    }
+
+    MemoryAccount* account() const noexcept { return account_; }
+
+    template <typename U>
+    bool operator==(const TrackingAllocator<U>& other) const noexcept {
+        return account_ == other.account_;
+    }
+
+    template <typename U>
+    bool operator!=(const TrackingAllocator<U>& other) const noexcept {
+        return account_ != other.account_;
+    }
+
+private:
+    template <typename> friend class TrackingAllocator;
+
+    MemoryAccount* account_ = nullptr;
+};
+
+// Where a process's resident memory went. Subsystems and connections are
+// what the node itself accounts for; a frame shared by several connections
+// is counted against each of them, so the parts can add up to more than the
+// resident total. Whatever is left is allocator overhead, code, stacks and
+// anything nobody tracks.
+struct MemoryReport {
+    struct Entry {
+        std::string owner;
+        size_t bytes = 0;
+    };
+
+    size_t resident = 0;
+    std::vector<Entry> subsystems;
+    std::vector<Entry> connections;  // Heaviest first
+
+    size_t accounted() const;
+    // One line per owner, listing at most max_connections connections
+    std::string format(size_t max_connections = 8) const;
+};
+
+// Resident set size of this process, from /proc/self/statm; 0 if unreadable
+size_t residentMemory();
+
+#endif // MEMORYACCOUNTING_H
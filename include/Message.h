@@ -1,46 +1,105 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <ctime>
 #include "Packet.h"
+#include "MessageId.h"
+#include "Tracing.h"
+
+// A progressive meme travels as a Preview followed by the Chunks of its
+// body. The preview is small enough to go out ahead of bulk traffic and be
+// shown at once; it lists every chunk's id, so signing the preview covers
+// the body and each chunk can be checked and relayed on arrival.
+enum class MessageKind : uint8_t {
+    Whole = 0,    // Self-contained message
+    Preview = 1,  // Preview of a progressive meme and the ids of its body chunks
+    Chunk = 2,    // One CHUNK_SIZE piece of a progressive meme's body
+};
 
 class Message {
 public:
+    // Chunks are several fragments long, so they always travel as bulk while
+    // a relay still forwards each one without holding the rest of the body
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t MAX_PREVIEW_SIZE = 8 * 1024;
+    static constexpr size_t MAX_BODY_SIZE = MAX_PAYLOAD_SIZE;
+    static constexpr size_t MAX_CHUNKS = MAX_BODY_SIZE / CHUNK_SIZE;
+    static constexpr uint8_t TRACE_EXTENSION = 1;  // Tag of the trailer holding a MessageTrace
+
     Message();
     Message(const std::string& group_id, const std::string& sender_id, const std::string& content);
 
+    // Builds a message whose id is derived from sender, timestamp and content
+    static Message contentAddressed(const std::string& group_id, const std::string& sender_id,
+                                    const std::string& content);
+    // Splits a meme into its preview, first, and body chunks. Sign the
+    // preview and send every part in order. Throws if either part is empty
+    // or too large.
+    static std::vector<Message> progressive(const std::string& group_id, const std::string& sender_id,
+                                            const std::string& preview, const std::string& body);
+    // Body chunk index of the meme a preview describes, holding content
+    static Message chunk(const Message& preview, uint32_t index, std::string content);
+    // The whole meme rebuilt from a preview and its joined body. It keeps
+    // the preview's id and signature.
+    static Message assembled(const Message& preview, std::string body);
+
     std::vector<Packet> serialize() const;
     static Message deserialize(const std::vector<Packet>& packets);
 
+    // Encoded payload, built on first use and shared by every send of this
+    // message. A message decoded from the wire keeps the bytes it arrived
+    // in, so relaying it unchanged never re-encodes. Setters invalidate it.
+    // Throws std::runtime_error if the group, sender or signature is over
+    // 65535 bytes, the most their length fields hold.
+    FramePtr encode() const;
+    static Message decode(FramePtr frame);
+    // Reads just the id from an undecoded, unverified Data payload
+    static bool peekId(const std::vector<uint8_t>& payload, MessageId& id);
+
     // Getters
-    std::string getMessageId() const { return message_id; }
+    const MessageId& getMessageId() const { return message_id; }
     std::string getGroupId() const { return group_id; }
     std::string getSenderId() const { return sender_id; }
     time_t getTimestamp() const { return timestamp; }
-    std::string getContent() const { return content; }
+    const std::string& getContent() const { return content; }
     std::string getSignature() const { return signature; }
     int getTTL() const { return ttl; }
-    bool isAcknowledgment() const { return is_acknowledgment; }
+    MessageKind getKind() const { return kind; }
+    size_t getBodySize() const { return body_size; }                          // Preview only
+    const std::vector<MessageId>& getChunkIds() const { return chunk_ids; }  // Preview only
+    const MessageId& getParentId() const { return parent_id; }              // Chunk only
+    uint32_t getChunkIndex() const { return chunk_index; }                  // Chunk only
+    const MessageTrace* getTrace() const { return trace.get(); }            // Null unless sampled
+    // When this node read the message off the wire; set only if traced
+    uint64_t getReceivedAt() const { return received_us; }
 
     // Setters
+    void setMessageId(const MessageId& id);
     void setContent(const std::string& new_content);
     void setSignature(const std::string& sig);
     void setTTL(int new_ttl);
-    void setAsAcknowledgment(bool is_ack);
+    void setTrace(MessageTrace new_trace);
+    void setReceivedAt(uint64_t us) { received_us = us; }
 
 private:
-    std::string message_id;
+    MessageId message_id;
     std::string group_id;
     std::string sender_id;
     time_t timestamp;
     std::string content;
     std::string signature;
     int ttl;
-    bool is_acknowledgment;
-
-    static std::string generateMessageId();
+    MessageKind kind = MessageKind::Whole;
+    size_t body_size = 0;
+    std::vector<MessageId> chunk_ids;
+    MessageId parent_id;
+    uint32_t chunk_index = 0;
+    std::shared_ptr<const MessageTrace> trace;
+    uint64_t received_us = 0;
+    mutable FramePtr encoded_;
 };
 
 #endif // MESSAGE_H
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef MESSAGEID_H
+#define MESSAGEID_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+// 128-bit message identifier. It is carried raw on the wire at the start of
+// every Data payload and used as-is for dedup, so comparing or hashing an id
+// never touches the heap.
+struct MessageId {
+    static constexpr size_t SIZE = 16;
+
+    std::array<uint8_t, SIZE> bytes{};
+
+    static MessageId random();
+    // Identical (sender, timestamp, content) triples map to the same id, so
+    // a repost of the same meme is deduplicated like a forwarded copy.
+    static MessageId fromContent(const std::string& sender_id, time_t timestamp,
+                                 const std::string& content);
+    // Id of one body chunk of a progressive meme. It binds the chunk's bytes
+    // to its place in the meme, so the preview's list of chunk ids lets any
+    // node check a chunk on its own.
+    static MessageId forChunk(const MessageId& parent, uint32_t index, const std::string& content);
+    static MessageId fromBytes(const uint8_t* data);
+
+    bool isNull() const;
+    std::string toHex() const;  // For logging
+
+    // Ids are uniformly distributed, so their halves serve directly as hashes
+    uint64_t high() const { uint64_t v; std::memcpy(&v, bytes.data(), 8); return v; }
+    uint64_t low() const { uint64_t v; std::memcpy(&v, bytes.data() + 8, 8); return v; }
+
+    bool operator==(const MessageId& other) const { return bytes == other.bytes; }
+    bool operator!=(const MessageId& other) const { return bytes != other.bytes; }
+    bool operator<(const MessageId& other) const { return bytes < other.bytes; }
+};
+
+static_assert(std::is_trivially_copyable<MessageId>::value, "MessageId must be trivially copyable");
+static_assert(sizeof(MessageId) == MessageId::SIZE, "MessageId must be exactly 16 bytes");
+
+namespace std {
+template <>
+struct hash<MessageId> {
+    size_t operator()(const MessageId& id) const noexcept {
+        return static_cast<size_t>(id.high() ^ id.low());
+    }
+};
+}
+
+#endif // MESSAGEID_H
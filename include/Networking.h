@@ -6,37 +6,253 @@
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <deque>
+#include <random>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <ctime>
 #include "Message.h"
 #include "RoutingTable.h"
 #include "BloomFilter.h"
+#include "Peer.h"
 #include "PeerConnection.h"
+#include "HandlerAllocator.h"
+#include "PeerExchange.h"
+#include "SizeEstimator.h"
+#include "SecureSession.h"
+#include "PeerCache.h"
+#include "MemeAssembler.h"
+#include "WorkerPool.h"
+#include "MemoryAccounting.h"
+#include "Swarm.h"
+#include "Tracing.h"
 
 class Network {
 public:
+    using PeerFactory = std::function<std::shared_ptr<Peer>(const std::string& server, const std::string& port)>;
+    // Checks a parsed message's origin signature; false drops it. Must be
+    // safe to call from several threads at once if verification workers
+    // are set.
+    using MessageVerifier = std::function<bool(const Message&)>;
+    // Receives each new message for a group this node has joined. A
+    // progressive meme arrives twice: its preview as soon as it lands, then
+    // the whole meme, with the preview's id, once the last chunk is in.
+    using DeliveryHandler = std::function<void(const Message&)>;
+    // Seconds since the Unix epoch; picks the size estimator's epoch
+    using WallClock = std::function<std::time_t()>;
+    // Times piece requests and the churn reported in peer exchanges
+    using SteadyClock = std::function<Swarm::Clock::time_point()>;
+    // Microseconds since the Unix epoch; stamps the hops of traced messages
+    using TraceClock = std::function<uint64_t()>;
+
+    // Hard limits on what the node holds, in bytes; zero means no limit.
+    // Each budget is met by shedding from what it covers, so neighbours are
+    // only ever disconnected for what the connections themselves hold. The
+    // seen filter, routing state, swarm, peer lists and peer cache have no
+    // budget of their own: their sizes are capped by the network size
+    // estimate, MAX_PEERS and fixed tables.
+    struct MemoryBudgets {
+        size_t per_connection = 0;  // Past this, bulk frames to a neighbour are dropped
+        size_t connections = 0;     // Past this, over all neighbours, the heaviest are disconnected
+        size_t memes = 0;           // Past this, parked chunks and then the oldest meme bodies are dropped
+        size_t worker_queue = 0;    // Per worker pool; past this, deliveries are dropped and checks run inline
+    };
+
+    // estimated_network_size is only a starting guess, replaced by the live
+    // estimate once a neighbour's size sketch arrives
     Network(boost::asio::io_context& io_context, size_t estimated_network_size);
+    // Replaces how addresses learned from peer exchange are dialled
+    void setPeerFactory(PeerFactory factory);
+    void setMessageVerifier(MessageVerifier verifier);
+    void setDeliveryHandler(DeliveryHandler handler);
+    // Moves the delivery handler off the io thread onto threads workers fed
+    // by a queue of capacity messages. Deliveries then overlap and may be
+    // reordered, and while the queue is full new ones are dropped. Call
+    // after setDeliveryHandler and before traffic starts.
+    void setDeliveryWorkers(size_t threads, size_t capacity);
+    WorkerPool::Stats deliveryStats() const;
+    // Moves signature checks off the io thread onto threads workers fed by
+    // a queue of capacity messages; the verdict is posted back to the io
+    // thread, which then forwards and delivers. While the queue is full
+    // the io thread checks messages itself. Call after setMessageVerifier
+    // and before traffic starts.
+    void setVerificationWorkers(size_t threads, size_t capacity);
+    // The port this node accepts connections on, advertised in peer requests
+    // so seeds can hand it out. Network has no listener of its own, so until
+    // this is set it advertises none and seeds never hand it out.
+    void setListenPort(uint16_t port);
+    // Connections dialled after this run an authenticated, encrypted session
+    void setIdentity(std::shared_ptr<const NodeIdentity> identity);
+    // Connections dialled after this offer to carry small frames as UDP
+    // datagrams, see DatagramChannel
+    void setDatagrams(bool enabled);
+    void seedRandom(uint32_t seed);
+    void setWallClock(WallClock clock);
+    void setSteadyClock(SteadyClock clock);
+    // PeerConnection stamps arrivals with traceClockNow whatever this is set
+    // to, so only replace it where the peers are not PeerConnections
+    void setTraceClock(TraceClock clock);
+    // Traces sample_rate of the messages sent from this node. Every node
+    // adds itself to the trace of a message it forwards, and one with a
+    // collector also records the path each traced message took to it. A
+    // collector may be shared by several nodes to see the whole spread.
+    void setTracing(double sample_rate, std::shared_ptr<TraceCollector> collector);
+    // Remembers peers across restarts in the file at path; throws if it
+    // cannot be opened. Call before bootstrapNetwork.
+    void openPeerCache(const std::string& path);
+    size_t estimatedNetworkSize() const;
+    // Dials the best cached peers, falling back to the seeds if too few answer
     void bootstrapNetwork(const std::vector<std::string>& seedNodes);
     void sendMessage(const Message& msg);
     void broadcastMessage(const Message& msg);
-    void addPeer(std::shared_ptr<PeerConnection> peer);
-    void updatePeerList(const std::string& peerListStr);
+    void addPeer(std::shared_ptr<Peer> peer);
+    void requestPeers();
+    // Subscriptions are advertised to neighbours, so only groups joined
+    // somewhere downstream are routed through this node
+    void joinGroup(const std::string& group);
+    void leaveGroup(const std::string& group);
     void startPeriodicPeerListUpdate();
-    
+    // Applies to current and future neighbours and worker pools. Budgets are
+    // checked every MEMORY_CHECK_INTERVAL: memes are shed down to theirs, a
+    // neighbour over its own budget even after shedding bulk frames is not
+    // reading what it is sent, and is dropped, and while the connections
+    // together are over budget the heaviest go first.
+    void setMemoryBudgets(const MemoryBudgets& budgets);
+    // Resident memory broken down by subsystem and connection
+    MemoryReport memoryReport();
+    // Reissues piece requests that have timed out. Runs every SWARM_TICK on
+    // the io_context while memes are being fetched; the simulator, which
+    // never runs its io_context, calls it itself.
+    void pollPieceRequests();
+
 private:
     boost::asio::io_context& io_context_;
+    MemoryAccount seen_memory_{"seen filter"};
+    MemoryAccount routing_memory_{"routing"};
     RoutingTable routing_table_;
-    std::vector<std::shared_ptr<PeerConnection>> peers_;
+    std::vector<std::shared_ptr<Peer>> peers_;
     BloomFilter bloom_filter_;
     size_t estimated_network_size_;
     boost::asio::steady_timer peer_update_timer_;
     std::mutex peers_mutex_;
+    HandlerMemory handler_memory_;
+    std::mt19937 rng_;
+    PeerFactory peer_factory_;
+    MessageVerifier message_verifier_;
+    DeliveryHandler delivery_handler_;
+    std::shared_ptr<const NodeIdentity> identity_;
+    bool datagrams_ = false;
+    uint16_t listen_port_ = 0;
+    WallClock wall_clock_;
+    SteadyClock steady_clock_;
+    TraceClock trace_clock_;
+    uint64_t node_id_ = 0;  // Random; names this node in size sketches and traces
+    double trace_sample_rate_ = 0;
+    std::shared_ptr<TraceCollector> trace_collector_;
+    SizeEstimator size_estimator_;
+    std::unique_ptr<PeerCache> peer_cache_;
+    MemeAssembler memes_;
+    Swarm swarm_;
+    boost::asio::steady_timer swarm_timer_;
+    bool swarm_timer_armed_ = false;
+    std::unique_ptr<WorkerPool> delivery_pool_;
+    bool delivery_backlogged_ = false;
+    std::unique_ptr<WorkerPool> verify_pool_;
+    boost::asio::steady_timer bootstrap_timer_;
+    MemoryBudgets memory_budgets_;
+    boost::asio::steady_timer memory_timer_;
+
+    static constexpr size_t MAX_PEERS = 64;
+    static constexpr size_t MAX_CANDIDATES = 256;
+    static constexpr size_t MAX_REMOVED_HISTORY = 256;
+    static constexpr size_t BLOOM_BITS_PER_NODE = 10;
+    static constexpr size_t MIN_BLOOM_BITS = 1 << 16;
+    static constexpr size_t MAX_BLOOM_BITS = size_t(1) << 27;  // 16 MiB
+    // A neighbour's sketch is merged only while it claims at most
+    // SIZE_OUTLIER_FACTOR times the median of what the neighbours claim,
+    // once SIZE_QUORUM of them have been heard from
+    static constexpr double SIZE_OUTLIER_FACTOR = 4.0;
+    static constexpr size_t SIZE_QUORUM = 3;
+    static constexpr size_t CACHED_DIALS = 16;
+    static constexpr size_t MAX_WAITING_COPIES = 4;  // Per message id awaiting verification
+    // A neighbour is served pieces only while less than this much sent to
+    // it is unacked, and the same piece again only once it could have given
+    // up waiting for the last copy
+    static constexpr size_t MAX_SERVING_BYTES =
+        (Swarm::REQUESTS_PER_PEER + Swarm::ENDGAME_REQUESTS) * Message::CHUNK_SIZE;
+    static constexpr std::chrono::milliseconds SERVE_AGAIN_AFTER = Swarm::MIN_REQUEST_TIMEOUT;
+    static constexpr size_t MIN_WARM_PEERS = 4;
+    static constexpr std::chrono::seconds SEED_FALLBACK_DELAY{2};
+    static constexpr std::chrono::seconds MEMORY_CHECK_INTERVAL{1};
+    static constexpr std::chrono::milliseconds SWARM_TICK{100};  // Retries timed-out piece requests
+
+    // Addresses learned from exchanges while at MAX_PEERS, and recently
+    // closed peers reported to neighbours as removals.
+    std::vector<PeerAddress> candidates_;
+    std::deque<std::pair<Peer::Clock::time_point, PeerAddress>> removed_peers_;
+    // Size each neighbour's last sketch claimed
+    std::map<std::shared_ptr<Peer>, double> neighbour_sizes_;
+    // Chunks served to each neighbour within SERVE_AGAIN_AFTER, by id and
+    // oldest first
+    struct Served {
+        std::unordered_map<MessageId, Swarm::Clock::time_point> at;
+        std::deque<std::pair<Swarm::Clock::time_point, MessageId>> order;
+    };
+    std::map<std::shared_ptr<Peer>, Served> served_;
+    // Copies of messages out with the verification workers, first copy
+    // first. Later copies wait rather than being checked too, and are only
+    // checked if the one before them turns out to be forged.
+    struct PendingVerification {
+        std::weak_ptr<Peer> from;
+        Message msg;
+        uint64_t dequeued_us;
+    };
+    std::unordered_map<MessageId, std::deque<PendingVerification>> verifying_;
+
+    std::set<std::string> groups_;
+    InterestFilter local_interests_;
+    // Last advert sent to each peer
+    using AdvertMap = std::map<std::shared_ptr<Peer>, InterestAdvert, std::less<std::shared_ptr<Peer>>,
+                               TrackingAllocator<std::pair<const std::shared_ptr<Peer>, InterestAdvert>>>;
+    AdvertMap advertised_;
+    // Control packets queued while peers_mutex_ is held
+    std::vector<std::pair<std::shared_ptr<Peer>, Packet>> outbox_;
 
-    void handleIncomingMessage(const Message& msg);
-    void sendAcknowledgment(const Message &msg);
+    void attachPeer(const std::shared_ptr<Peer>& peer);
+    // A copy of peers_ to send to once peers_mutex_ is released
+    std::vector<std::shared_ptr<Peer>> peersSnapshot();
+    // Sends what was queued in outbox_; caller must not hold peers_mutex_
+    void sendQueued();
+    void handleIncomingMessage(const std::shared_ptr<Peer>& from, const Message& msg);
+    void verify(const Message& msg);
+    void verified(MessageId id, bool valid);
+    void acceptMessage(const std::shared_ptr<Peer>& from, const Message& msg, bool consumer, uint64_t dequeued_us);
+    void deliver(Message msg);
+    void handleChunk(const std::shared_ptr<Peer>& from, const Message& chunk);
+    void stopAbandonedMemes();
+    void announcePieces(const MessageId& meme);
+    void requestPieces();
+    void servePiece(const std::shared_ptr<Peer>& peer, const PieceRequest& request);
+    void handleControlPacket(const std::shared_ptr<Peer>& peer, const Packet& packet);
+    void handlePeerClosed(const std::shared_ptr<Peer>& peer);
     bool addPeerIfNew(const std::string &server, const std::string &port);
-    void sendPeerList();
-    bool shouldForwardMessage() const;
+    void dialSeeds(const std::vector<std::string>& seedNodes);
+    Packet makePeerRequest();
+    void sendPeerExchange(const std::shared_ptr<Peer>& requester);
+    void applyPeerExchange(const std::shared_ptr<Peer>& from, const PeerExchange& exchange);
+    void mergeSizeSketch(const std::shared_ptr<Peer>& from, const SizeSketch& sketch);
+    uint32_t currentEpoch() const;
+    static size_t bloomBitsFor(size_t network_size);
+    bool shouldForwardMessage();
     int calculateFloodRadius() const;
-    void forwardMessage(const Message& msg);
+    void forwardMessage(const Message& msg, const std::shared_ptr<Peer>& from);
+    Message addTraceHop(const Message& msg, uint64_t received_us, uint64_t dequeued_us);
+    bool isSubscribed(const std::string& group);
+    void advertiseInterests();
+    std::vector<MemoryReport::Entry> subsystemMemory();
+    void scheduleMemoryCheck();
+    void enforceMemoryBudgets();
 };
 
 std::string computeProofOfWork(const std::string& challenge, int difficulty);
@@ -1,24 +1,110 @@
 #ifndef PACKET_H
 #define PACKET_H
 
+#include <array>
 #include <vector>
 #include <cstdint>
+#include <memory>
 #include <string>
 
 const uint32_t MAGIC_NUMBER = 0x54454C45;  // "TELE" in ASCII
+const size_t PACKET_HEADER_SIZE = 20;
+const size_t MAX_PAYLOAD_SIZE = 16 * 1024 * 1024;
+
+enum class PacketType : uint8_t {
+    Data = 0,  // Serialized Message
+    Ack = 1,   // Cumulative acknowledgment, see Reliability.h
+    PeerRequest = 2,   // Ask a neighbour for a PeerExchange
+    PeerExchange = 3,  // Peer sample and deltas, see PeerExchange.h
+    Handshake = 4,     // Signed session key, see SecureSession.h
+    Interest = 5,      // Group subscriptions behind a neighbour, see InterestFilter.h
+    Keepalive = 6,     // Liveness probe, one byte: KEEPALIVE_PING is answered with KEEPALIVE_PONG
+    Admission = 7,     // Proof-of-work challenge or solution, see Admission.h
+    Have = 8,          // Pieces of a meme the sender can serve, see Swarm.h
+    PieceRequest = 9,  // Ask a neighbour for one piece of a meme, see Swarm.h
+    Datagram = 10,     // The sender's UDP port for small frames, see Datagram.h
+};
+
+const uint8_t KEEPALIVE_PING = 0;
+const uint8_t KEEPALIVE_PONG = 1;
+
+const uint8_t ADMISSION_CHALLENGE = 0;
+const uint8_t ADMISSION_SOLUTION = 1;
+
+// Header flags
+const uint8_t PACKET_FLAG_SEALED = 0x01;  // Payload is AEAD ciphertext plus tag
+const uint8_t PACKET_FLAG_FRAGMENT = 0x02;       // One piece of a frame larger than FRAGMENT_SIZE
+const uint8_t PACKET_FLAG_LAST_FRAGMENT = 0x04;  // Final piece, the frame is complete
+
+// Frames larger than this are written as a run of fragments, so that other
+// frames can be sent between them; see SendScheduler.h. Every fragment's
+// header repeats the frame's type, sequence and whole-payload CRC, or zero
+// in its place if sealed.
+const size_t FRAGMENT_SIZE = 16 * 1024;
 
 struct Packet {
     uint32_t magic;           // Magic number to identify start of packet (e.g., 0x54454C45 for "TELE")
     uint32_t length;          // Length of the payload
-    uint32_t sequence;        // Sequence number for ordering packets
+    uint32_t sequence;        // Per-connection sequence number, 0 for unsequenced control frames
     uint32_t checksum;        // CRC32 checksum of the payload
+    PacketType type = PacketType::Data;
+    uint8_t flags = 0;
     std::vector<uint8_t> payload;  // Actual message content
 };
 
+// A payload encoded once and shared, immutable, by every send queue and
+// retransmit window that carries it. Only the header, which holds the
+// per-connection sequence number, is written per send.
+struct EncodedFrame {
+    PacketType type;
+    uint32_t checksum;
+    std::vector<uint8_t> payload;
+};
+
+using FramePtr = std::shared_ptr<const EncodedFrame>;
+using PacketHeader = std::array<uint8_t, PACKET_HEADER_SIZE>;
+
+FramePtr makeFrame(PacketType type, std::vector<uint8_t> payload);
+FramePtr makeFrame(Packet packet);
+PacketHeader makePacketHeader(const EncodedFrame& frame, uint32_t sequence, uint8_t flags = 0);
+PacketHeader makePacketHeader(PacketType type, uint32_t length, uint32_t sequence,
+                              uint32_t checksum, uint8_t flags);
+
+// Cheap sanity check of a raw header before its payload is read: magic,
+// known type and a bounded length. Does not touch the payload or its CRC.
+bool isValidHeader(const uint8_t* header);
+
+// Joins the fragments of one frame. Fragments of different frames never
+// interleave on a connection, so one reassembler per connection suffices.
+class FragmentReassembler {
+public:
+    // Returns true with the whole frame in piece once its last fragment has
+    // been added. Throws if the frame outgrows MAX_PAYLOAD_SIZE or, when
+    // verify_checksum is set, if the joined payload fails its CRC.
+    bool add(Packet& piece, bool verify_checksum);
+    bool active() const { return active_; }
+    size_t bufferedBytes() const { return payload_.capacity(); }
+
+private:
+    bool active_ = false;
+    std::vector<uint8_t> payload_;
+};
 
 Packet createPacket(const std::string& message, uint32_t sequence);
+Packet createPacket(PacketType type, std::vector<uint8_t> payload, uint32_t sequence);
 std::vector<uint8_t> serializePacket(const Packet& packet);
 Packet deserializePacket(const std::vector<uint8_t>& data);
+// Fragments are not checksummed here; FragmentReassembler checks the whole frame
+Packet deserializePacket(const uint8_t* header, const std::vector<uint8_t>& payload);
+// Header fields only; the payload is left empty and nothing is verified
+Packet parsePacketHeader(const uint8_t* header);
+uint16_t readUint16(const uint8_t* data, size_t offset);
+uint32_t readUint32(const uint8_t* data, size_t offset);
+uint64_t readUint64(const uint8_t* data, size_t offset);
+void appendUint16(std::vector<uint8_t>& out, uint16_t value);
+void appendUint32(std::vector<uint8_t>& out, uint32_t value);
+void appendUint64(std::vector<uint8_t>& out, uint64_t value);
 uint32_t calculateCRC32(const std::vector<uint8_t>& data);
+uint32_t calculateCRC32(const uint8_t* data, size_t size);
 
 #endif // PACKET_H
@@ -0,0 +1,71 @@
+#ifndef PEER_H
+#define PEER_H
+
+#include <boost/asio/ip/tcp.hpp>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include "Message.h"
+#include "Packet.h"
+
+// A neighbour as seen by Network. PeerConnection is the TCP implementation;
+// the simulator supplies an in-memory one so the same Network logic can be
+// exercised over thousands of virtual nodes.
+class Peer : public std::enable_shared_from_this<Peer> {
+public:
+    using Clock = std::chrono::steady_clock;
+    using MessageHandler = std::function<void(const std::shared_ptr<Peer>&, const Message&)>;
+    using ControlHandler = std::function<void(const std::shared_ptr<Peer>&, const Packet&)>;
+    using CloseHandler = std::function<void(const std::shared_ptr<Peer>&)>;
+    // Asked with a peeked id before a Data frame is checksummed or parsed
+    using SeenFilter = std::function<bool(const MessageId&)>;
+
+    virtual ~Peer() = default;
+
+    virtual void start() = 0;
+    // False if the message was dropped rather than queued
+    virtual bool sendMessage(const Message& msg) = 0;
+    virtual void sendControl(Packet packet) = 0;
+
+    virtual std::string getAddress() const = 0;
+    virtual bool isConnected() const = 0;
+    virtual boost::asio::ip::tcp::endpoint remoteEndpoint() const = 0;
+    virtual Clock::time_point connectedAt() const = 0;
+    // True once frames from this neighbour are protected by a session keyed
+    // to its identity, so what it relays need not be re-verified here
+    virtual bool isAuthenticated() const { return false; }
+    // The neighbour's Ed25519 identity once authenticated, zero before
+    virtual std::array<uint8_t, 32> remoteIdentity() const { return {}; }
+    // Bytes this neighbour's queues and buffers hold. A frame fanned out to
+    // several neighbours is counted against each one holding it.
+    virtual size_t memoryUsage() const { return 0; }
+    // Bytes of messages sent or queued to this neighbour not yet acked
+    virtual size_t unackedBytes() const { return 0; }
+    // Once memoryUsage would pass budget, bulk frames for this neighbour are
+    // dropped instead of queued; zero means no limit
+    virtual void setMemoryBudget(size_t /*budget*/) {}
+    // Drops the link; the close handler runs as if the neighbour had left
+    virtual void disconnect() {}
+
+    void setMessageHandler(MessageHandler handler) { message_handler_ = std::move(handler); }
+    void setControlHandler(ControlHandler handler) { control_handler_ = std::move(handler); }
+    void setCloseHandler(CloseHandler handler) { close_handler_ = std::move(handler); }
+    void setSeenFilter(SeenFilter filter) { seen_filter_ = std::move(filter); }
+
+    // When this neighbour last received a PeerExchange from us
+    Clock::time_point lastPeerExchange() const { return last_peer_exchange_; }
+    void setLastPeerExchange(Clock::time_point when) { last_peer_exchange_ = when; }
+
+protected:
+    MessageHandler message_handler_;
+    ControlHandler control_handler_;
+    CloseHandler close_handler_;
+    SeenFilter seen_filter_;
+
+private:
+    Clock::time_point last_peer_exchange_;
+};
+
+#endif // PEER_H
@@ -0,0 +1,107 @@
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PeerExchange.h"
+
+// Peers this node has talked to, kept in a small memory-mapped file so a
+// restarted node can dial them straight away instead of rediscovering the
+// overlay through the seeds. Each entry holds the peer's address, when it
+// was last seen, a score from its past sessions and its identity key if the
+// link was sealed. Entries are updated in place; a CRC over the whole table
+// is rewritten with every change, so a file left half-written by a crash is
+// detected on the next start and the cache begins empty rather than wrong.
+// Sessions starting and ending change the table at once; peers being heard
+// from, which happens on every control frame, is noted in memory and only
+// written to the table on flush().
+// Fields are stored in host byte order, as the file never leaves the host.
+class PeerCache {
+public:
+    using NodeId = std::array<uint8_t, 32>;  // Ed25519 identity, zero if unknown
+
+    static constexpr size_t CAPACITY = 1024;
+    static constexpr int32_t MAX_SCORE = 100;
+    static constexpr int32_t MIN_SCORE = -100;
+
+    struct Entry {
+        PeerAddress address;
+        std::time_t last_seen = 0;
+        int32_t score = 0;
+        NodeId node_id{};
+    };
+
+    // Opens or creates the cache file; throws if it cannot be mapped
+    explicit PeerCache(const std::string& path);
+    ~PeerCache();
+    PeerCache(const PeerCache&) = delete;
+    PeerCache& operator=(const PeerCache&) = delete;
+
+    // The peer answered us; a non-zero node_id replaces the stored one.
+    // Kept in memory until the next flush().
+    void recordSeen(const PeerAddress& address, std::time_t now, const NodeId& node_id);
+    // A session ended: connected at some point, or never got that far.
+    // Failures only count against peers already in the cache.
+    void recordSession(const PeerAddress& address, std::time_t now, bool connected);
+    // Up to count entries, best first: high score, then recently seen
+    std::vector<Entry> best(size_t count, std::time_t now) const;
+    size_t size() const;
+    // The mapped table and the peers noted since the last flush
+    size_t memoryUsage() const;
+    // Writes out what recordSeen noted, then schedules the mapped pages to
+    // be written back to disk
+    void flush();
+
+private:
+    // One 64-byte slot in the file
+    struct Record {
+        uint8_t family;  // 0 for an empty slot, else 4 or 6
+        uint8_t reserved;
+        uint16_t port;
+        int32_t score;
+        int64_t last_seen;
+        uint8_t address[16];
+        uint8_t node_id[32];
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+        uint32_t checksum;  // CRC32 of the record table
+    };
+
+    static constexpr uint32_t MAGIC = 0x544C5043;  // "TLPC"
+    static constexpr uint32_t VERSION = 1;
+    static_assert(sizeof(Record) == 64, "Peer cache records are 64 bytes");
+    static constexpr size_t FILE_SIZE = sizeof(Header) + CAPACITY * sizeof(Record);
+
+    struct Seen {
+        std::time_t last_seen;
+        NodeId node_id;
+    };
+
+    int fd_ = -1;
+    uint8_t* map_ = nullptr;
+    // At most CAPACITY peers heard from since the last flush
+    std::unordered_map<PeerAddress, Seen, PeerAddressHash> seen_;
+
+    Header* header() const { return reinterpret_cast<Header*>(map_); }
+    Record* records() const { return reinterpret_cast<Record*>(map_ + sizeof(Header)); }
+    uint32_t checksum() const;
+    bool valid() const;
+    void reset();
+    Record* find(const PeerAddress& address) const;
+    Record* findOrInsert(const PeerAddress& address, std::time_t now);
+    static Entry toEntry(const Record& record);
+    static double rank(const Record& record, std::time_t now);
+    void commit();
+    void applySeen();
+};
+
+#endif // PEERCACHE_H
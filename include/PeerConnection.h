@@ -2,29 +2,175 @@
 #define PEERCONNECTION_H
 
 #include <boost/asio.hpp>
+#include <array>
+#include <deque>
 #include <string>
 #include <functional>
 #include <memory>
+#include "Datagram.h"
 #include "Message.h"
+#include "Packet.h"
+#include "Peer.h"
+#include "HandlerAllocator.h"
+#include "Reliability.h"
+#include "Ingress.h"
+#include "SecureSession.h"
+#include "SendScheduler.h"
+#include "TimerWheel.h"
+#ifdef TELELIBRE_IO_URING
+#include "FrameParser.h"
+#include "UringReactor.h"
+#endif
 
-class PeerConnection : public std::enable_shared_from_this<PeerConnection> {
+class PeerConnection : public Peer
+#ifdef TELELIBRE_IO_URING
+    , private UringReactor::Receiver
+#endif
+{
 public:
-    PeerConnection(boost::asio::io_context& io_context, 
+    PeerConnection(boost::asio::io_context& io_context,
                    const std::string& server, const std::string& port);
+    ~PeerConnection() override;
 
-    void start();
-    void sendMessage(const Message& msg);
+    // Seals the connection with a SecureSession; call before start()
+    void setIdentity(std::shared_ptr<const NodeIdentity> identity);
+    // Offers the peer a DatagramChannel for small frames; call before start()
+    void enableDatagrams() { datagrams_enabled_ = true; }
+    void start() override;
+    bool sendMessage(const Message& msg) override;
+    void sendControl(Packet packet) override;
     void receiveMessage();
-    void setMessageHandler(std::function<void(const Message&)> handler);
 
-    std::string getAddress() const { return server_ + ":" + port_; }
+    std::string getAddress() const override { return server_ + ":" + port_; }
+    bool isConnected() const override { return connected_; }
+    boost::asio::ip::tcp::endpoint remoteEndpoint() const override { return remote_endpoint_; }
+    Clock::time_point connectedAt() const override { return connected_at_; }
+    bool isAuthenticated() const override { return session_ && session_->established(); }
+    std::array<uint8_t, 32> remoteIdentity() const override {
+        return isAuthenticated() ? session_->remoteIdentity() : std::array<uint8_t, 32>{};
+    }
+    size_t memoryUsage() const override;
+    size_t unackedBytes() const override { return send_window_.retainedBytes() + backlog_bytes_; }
+    void setMemoryBudget(size_t budget) override { memory_budget_ = budget; }
+    void disconnect() override { close(); }
+    const HandlerMemory& handlerMemory() const { return handler_memory_; }
+    const IngressStats& ingressStats() const { return ingress_stats_; }
+    // Bulk frames dropped for being over the memory budget
+    uint64_t shedFrames() const { return shed_frames_; }
+    DatagramChannel::Stats datagramStats() const {
+        return datagrams_ ? datagrams_->stats() : DatagramChannel::Stats();
+    }
 
 private:
     boost::asio::ip::tcp::socket socket_;
     std::string server_;
     std::string port_;
-    boost::asio::streambuf receive_buffer_;
-    std::function<void(const Message&)> message_handler_;
+    bool connected_ = false;
+    bool closed_ = false;
+    boost::asio::ip::tcp::endpoint remote_endpoint_;
+    Clock::time_point connected_at_;
+    std::array<uint8_t, PACKET_HEADER_SIZE> header_buffer_;
+    std::vector<uint8_t> payload_buffer_;
+    // Header is per connection; the payload is shared with every other
+    // connection sending the same frame.
+    // Sealed frames carry their own ciphertext instead.
+    struct OutgoingFrame {
+        PacketHeader header;
+        SendScheduler::Piece piece;
+        std::vector<uint8_t> sealed;
+    };
+    SendScheduler scheduler_;
+    OutgoingFrame in_flight_;  // Owns the bytes of the write in progress
+    bool writing_ = false;
+    FragmentReassembler reassembler_;
+    bool discarding_fragments_ = false;  // Rest of a dropped fragmented frame
+    HandlerMemory handler_memory_;
+
+    static constexpr std::chrono::milliseconds ACK_DELAY{20};
+    static constexpr std::chrono::milliseconds RETRANSMIT_TICK{50};
+    static constexpr size_t ACK_EVERY_FRAMES = 32;
+
+    AckTracker ack_tracker_;
+    SendWindow send_window_;
+    std::deque<FramePtr> window_backlog_;  // Waiting for room in send_window_
+    size_t backlog_bytes_ = 0;  // In window_backlog_ and awaiting_handshake_
+    size_t memory_budget_ = 0;
+    uint64_t shed_frames_ = 0;
+    // Connection deadlines, all on the io_context's shared TimerWheel. A
+    // peer that sends nothing for KEEPALIVE_INTERVAL is pinged, and one that
+    // stays silent for IDLE_TIMEOUT is dropped.
+    static constexpr std::chrono::seconds KEEPALIVE_INTERVAL{30};
+    static constexpr std::chrono::seconds IDLE_TIMEOUT{90};
+    static constexpr std::chrono::seconds HANDSHAKE_TIMEOUT{10};
+    static constexpr std::chrono::seconds REASSEMBLY_TIMEOUT{30};  // Between fragments of one frame
+    // Admission puzzles harder than any server of ours sets are refused
+    static constexpr int MAX_ADMISSION_DIFFICULTY = 24;
+    bool admission_open_ = true;  // Until the first other frame or a challenge
+
+    TimerWheel::Timer ack_timer_;
+    TimerWheel::Timer retransmit_timer_;
+    TimerWheel::Timer idle_timer_;
+    TimerWheel::Timer keepalive_timer_;
+    TimerWheel::Timer handshake_timer_;
+    TimerWheel::Timer reassembly_timer_;
+    TimerWheel::Timer throttle_timer_;  // Resumes reading once the ingress bucket refills
+    Clock::time_point last_received_;
+    Clock::time_point last_fragment_;
+
+    // Inbound frames per second a neighbour may send once its burst is spent
+    static constexpr double INGRESS_RATE = 2000.0;
+    static constexpr double INGRESS_BURST = 500.0;
+
+    TokenBucket ingress_bucket_;
+    IngressStats ingress_stats_;
+
+    std::unique_ptr<SecureSession> session_;
+    // Frames sent before the handshake completes, sealed once it has
+    std::deque<std::pair<FramePtr, uint32_t>> awaiting_handshake_;
+
+    bool datagrams_enabled_ = false;
+    std::shared_ptr<DatagramChannel> datagrams_;
+
+#ifdef TELELIBRE_IO_URING
+    // Bytes come from the io_context's UringReactor instead of async_read
+    UringReactor::Token receive_token_ = 0;
+    bool receiving_ = false;
+    FrameParser parser_;
+    bool header_admitted_ = false;  // The frame at the parser's head has been charged for
+    // About what a kernel receive buffer would hold for a paused reader
+    static constexpr size_t MAX_THROTTLED_BYTES = 4 * 1024 * 1024;
+
+    void onReceive(const uint8_t* data, size_t size) override;
+    void parseFrames();
+    void onReceiveError(int error) override;
+#endif
+
+    void receivePayload(uint32_t payload_length);
+    bool chargesIngress() const;
+    bool admitFrame();
+    void resumeReceive();
+    void handlePayload();
+    void handleHandshake();
+    void handleAdmission();
+    bool dropIfSeen(PacketType type, uint32_t sequence, const std::vector<uint8_t>& payload);
+    void acceptPiece(Packet packet);
+    void processPacket(Packet packet);
+    void offerDatagrams();
+    void handleDatagramOffer(const Packet& packet);
+    bool acceptDatagram(const Packet& packet);
+    void sendFrame(FramePtr frame);
+    void sendOnStream(FramePtr frame);
+    void sendSequenced(FramePtr frame);
+    void queueFrame(FramePtr frame, uint32_t sequence);
+    void writeNext();
+    void scheduleAck();
+    void sendAck();
+    void armRetransmitTimer();
+    void retransmitExpired();
+    void checkIdle();
+    void checkKeepalive();
+    void checkReassembly();
+    void close();
 };
 
 #endif // PEERCONNECTION_H
@@ -0,0 +1,53 @@
+#ifndef PEEREXCHANGE_H
+#define PEEREXCHANGE_H
+
+#include <boost/asio/ip/address.hpp>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "Packet.h"
+#include "SizeEstimator.h"
+
+// Packed peer entry: family (4 or 6), 4 or 16 address bytes, then a u16 port.
+struct PeerAddress {
+    boost::asio::ip::address address;
+    uint16_t port = 0;
+
+    std::string toString() const;
+    bool operator==(const PeerAddress& other) const {
+        return address == other.address && port == other.port;
+    }
+};
+
+struct PeerAddressHash {
+    size_t operator()(const PeerAddress& address) const;
+};
+
+// Body of a PeerRequest packet: the sender's network size sketch, and the
+// port it accepts connections on. The source port of an outbound connection
+// cannot be dialled, so a seed only hands out nodes that advertise one.
+struct PeerRequest {
+    std::optional<SizeSketch> size_sketch;
+    uint16_t listen_port = 0;  // Zero if the sender accepts no connections
+
+    Packet toPacket() const;
+    static PeerRequest fromPacket(const Packet& packet);
+};
+
+// Body of a PeerExchange packet. It is sent point-to-point in answer to a
+// PeerRequest and holds a bounded sample of peers that connected since the
+// requester last asked, plus the peers that went away in the same period.
+// The sender's network size sketch rides along after the entries.
+struct PeerExchange {
+    static constexpr size_t MAX_ENTRIES = 32;
+
+    std::vector<PeerAddress> added;
+    std::vector<PeerAddress> removed;
+    std::optional<SizeSketch> size_sketch;
+
+    Packet toPacket() const;
+    static PeerExchange fromPacket(const Packet& packet);
+};
+
+#endif // PEEREXCHANGE_H
@@ -0,0 +1,113 @@
+#ifndef RELIABILITY_H
+#define RELIABILITY_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+#include "Packet.h"
+
+// Receiver side of the per-connection acknowledgment scheme. Sequenced
+// frames are recorded here and acknowledged in bulk: an Ack packet carries
+// the cumulative sequence (everything up to and including it has arrived)
+// in its header and up to MAX_ACK_RANGES [start, end] ranges of frames
+// received above that point in its payload.
+class AckTracker {
+public:
+    static constexpr size_t MAX_ACK_RANGES = 32;
+    static constexpr size_t MAX_TRACKED_RANGES = 1024;
+
+    enum class Result {
+        New,
+        Duplicate,  // Already received, a retransmit
+        Full,       // Too many gaps to track another; neither kept nor acked
+    };
+
+    Result record(uint32_t sequence);
+    // What record would return, without recording
+    Result check(uint32_t sequence) const;
+    // The sender has given up on everything up to sequence, so the gaps
+    // below it will never fill
+    void skipTo(uint32_t sequence);
+    size_t pendingCount() const { return pending_; }
+    Packet buildAck();
+
+private:
+    uint32_t cumulative_ = 0;
+    std::map<uint32_t, uint32_t> ranges_;  // start -> end, all above cumulative_
+    size_t pending_ = 0;
+};
+
+// Sender side: keeps sequenced frames until they are acknowledged and hands
+// back the ones whose retransmission deadline has passed. Frames are held by
+// reference, so a message fanned out to many peers is stored once. A
+// frame's deadline runs from when it was last put on the wire, backing off
+// exponentially per attempt up to MAX_RTO; while it waits to go out, or
+// to go out again once handed back, it cannot expire.
+class SendWindow {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Retransmit = std::pair<uint32_t, FramePtr>;
+
+    static constexpr std::chrono::milliseconds INITIAL_RTO{250};
+    static constexpr std::chrono::milliseconds MAX_RTO{60000};
+    static constexpr int MAX_ATTEMPTS = 6;
+
+    explicit SendWindow(size_t capacity = 256, int max_attempts = MAX_ATTEMPTS)
+        : capacity_(capacity), max_attempts_(max_attempts) {}
+
+    uint32_t nextSequence() { return next_sequence_++; }
+    bool full() const { return unacked_.size() >= capacity_; }
+    bool empty() const { return unacked_.empty(); }
+    size_t size() const { return unacked_.size(); }
+    size_t droppedCount() const { return dropped_; }
+    // Every frame up to this sequence has been acked or given up on
+    uint32_t settledSequence() const {
+        return unacked_.empty() ? next_sequence_ - 1 : unacked_.begin()->first - 1;
+    }
+    // Payload bytes of the frames still waiting for an ack
+    size_t retainedBytes() const { return retained_bytes_; }
+    // From now on deadlines follow the round trip measured from acks, as
+    // RFC 6298 has it, instead of staying at INITIAL_RTO, but never fall
+    // below min_rto. Only frames acked on their first attempt are timed.
+    void adaptRto(std::chrono::milliseconds min_rto) { min_rto_ = min_rto; adaptive_ = true; }
+    Clock::duration rto() const { return rto_; }
+
+    // Held until markSent
+    void add(uint32_t sequence, FramePtr frame);
+    // Sent at once
+    void add(uint32_t sequence, FramePtr frame, Clock::time_point now);
+    // The frame has been written in full; starts its deadline
+    void markSent(uint32_t sequence, Clock::time_point now);
+    size_t acknowledge(const Packet& ack);
+    // Frames out of attempts are dropped, or handed to abandoned if given.
+    // The rest are handed back to be sent again, and marked sent once they are.
+    std::vector<Retransmit> collectExpired(Clock::time_point now, std::vector<Retransmit>* abandoned = nullptr);
+
+private:
+    struct Entry {
+        FramePtr frame;
+        Clock::time_point sent;
+        Clock::time_point deadline;
+        int attempts;
+    };
+
+    size_t capacity_;
+    int max_attempts_;
+    uint32_t next_sequence_ = 1;
+    std::map<uint32_t, Entry> unacked_;
+    size_t dropped_ = 0;
+    size_t retained_bytes_ = 0;
+    bool adaptive_ = false;
+    Clock::duration min_rto_ = INITIAL_RTO;
+    Clock::duration rto_ = INITIAL_RTO;
+    Clock::duration srtt_{0};
+    Clock::duration rttvar_{0};
+    Clock::time_point newest_acked_;  // Sent time of the newest first-attempt frame in this ack
+
+    void erase(std::map<uint32_t, Entry>::iterator first, std::map<uint32_t, Entry>::iterator last);
+    void sampleRtt(Clock::duration rtt);
+};
+
+#endif // RELIABILITY_H
@@ -2,19 +2,33 @@
 #define ROUTINGTABLE_H
 
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <memory>
-#include "PeerConnection.h"
+#include "Peer.h"
+#include "InterestFilter.h"
+#include "MemoryAccounting.h"
 
+// Interest adverts received from each neighbour. A group's messages go to
+// the neighbours whose advert says a subscriber lies somewhere behind them.
 class RoutingTable {
 public:
-    void addPeer(const std::string& category, std::shared_ptr<PeerConnection> peer);
-    std::vector<std::shared_ptr<PeerConnection>> getPeersForCategory(const std::string& category);
-    void updatePeerInterests(std::shared_ptr<PeerConnection> peer, const std::vector<std::string>& categories);
+    // Entries are charged to account, when one is given
+    explicit RoutingTable(MemoryAccount* account = nullptr) : entries_(TrackingAllocator<Entry>(account)) {}
+
+    // Returns false if the advert is the same as the one already held
+    bool updatePeerInterests(const std::shared_ptr<Peer>& peer, const InterestAdvert& advert);
+    bool removePeer(const std::shared_ptr<Peer>& peer);
+    std::vector<std::shared_ptr<Peer>> getPeersForCategory(const std::string& category) const;
+    // What to tell one neighbour: our own groups in layer 0, and every other
+    // neighbour's advert shifted one layer deeper (split horizon)
+    InterestAdvert advertFor(const std::shared_ptr<Peer>& peer, const InterestFilter& local) const;
 
 private:
-    std::unordered_map<std::string, std::vector<std::shared_ptr<PeerConnection>>> table_;
+    struct Entry {
+        std::shared_ptr<Peer> peer;
+        InterestAdvert advert;
+    };
+    std::vector<Entry, TrackingAllocator<Entry>> entries_;
 };
 
 #endif // ROUTINGTABLE_H
@@ -0,0 +1,102 @@
+#ifndef SECURESESSION_H
+#define SECURESESSION_H
+
+#include <openssl/evp.h>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Packet.h"
+
+// Long-lived Ed25519 identity of a node. It only signs handshakes; frame
+// protection uses the per-connection keys those handshakes agree on.
+class NodeIdentity {
+public:
+    static constexpr size_t PUBLIC_KEY_SIZE = 32;
+    static constexpr size_t SIGNATURE_SIZE = 64;
+    using PublicKey = std::array<uint8_t, PUBLIC_KEY_SIZE>;
+
+    static std::shared_ptr<NodeIdentity> generate();
+    // Takes ownership of an Ed25519 private key, e.g. from KeyManagement::loadPrivateKey
+    explicit NodeIdentity(EVP_PKEY* private_key);
+    ~NodeIdentity();
+    NodeIdentity(const NodeIdentity&) = delete;
+    NodeIdentity& operator=(const NodeIdentity&) = delete;
+
+    const PublicKey& publicKey() const { return public_key_; }
+    std::vector<uint8_t> sign(const std::vector<uint8_t>& data) const;
+    static bool verify(const PublicKey& key, const std::vector<uint8_t>& data,
+                       const uint8_t* signature, size_t signature_length);
+
+private:
+    EVP_PKEY* key_;
+    PublicKey public_key_;
+};
+
+// Authenticated encryption for one connection. Each side sends a Handshake
+// packet holding a fresh X25519 key signed with its Ed25519 identity; the
+// X25519 shared secret is expanded with HKDF-SHA256 into one
+// ChaCha20-Poly1305 key per direction. Every later frame is sealed with the
+// header as associated data and an implicit per-direction frame counter as
+// nonce, so nothing but the tag is added on the wire.
+class SecureSession {
+public:
+    static constexpr size_t KEY_SIZE = 32;
+    static constexpr size_t NONCE_SIZE = 12;
+    static constexpr size_t TAG_SIZE = 16;
+    static constexpr size_t HELLO_SIZE = KEY_SIZE + NodeIdentity::PUBLIC_KEY_SIZE + NodeIdentity::SIGNATURE_SIZE;
+
+    explicit SecureSession(std::shared_ptr<const NodeIdentity> identity);
+    ~SecureSession();
+    SecureSession(const SecureSession&) = delete;
+    SecureSession& operator=(const SecureSession&) = delete;
+
+    Packet hello() const;
+    // Verifies the remote Handshake and derives the session keys; throws on failure
+    void accept(const Packet& hello);
+    bool established() const { return established_; }
+    const NodeIdentity::PublicKey& remoteIdentity() const { return remote_identity_; }
+
+    // Encrypts one outgoing frame into out and returns the header to send
+    // with it: PACKET_FLAG_SEALED set and the length covering the tag. The
+    // checksum field is zero, since a CRC of the plaintext would let an
+    // observer confirm guesses at short frames; the tag authenticates them.
+    PacketHeader seal(const EncodedFrame& frame, uint32_t sequence, std::vector<uint8_t>& out) {
+        return seal(frame, 0, frame.payload.size(), sequence, 0, out);
+    }
+    // Same for the length bytes at offset, sent with the given fragment flags
+    PacketHeader seal(const EncodedFrame& frame, size_t offset, size_t length, uint32_t sequence,
+                      uint8_t flags, std::vector<uint8_t>& out);
+    // Authenticates and decrypts one incoming frame; throws if it was altered
+    Packet open(const uint8_t* header, const std::vector<uint8_t>& ciphertext);
+    // Consumes the nonce of an incoming frame dropped before decryption
+    void discardIncoming() { ++receive_counter_; }
+
+    // Datagrams may be lost or reordered, so one cannot take the next
+    // nonce in turn. Each carries its own counter ahead of the ciphertext,
+    // from a nonce space apart from the stream's, adding DATAGRAM_OVERHEAD
+    // bytes. A replayed datagram opens again; sequencing must catch it.
+    static constexpr size_t DATAGRAM_OVERHEAD = 8 + TAG_SIZE;
+    PacketHeader sealDatagram(const EncodedFrame& frame, uint32_t sequence, std::vector<uint8_t>& out);
+    Packet openDatagram(const uint8_t* header, const uint8_t* data, size_t size);
+
+private:
+    std::shared_ptr<const NodeIdentity> identity_;
+    EVP_PKEY* ephemeral_ = nullptr;
+    std::array<uint8_t, KEY_SIZE> ephemeral_public_{};
+    NodeIdentity::PublicKey remote_identity_{};
+    bool established_ = false;
+
+    EVP_CIPHER_CTX* send_ctx_ = nullptr;
+    EVP_CIPHER_CTX* receive_ctx_ = nullptr;
+    uint64_t send_counter_ = 0;
+    uint64_t receive_counter_ = 0;
+    uint64_t datagram_counter_ = 0;
+
+    void encrypt(const uint8_t* nonce, const PacketHeader& header, const uint8_t* plaintext, size_t length,
+                 uint8_t* out);
+    bool decrypt(const uint8_t* nonce, const uint8_t* header, const uint8_t* ciphertext, size_t length,
+                 uint8_t* out);
+};
+
+#endif // SECURESESSION_H
@@ -0,0 +1,80 @@
+#ifndef SEEDREGISTRY_H
+#define SEEDREGISTRY_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "Packet.h"
+#include "PeerExchange.h"
+
+// The seed's view of which nodes are live: every node that has sent it a
+// frame within LIVENESS_TIMEOUT, keyed by the address it accepts connections
+// on, which is its connection's source address with the listen port its
+// PeerRequest advertised. Entries are spread over SHARD_COUNT independently locked shards so
+// sessions recording themselves do not contend.
+//
+// Bootstrap answers are not built per request. The registry keeps
+// RESPONSE_VARIANTS PeerExchange responses, each a random sample of up to
+// PeerExchange::MAX_ENTRIES live nodes, already serialized into frames,
+// and hands out one at random. They are rebuilt only after a node joins or
+// leaves, and at most once per MIN_REBUILD_INTERVAL, so under churn a
+// sample may be that much out of date.
+class SeedRegistry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t SHARD_COUNT = 16;
+    static constexpr size_t RESPONSE_VARIANTS = 8;
+    static constexpr std::chrono::seconds LIVENESS_TIMEOUT{120};
+    static constexpr std::chrono::milliseconds MIN_REBUILD_INTERVAL{1000};
+
+    // A ready-made answer to a PeerRequest. Plain sessions send frame as it
+    // is; sealed ones seal packet with their own keys.
+    struct Response {
+        Packet packet;
+        std::vector<uint8_t> frame;
+        std::vector<PeerAddress> entries;  // Sorted, to check for the requester
+    };
+    using ResponsePtr = std::shared_ptr<const Response>;
+
+    SeedRegistry();
+
+    // The node at address was heard from at now
+    void touch(const PeerAddress& address, Clock::time_point now);
+    void remove(const PeerAddress& address);
+    // Drops nodes not heard from for LIVENESS_TIMEOUT; returns how many
+    size_t expire(Clock::time_point now);
+    size_t size() const;
+
+    // A response for requester that does not list requester itself
+    ResponsePtr responseFor(const PeerAddress& requester, Clock::time_point now);
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<PeerAddress, Clock::time_point, PeerAddressHash> last_seen;
+    };
+
+    std::array<Shard, SHARD_COUNT> shards_;
+    std::atomic<uint64_t> version_{0};  // Bumped whenever membership changes
+
+    std::mutex responses_mutex_;
+    std::vector<ResponsePtr> responses_;
+    uint64_t responses_version_ = 0;
+    Clock::time_point responses_built_;
+    std::mt19937_64 rng_;
+
+    Shard& shardFor(const PeerAddress& address);
+    std::vector<PeerAddress> snapshot() const;
+    ResponsePtr buildResponse(std::vector<PeerAddress> entries) const;
+    void rebuildResponses(Clock::time_point now);
+};
+
+#endif // SEEDREGISTRY_H
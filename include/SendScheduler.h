@@ -0,0 +1,69 @@
+#ifndef SENDSCHEDULER_H
+#define SENDSCHEDULER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include "Packet.h"
+
+// Traffic classes of one connection, in order of priority
+enum class SendClass : uint8_t {
+    Control = 0,      // Acks, handshakes, peer exchange and interest adverts
+    Interactive = 1,  // Messages that fit in a single fragment, e.g. text
+    Bulk = 2,         // Larger messages such as image memes
+};
+
+// Per-connection send queues, one per SendClass, drained by deficit round
+// robin: each turn a class may write up to its quantum of bytes, so the
+// link is shared in proportion to the quanta and no class starves. Bulk
+// frames are handed out one fragment at a time, which bounds how long an
+// ack or a text message can wait behind a multi-megabyte meme to the time
+// it takes to write a single FRAGMENT_SIZE piece.
+class SendScheduler {
+public:
+    // Bytes per round; only the ratios matter
+    static constexpr size_t CONTROL_QUANTUM = 8 * FRAGMENT_SIZE;
+    static constexpr size_t INTERACTIVE_QUANTUM = 4 * FRAGMENT_SIZE;
+    static constexpr size_t BULK_QUANTUM = FRAGMENT_SIZE;
+
+    // One write: the whole frame, or one fragment of a bulk frame
+    struct Piece {
+        FramePtr frame;
+        uint32_t sequence = 0;
+        size_t offset = 0;
+        size_t length = 0;
+        uint8_t flags = 0;
+    };
+
+    SendScheduler();
+
+    static SendClass classify(const EncodedFrame& frame);
+
+    // front puts the frame ahead of everything else in its class
+    void push(FramePtr frame, uint32_t sequence, bool front = false);
+    // Fills piece with the next write; false when nothing is queued
+    bool next(Piece& piece);
+    bool empty() const;
+    size_t queuedBytes(SendClass send_class) const { return queues_[static_cast<size_t>(send_class)].bytes; }
+
+private:
+    struct Pending {
+        FramePtr frame;
+        uint32_t sequence;
+        size_t offset;  // Bytes of a bulk frame already handed out
+    };
+
+    struct Queue {
+        std::deque<Pending> frames;
+        size_t quantum = 0;
+        size_t deficit = 0;
+        size_t bytes = 0;
+    };
+
+    std::array<Queue, 3> queues_;
+    size_t current_ = 0;
+    bool topped_up_ = false;  // Current queue has had this round's quantum
+};
+
+#endif // SENDSCHEDULER_H
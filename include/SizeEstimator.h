@@ -0,0 +1,74 @@
+#ifndef SIZEESTIMATOR_H
+#define SIZEESTIMATOR_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// HyperLogLog sketch over node ids. Merging is a register-wise max, so
+// sketches can be swapped with any neighbour any number of times and the
+// union still converges to every node that contributed.
+class HyperLogLog {
+public:
+    static constexpr int PRECISION = 10;
+    static constexpr size_t REGISTERS = size_t(1) << PRECISION;  // ~3% standard error
+    // Registers are capped here, so a forged sketch can claim at most about
+    // 2^MAX_RANK nodes per register; honest ones reach it with odds of 2^-32
+    static constexpr uint8_t MAX_RANK = 32;
+
+    void add(uint64_t hash);
+    void merge(const HyperLogLog& other);
+    double estimate() const;
+    void clear() { registers_.fill(0); }
+
+    const std::array<uint8_t, REGISTERS>& registers() const { return registers_; }
+    static HyperLogLog fromRegisters(const uint8_t* data);
+
+private:
+    std::array<uint8_t, REGISTERS> registers_{};
+};
+
+// Sketch as carried by PeerRequest and PeerExchange: u32 epoch, then one
+// byte per register.
+struct SizeSketch {
+    static constexpr size_t WIRE_SIZE = 4 + HyperLogLog::REGISTERS;
+
+    uint32_t epoch = 0;
+    HyperLogLog sketch;
+
+    void appendTo(std::vector<uint8_t>& out) const;
+    static SizeSketch read(const uint8_t* data);
+};
+
+// Live network size estimate. Sketches are bucketed into wall-clock epochs
+// so that nodes which left stop being counted: each epoch starts from an
+// empty sketch, and the estimate is the larger of the current and the
+// previous epoch so it does not collapse at every rollover.
+class SizeEstimator {
+public:
+    static constexpr uint32_t EPOCH_SECONDS = 3600;
+    static constexpr double MAX_ESTIMATE = 1e8;  // Far past any real overlay
+
+    explicit SizeEstimator(uint64_t node_id = 0) { setNodeId(node_id); }
+
+    void setNodeId(uint64_t node_id);
+    // Starts a new epoch if the clock has moved past the current one
+    void advance(uint32_t epoch);
+    // Merges a sketch taken at most one epoch ahead of now, the most clock
+    // skew allows; returns false if it was ignored
+    bool merge(const SizeSketch& remote, uint32_t now);
+    double estimate() const;
+
+    SizeSketch snapshot() const { return SizeSketch{epoch_, current_}; }
+    bool heardFromPeers() const { return merges_ > 0; }
+
+private:
+    uint64_t node_id_;
+    uint32_t epoch_ = 0;
+    HyperLogLog current_;
+    HyperLogLog previous_;
+    uint64_t merges_ = 0;
+};
+
+#endif // SIZEESTIMATOR_H
@@ -0,0 +1,140 @@
+#ifndef SWARM_H
+#define SWARM_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "Message.h"
+#include "MessageId.h"
+#include "Packet.h"
+#include "Peer.h"
+
+// Pieces of a progressive meme the sender holds and will serve. Sent to
+// every neighbour each time the sender gains a piece.
+//
+//   meme[16], count u16, then one bit per piece, most significant first
+struct PieceHave {
+    MessageId meme;
+    std::vector<bool> pieces;
+
+    Packet toPacket() const;
+    // Throws on a malformed payload
+    static PieceHave fromPacket(const Packet& packet);
+};
+
+// Asks a neighbour for one body chunk, answered with the Chunk message
+// itself. A neighbour that no longer holds the piece stays silent and the
+// request times out.
+//
+//   meme[16], index u32
+struct PieceRequest {
+    MessageId meme;
+    uint32_t index = 0;
+
+    Packet toPacket() const;
+    static PieceRequest fromPacket(const Packet& packet);
+};
+
+// Decides which neighbour to ask for which piece of the memes being
+// fetched. A meme's preview lists the id of every body chunk, so each
+// chunk checks out on its own and can come from any neighbour that has
+// announced it; pieces are spread over all of them at once.
+//
+// Each neighbour may have REQUESTS_PER_PEER requests outstanding. Free
+// slots are filled fastest neighbour first, each taking the rarest piece it
+// holds that nobody has been asked for yet, with ties broken at random so
+// neighbours fetching the same meme do not all start in the same place.
+// Once every missing piece of a meme has been asked for, the meme is in
+// endgame and a missing piece may be asked of up to ENDGAME_REQUESTS
+// neighbours, so the last pieces are not held up by the slowest of them.
+// A request unanswered after a few round trips is given to someone else.
+class Swarm {
+public:
+    using Clock = std::chrono::steady_clock;
+    using PeerPtr = std::shared_ptr<Peer>;
+
+    static constexpr size_t REQUESTS_PER_PEER = 4;
+    static constexpr size_t ENDGAME_REQUESTS = 2;
+    static constexpr size_t MAX_MEMES = 256;
+    static constexpr size_t MAX_UNKNOWN_HAVES = 8;  // Per peer, awaiting the meme's preview
+    static constexpr std::chrono::milliseconds INITIAL_RTT{200};
+    static constexpr std::chrono::milliseconds MIN_REQUEST_TIMEOUT{500};
+    static constexpr int TIMEOUT_RTTS = 4;
+
+    struct Request {
+        PeerPtr peer;
+        MessageId meme;
+        uint32_t index;
+    };
+
+    Swarm();
+    void seed(uint32_t seed) { rng_.seed(seed); }
+
+    // Starts tracking a meme of pieces pieces, fetching its missing ones if
+    // download is set. The caller has checked pieces against the meme's
+    // preview, so announcements that disagree with it are dropped.
+    void add(const MessageId& meme, size_t pieces, bool download);
+    // A piece is now held here, whether requested or not; from is the
+    // neighbour it came from, if any
+    void received(const MessageId& meme, uint32_t index, const PeerPtr& from, Clock::time_point now);
+    // Stops fetching a meme's missing pieces, forgetting requests already out
+    void stop(const MessageId& meme);
+    // Adds to what peer is known to hold. Announcements may arrive before
+    // the meme's preview; the last MAX_UNKNOWN_HAVES of those from each peer
+    // are kept aside until it does, so only previews start a meme tracked.
+    void setHolder(const PeerPtr& peer, const PieceHave& have);
+    void removePeer(const PeerPtr& peer);
+
+    // Requests to send now. Requests that have timed out are withdrawn first.
+    std::vector<Request> pick(Clock::time_point now);
+    // True while a meme is still being fetched
+    bool downloading() const;
+    // Roughly what the per-meme and per-peer state takes, containers' own
+    // bookkeeping aside
+    size_t memoryUsage() const;
+
+private:
+    struct Outstanding {
+        PeerPtr peer;
+        Clock::time_point sent;
+    };
+
+    struct Meme {
+        size_t pieces = 0;
+        bool download = false;
+        size_t missing = 0;
+        std::vector<bool> have;
+        std::vector<uint16_t> availability;  // Neighbours holding each piece
+        std::map<PeerPtr, std::vector<bool>> holders;
+        std::vector<std::vector<Outstanding>> requested;
+        size_t unrequested = 0;  // Missing pieces nobody has been asked for
+    };
+
+    struct PeerState {
+        size_t in_flight = 0;
+        Clock::duration rtt = INITIAL_RTT;
+        uint64_t order = 0;  // Breaks rtt ties the same way every run
+    };
+
+    std::unordered_map<MessageId, Meme> memes_;
+    std::deque<MessageId> order_;  // Oldest first
+    std::map<PeerPtr, PeerState> peers_;
+    std::map<PeerPtr, std::deque<PieceHave>> unknown_haves_;  // Oldest first
+    uint64_t peers_seen_ = 0;
+    std::minstd_rand rng_;
+
+    Meme& track(const MessageId& meme, size_t pieces);
+    void applyHave(Meme& meme, const PeerPtr& peer, const std::vector<bool>& pieces);
+    Clock::duration timeoutFor(const PeerState& state) const;
+    void withdraw(Meme& meme, uint32_t index, const PeerPtr& peer);
+    void expire(Clock::time_point now);
+    bool pickFor(const PeerPtr& peer, Clock::time_point now, std::vector<Request>& requests);
+};
+
+#endif // SWARM_H
@@ -0,0 +1,95 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "HandlerAllocator.h"
+
+// Hashed hierarchical timing wheel shared by every connection on one
+// io_context. Four levels of 64 slots cover 2^24 ticks of TICK each, about
+// 46 hours; a timer sits in the level matching how far off it is and moves
+// down a level each time the level below wraps. Timers are intrusive list
+// nodes owned by whoever arms them, so arming and cancelling are O(1) and
+// never allocate. A single steady_timer wakes the wheel, only for slots that
+// hold timers or need cascading, and not at all while the wheel is empty.
+//
+// Obtained with TimerWheel::of(io_context). Like the rest of a connection's
+// state it is only touched from the thread running that io_context.
+class TimerWheel : public boost::asio::execution_context::service {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr Clock::duration TICK = std::chrono::milliseconds(10);
+    static constexpr size_t LEVELS = 4;
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+
+    // One schedulable deadline. It is cancelled on destruction, and the
+    // callback runs on the io_context thread after the timer is unlinked,
+    // so it may re-arm the same timer.
+    class Timer {
+    public:
+        explicit Timer(TimerWheel& wheel, std::function<void()> callback = {})
+            : wheel_(&wheel), callback_(std::move(callback)) {}
+        ~Timer() { cancel(); }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        void setCallback(std::function<void()> callback) { callback_ = std::move(callback); }
+        void arm(Clock::duration delay) {
+            if (wheel_) {
+                wheel_->schedule(*this, delay);
+            }
+        }
+        void cancel() {
+            if (wheel_ && slot_) {
+                wheel_->unlink(*this);
+            }
+        }
+        bool armed() const { return slot_ != nullptr; }
+
+    private:
+        friend class TimerWheel;
+        TimerWheel* wheel_;
+        std::function<void()> callback_;
+        Timer** slot_ = nullptr;  // Head of the list holding this timer
+        Timer* prev_ = nullptr;
+        Timer* next_ = nullptr;
+        uint64_t expiry_ = 0;  // In ticks
+    };
+
+    static boost::asio::execution_context::id id;
+
+    explicit TimerWheel(boost::asio::execution_context& context);
+    static TimerWheel& of(boost::asio::io_context& io_context) {
+        return boost::asio::use_service<TimerWheel>(io_context);
+    }
+
+    size_t size() const { return count_; }
+    uint64_t firedCount() const { return fired_; }
+
+private:
+    boost::asio::steady_timer timer_;
+    HandlerMemory handler_memory_;
+    Clock::time_point start_;
+    uint64_t current_tick_ = 0;  // Last tick processed
+    uint64_t wake_tick_ = 0;     // Tick timer_ is set for, when waiting
+    bool waiting_ = false;
+    size_t count_ = 0;
+    uint64_t fired_ = 0;
+    std::array<std::array<Timer*, SLOTS>, LEVELS> slots_{};
+
+    void shutdown() override;
+    void schedule(Timer& timer, Clock::duration delay);
+    void insert(Timer& timer);
+    void unlink(Timer& timer);
+    uint64_t tickAt(Clock::time_point when) const;
+    void advance();
+    void cascade(size_t level);
+    void rearm();
+};
+
+#endif // TIMERWHEEL_H
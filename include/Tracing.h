@@ -0,0 +1,86 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "MessageId.h"
+
+// One node a traced message passed through, in microseconds since the Unix
+// epoch on that node's clock. received is when its frame had been read off
+// the connection, dequeued when the node began handling it, and forwarded
+// when it was handed to the neighbours' send queues. The origin's first hop
+// has all three set to when it sent the message.
+struct TraceHop {
+    uint64_t node = 0;
+    uint64_t received_us = 0;
+    uint64_t dequeued_us = 0;
+    uint64_t forwarded_us = 0;
+};
+
+// The hops a sampled message has taken so far, origin first. It travels
+// with the message and each relay appends itself before forwarding, so the
+// copy a node receives holds the path the first copy to reach it took.
+// Hops are not signed and are only fit for diagnostics.
+struct MessageTrace {
+    static constexpr size_t MAX_HOPS = 64;  // Later relays forward without adding themselves
+
+    uint64_t id = 0;
+    std::vector<TraceHop> hops;
+};
+
+// Microseconds since the Unix epoch, the default clock for trace hops
+uint64_t traceClockNow();
+
+// Paths of traced messages as they arrived at one or more nodes, merged per
+// trace into the tree the message spread along, and written out in the
+// Chrome trace event format for chrome://tracing or Perfetto. Each node is
+// a process there; every hop shows as the time since the previous node
+// forwarded it (sender queue and wire), parsing, and handling up to the
+// forward, with an arrow from the previous node. The oldest traces give way
+// past MAX_TRACES. Safe to share between nodes and threads.
+class TraceCollector {
+public:
+    static constexpr size_t MAX_TRACES = 4096;
+
+    // Mean time per hop spent in each stage, over every recorded hop with a
+    // previous node
+    struct Breakdown {
+        size_t hops = 0;
+        double wire_us = 0;
+        double parse_us = 0;
+        double handle_us = 0;
+    };
+
+    void record(const MessageId& message, const MessageTrace& trace);
+    size_t size() const;
+    Breakdown breakdown() const;
+    void writeChromeTrace(std::ostream& out) const;
+    // Throws std::runtime_error if the file cannot be written
+    void exportChromeTrace(const std::string& path) const;
+
+private:
+    struct Hop {
+        TraceHop hop;
+        bool has_previous = false;
+        uint64_t previous = 0;
+    };
+
+    struct Trace {
+        MessageId message;
+        std::map<uint64_t, Hop> hops;  // By node
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, Trace> traces_;
+    std::deque<uint64_t> order_;  // Oldest first
+};
+
+#endif // TRACING_H
@@ -0,0 +1,132 @@
+#ifndef URINGREACTOR_H
+#define URINGREACTOR_H
+
+#include <boost/asio.hpp>
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "HandlerAllocator.h"
+
+// io_uring receive and accept path, compiled in with -DTELELIBRE_IO_URING=ON.
+// Each connection keeps one multishot receive armed on the ring, drawing
+// from a pool of receive buffers handed to the kernel up front, so bytes
+// arrive without a readiness wakeup and a read() per socket; listening
+// sockets likewise keep one multishot accept armed.
+// Completions from every socket are reaped in batches on the io_context
+// thread, woken through an eventfd that Asio waits on, and submissions
+// made while reaping go to the kernel in one io_uring_enter. Writes,
+// connects and timers stay on Asio.
+//
+// Talks to the kernel directly rather than through liburing and needs
+// Linux 6.0 or later for multishot receive. Obtained with
+// UringReactor::of(io_context); like the rest of a connection's state it
+// is only touched from the thread running that io_context.
+class UringReactor : public boost::asio::execution_context::service {
+public:
+    static constexpr unsigned RING_ENTRIES = 4096;
+    static constexpr unsigned BUFFER_COUNT = 1024;  // Power of two
+    static constexpr size_t BUFFER_SIZE = 16 * 1024;
+
+    // Gets the bytes of one connection in the order they arrived
+    class Receiver {
+    public:
+        virtual ~Receiver() = default;
+        // data is only valid for the duration of the call
+        virtual void onReceive(const uint8_t* data, size_t size) = 0;
+        // error is 0 when the peer closed the connection, else an errno
+        virtual void onReceiveError(int error) = 0;
+    };
+
+    using AcceptHandler = std::function<void(int fd)>;
+    using Token = uint64_t;  // Names one receive registration
+
+    static boost::asio::execution_context::id id;
+
+    explicit UringReactor(boost::asio::execution_context& context);
+    ~UringReactor() override;
+    static UringReactor& of(boost::asio::io_context& io_context) {
+        return boost::asio::use_service<UringReactor>(io_context);
+    }
+
+    // Feeds fd's bytes to receiver until stopReceive. The receiver must
+    // outlive the registration; no callback follows stopReceive.
+    Token startReceive(int fd, Receiver* receiver);
+    void stopReceive(Token token);
+    // Hands every connection accepted on listen_fd to handler
+    void startAccept(int listen_fd, AcceptHandler handler);
+
+    uint64_t submitCalls() const { return submit_calls_; }
+
+private:
+    enum Kind : uint64_t { KIND_RECEIVE = 0, KIND_ACCEPT = 1, KIND_IGNORE = 2, KIND_BUFFERS = 3 };
+    static constexpr uint16_t BUFFER_GROUP = 0;
+
+    struct ReceiveSlot {
+        int fd = -1;
+        Receiver* receiver = nullptr;  // Null once stopped
+        uint32_t generation = 0;
+        bool active = false;  // Kernel still holds a request for it
+    };
+
+    struct AcceptSlot {
+        int fd;
+        AcceptHandler handler;
+    };
+
+    int ring_fd_ = -1;
+    int event_fd_ = -1;
+    boost::asio::posix::stream_descriptor event_;
+
+    // Rings shared with the kernel
+    void* ring_map_ = nullptr;
+    size_t ring_map_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_pending_ = 0;      // Filled in but not yet published to the kernel
+    unsigned sq_unsubmitted_ = 0;  // Published but not yet taken by io_uring_enter
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+
+    // Receive buffers, and those read and waiting to go back to the kernel
+    uint8_t* buffers_ = nullptr;
+    std::vector<uint16_t> returned_buffers_;
+
+    std::vector<ReceiveSlot> receives_;
+    std::vector<uint32_t> free_receives_;
+    std::vector<Token> starved_receives_;  // Ended for want of a buffer
+    std::vector<AcceptSlot> accepts_;
+    bool reaping_ = false;
+    bool waiting_ = false;
+    size_t active_requests_ = 0;  // Requests the kernel still holds
+    HandlerMemory handler_memory_;
+    uint64_t submit_calls_ = 0;
+
+    void shutdown() override;
+    void release();
+    void releaseSlot(uint32_t index);
+    io_uring_sqe* nextSqe();
+    void submit();
+    void armReceive(uint32_t index);
+    void armAccept(uint32_t index);
+    void recycle(uint16_t buffer) { returned_buffers_.push_back(buffer); }
+    void provideBuffers(uint16_t first, uint16_t count);
+    void provideReturnedBuffers();
+    void waitForCompletions();
+    void reap();
+    void dispatchReceive(const io_uring_cqe& cqe);
+    void dispatchAccept(const io_uring_cqe& cqe);
+    static Token userData(Kind kind, uint32_t generation, uint32_t index) {
+        return (static_cast<uint64_t>(kind) << 62) | (static_cast<uint64_t>(generation & 0x3FFFFFFF) << 32) | index;
+    }
+};
+
+#endif // URINGREACTOR_H
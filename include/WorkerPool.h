@@ -0,0 +1,72 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Message.h"
+#include "MpmcQueue.h"
+
+// Threads that run a handler for messages off the io thread: the
+// application's handler for delivered messages, or the signature check on
+// incoming ones, so that however long either takes, the io thread goes
+// straight back to servicing sockets. The io thread hands messages over through a
+// bounded MpmcQueue and never waits: when the queue is full, or holds more
+// than its byte budget, the message is dropped and counted. Workers take messages in batches and only touch the
+// mutex to sleep when there is nothing to do.
+class WorkerPool {
+public:
+    using Handler = std::function<void(const Message&)>;
+
+    struct Stats {
+        uint64_t submitted = 0;
+        uint64_t delivered = 0;
+        uint64_t dropped = 0;  // Refused because the queue was full
+        size_t backlog = 0;    // Waiting in the queue right now
+    };
+
+    static constexpr size_t BATCH_SIZE = 32;
+
+    // The handler may run on several workers at once, so messages can be
+    // delivered out of order
+    WorkerPool(size_t threads, size_t capacity, Handler handler);
+    // Delivers what is already queued, then joins the workers
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Zero, the default, bounds the queue by its capacity alone
+    void setByteBudget(size_t bytes) { byte_budget_ = bytes; }
+    // False if the queue is full and the message was dropped
+    bool submit(Message msg);
+    Stats stats() const;
+    // The queue's cells and the contents of the messages waiting in it
+    size_t memoryUsage() const;
+
+private:
+    MpmcQueue<Message> queue_;
+    Handler handler_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint64_t> submitted_{0};
+    std::atomic<uint64_t> delivered_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<size_t> byte_budget_{0};
+    std::atomic<size_t> queued_bytes_{0};
+
+    // Idle workers sleep here; sleepers_ lets submit skip the mutex while
+    // every worker is busy
+    std::mutex idle_mutex_;
+    std::condition_variable idle_;
+    std::atomic<size_t> sleepers_{0};
+
+    static size_t footprint(const Message& msg);
+    void run();
+};
+
+#endif // WORKERPOOL_H
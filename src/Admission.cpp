@@ -0,0 +1,226 @@
+#include "Admission.h"
+#include <boost/asio/post.hpp>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+void appendBody(std::vector<uint8_t>& out, const AdmissionChallenge& challenge) {
+    out.push_back(challenge.difficulty);
+    appendUint64(out, challenge.issued);
+    out.insert(out.end(), challenge.mac.begin(), challenge.mac.end());
+}
+
+bool hasLeadingZeroBits(const uint8_t* hash, int bits) {
+    int whole = bits / 8;
+    for (int i = 0; i < whole; ++i) {
+        if (hash[i] != 0) {
+            return false;
+        }
+    }
+    int rest = bits % 8;
+    return rest == 0 || (hash[whole] >> (8 - rest)) == 0;
+}
+
+// The body is followed by the nonce, big-endian, in the hashed input
+bool solves(const std::vector<uint8_t>& body_and_nonce, int difficulty) {
+    uint8_t hash[EVP_MAX_MD_SIZE];
+    unsigned int hash_length = 0;
+    EVP_Digest(body_and_nonce.data(), body_and_nonce.size(), hash, &hash_length, EVP_sha256(), nullptr);
+    return hasLeadingZeroBits(hash, difficulty);
+}
+
+// Busy and total jiffies over all CPUs since boot, from the first line of
+// /proc/stat; both zero if it cannot be read
+void machineCpuTimes(uint64_t& busy, uint64_t& total) {
+    busy = 0;
+    total = 0;
+    std::ifstream stat("/proc/stat");
+    std::string label;
+    if (!(stat >> label) || label != "cpu") {
+        return;
+    }
+    uint64_t value;
+    for (int field = 0; field < 8 && stat >> value; ++field) {
+        total += value;
+        if (field != 3 && field != 4) {  // idle and iowait
+            busy += value;
+        }
+    }
+}
+
+void writeNonce(std::vector<uint8_t>& body_and_nonce, uint64_t nonce) {
+    size_t offset = body_and_nonce.size() - 8;
+    for (int i = 7; i >= 0; --i) {
+        body_and_nonce[offset + i] = static_cast<uint8_t>(nonce);
+        nonce >>= 8;
+    }
+}
+
+}
+
+Packet AdmissionChallenge::toPacket() const {
+    std::vector<uint8_t> payload{ADMISSION_CHALLENGE};
+    appendBody(payload, *this);
+    return createPacket(PacketType::Admission, std::move(payload), 0);
+}
+
+AdmissionChallenge AdmissionChallenge::fromPacket(const Packet& packet) {
+    const std::vector<uint8_t>& data = packet.payload;
+    if (packet.type != PacketType::Admission || data.size() != 1 + BODY_SIZE || data[0] != ADMISSION_CHALLENGE) {
+        throw std::runtime_error("Invalid admission challenge");
+    }
+    AdmissionChallenge challenge;
+    challenge.difficulty = data[1];
+    challenge.issued = readUint64(data.data(), 2);
+    std::copy(data.begin() + 10, data.end(), challenge.mac.begin());
+    if (challenge.difficulty > 64) {
+        throw std::runtime_error("Admission challenge is unreasonably hard");
+    }
+    return challenge;
+}
+
+Packet AdmissionChallenge::solve() const {
+    std::vector<uint8_t> input;
+    appendBody(input, *this);
+    appendUint64(input, 0);
+    uint64_t nonce = 0;
+    while (!solves(input, difficulty)) {
+        writeNonce(input, ++nonce);
+    }
+    std::vector<uint8_t> payload{ADMISSION_SOLUTION};
+    payload.insert(payload.end(), input.begin(), input.end());
+    return createPacket(PacketType::Admission, std::move(payload), 0);
+}
+
+AdmissionSolver& AdmissionSolver::shared() {
+    static AdmissionSolver solver;
+    return solver;
+}
+
+bool AdmissionSolver::submit(const AdmissionChallenge& challenge, Callback done) {
+    if (++pending_ > MAX_PENDING) {
+        --pending_;
+        return false;
+    }
+    boost::asio::post(pool_, [this, challenge, done = std::move(done)]() {
+        Packet solution = challenge.solve();
+        --pending_;
+        done(std::move(solution));
+    });
+    return true;
+}
+
+AdmissionControl::AdmissionControl() : last_sample_(Clock::now()) {
+    if (RAND_bytes(secret_.data(), static_cast<int>(secret_.size())) != 1) {
+        throw std::runtime_error("Failed to generate admission secret");
+    }
+}
+
+std::array<uint8_t, AdmissionChallenge::MAC_SIZE> AdmissionControl::macFor(uint8_t difficulty, uint64_t issued,
+                                                                          const PeerAddress& peer) const {
+    std::vector<uint8_t> input{difficulty};
+    appendUint64(input, issued);
+    if (peer.address.is_v4()) {
+        auto bytes = peer.address.to_v4().to_bytes();
+        input.insert(input.end(), bytes.begin(), bytes.end());
+    } else {
+        auto bytes = peer.address.to_v6().to_bytes();
+        input.insert(input.end(), bytes.begin(), bytes.end());
+    }
+    appendUint16(input, peer.port);
+
+    uint8_t full[EVP_MAX_MD_SIZE];
+    unsigned int full_length = 0;
+    HMAC(EVP_sha256(), secret_.data(), static_cast<int>(secret_.size()), input.data(), input.size(),
+         full, &full_length);
+    std::array<uint8_t, AdmissionChallenge::MAC_SIZE> mac;
+    std::copy(full, full + mac.size(), mac.begin());
+    return mac;
+}
+
+AdmissionChallenge AdmissionControl::challengeFor(const PeerAddress& peer, std::time_t now) const {
+    AdmissionChallenge challenge;
+    challenge.difficulty = static_cast<uint8_t>(difficulty_);
+    challenge.issued = static_cast<uint64_t>(now);
+    challenge.mac = macFor(challenge.difficulty, challenge.issued, peer);
+    return challenge;
+}
+
+// The mac is checked before the hash, so a forged or stale challenge costs
+// one HMAC; comparing in constant time keeps the mac from leaking byte by byte
+bool AdmissionControl::verify(const Packet& solution, const PeerAddress& peer, std::time_t now) const {
+    const std::vector<uint8_t>& data = solution.payload;
+    if (solution.type != PacketType::Admission || data.size() != 1 + AdmissionChallenge::BODY_SIZE + 8 ||
+        data[0] != ADMISSION_SOLUTION) {
+        return false;
+    }
+    uint8_t difficulty = data[1];
+    uint64_t issued = readUint64(data.data(), 2);
+    uint64_t current = static_cast<uint64_t>(now);
+    if (issued > current || current - issued > static_cast<uint64_t>(CHALLENGE_LIFETIME.count())) {
+        return false;
+    }
+    auto mac = macFor(difficulty, issued, peer);
+    if (CRYPTO_memcmp(mac.data(), data.data() + 10, mac.size()) != 0) {
+        return false;
+    }
+    return solves(std::vector<uint8_t>(data.begin() + 1, data.end()), difficulty);
+}
+
+void AdmissionControl::updateLoad(double load) {
+    if (load >= HIGH_LOAD) {
+        calm_samples_ = 0;
+        difficulty_ = difficulty_ == 0 ? MIN_DIFFICULTY : std::min(MAX_DIFFICULTY, difficulty_ + DIFFICULTY_STEP);
+    } else if (load < LOW_LOAD && difficulty_ > 0) {
+        if (++calm_samples_ >= RELAX_SAMPLES) {
+            calm_samples_ = 0;
+            difficulty_ = difficulty_ == MIN_DIFFICULTY ? 0 : difficulty_ - DIFFICULTY_STEP;
+        }
+    } else {
+        calm_samples_ = 0;
+    }
+}
+
+double AdmissionControl::sampleLoad(int listen_fd) {
+    double load = 0.0;
+
+    timespec cpu{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    auto cpu_now = std::chrono::seconds(cpu.tv_sec) + std::chrono::nanoseconds(cpu.tv_nsec);
+    auto now = Clock::now();
+    if (now > last_sample_ && last_cpu_ != Clock::duration::zero()) {
+        load = std::chrono::duration<double>(cpu_now - last_cpu_).count() /
+               std::chrono::duration<double>(now - last_sample_).count();
+    }
+    last_cpu_ = std::chrono::duration_cast<Clock::duration>(cpu_now);
+    last_sample_ = now;
+
+    // Other work on the machine leaves the server less CPU than it counts
+    uint64_t busy, total;
+    machineCpuTimes(busy, total);
+    if (total > last_machine_total_ && last_machine_total_ != 0) {
+        load = std::max(load, static_cast<double>(busy - last_machine_busy_) / (total - last_machine_total_));
+    }
+    last_machine_busy_ = busy;
+    last_machine_total_ = total;
+
+    // For a listening socket Linux reports the accept queue's length and
+    // limit in these two fields
+    tcp_info info{};
+    socklen_t length = sizeof(info);
+    if (::getsockopt(listen_fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0 && info.tcpi_sacked > 0) {
+        load = std::max(load, static_cast<double>(info.tcpi_unacked) / info.tcpi_sacked);
+    }
+    return std::min(load, 1.0);
+}
@@ -1,23 +1,38 @@
 #include "BloomFilter.h"
+#include <algorithm>
 
-BloomFilter::BloomFilter(size_t size, size_t num_hashes)
-    : bits_(size, false), num_hashes_(num_hashes) {}
+BloomFilter::BloomFilter(size_t size, size_t num_hashes, MemoryAccount* account)
+    : bits_(std::max<size_t>(size, 1), false, TrackingAllocator<bool>(account)),
+      previous_bits_(TrackingAllocator<bool>(account)), num_hashes_(num_hashes) {}
 
-void BloomFilter::add(const std::string& item) {
+void BloomFilter::add(const MessageId& item) {
     for (size_t i = 0; i < num_hashes_; ++i) {
-        bits_[hash(item, i)] = true;
+        bits_[hash(item, i, bits_.size())] = true;
     }
 }
 
-bool BloomFilter::probably_contains(const std::string& item) const {
+bool BloomFilter::probably_contains(const MessageId& item) const {
+    return contains(bits_, item) || (!previous_bits_.empty() && contains(previous_bits_, item));
+}
+
+// The new array is allocated before the current one is retired, so a failed
+// allocation leaves the filter as it was
+void BloomFilter::resize(size_t size) {
+    Bits fresh(std::max<size_t>(size, 1), false, bits_.get_allocator());
+    previous_bits_ = std::move(bits_);
+    bits_ = std::move(fresh);
+}
+
+bool BloomFilter::contains(const Bits& bits, const MessageId& item) const {
     for (size_t i = 0; i < num_hashes_; ++i) {
-        if (!bits_[hash(item, i)]) {
+        if (!bits[hash(item, i, bits.size())]) {
             return false;
         }
     }
     return true;
 }
 
-size_t BloomFilter::hash(const std::string& item, size_t index) const {
-    return (hash_func_(item) + index) % bits_.size();
+// Double hashing over the two halves of the id, which are already uniform
+size_t BloomFilter::hash(const MessageId& item, size_t index, size_t size) const {
+    return (item.high() + index * (item.low() | 1)) % size;
 }
@@ -0,0 +1,222 @@
+#include "Datagram.h"
+#include "Debug.h"
+
+DatagramChannel::DatagramChannel(boost::asio::io_context& io_context, FrameHandler handler, Fallback fallback)
+    : socket_(io_context), handler_(std::move(handler)), fallback_(std::move(fallback)),
+      window_(WINDOW, MAX_ATTEMPTS),
+      ack_timer_(TimerWheel::of(io_context)), retransmit_timer_(TimerWheel::of(io_context)) {
+    window_.adaptRto(MIN_RTO);
+    ack_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        sendAck();
+    });
+    retransmit_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        retransmitExpired();
+    });
+}
+
+uint16_t DatagramChannel::open(const boost::asio::ip::address& address) {
+    boost::asio::ip::udp::endpoint local(address, 0);
+    socket_.open(local.protocol());
+    socket_.bind(local);
+    // Sends never wait; a full socket buffer loses the datagram as the network might
+    socket_.non_blocking(true);
+    receive();
+    return socket_.local_endpoint().port();
+}
+
+void DatagramChannel::connect(const boost::asio::ip::udp::endpoint& remote) {
+    remote_ = remote;
+    connected_ = true;
+}
+
+bool DatagramChannel::carries(const EncodedFrame& frame) {
+    return frame.payload.size() <= MAX_PAYLOAD && carriesType(frame.type);
+}
+
+// Datagrams can overtake each other and the stream, so only frames whose
+// effect does not depend on their order qualify. Interest adverts and peer
+// exchanges update what came before them; handshakes, admission and
+// keepalives belong to the stream itself.
+bool DatagramChannel::carriesType(PacketType type) {
+    switch (type) {
+    case PacketType::Data:
+    case PacketType::PeerRequest:
+    case PacketType::Have:
+    case PacketType::PieceRequest:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool DatagramChannel::send(FramePtr frame) {
+    if (!ready() || disabled_ || window_.full() || (!confirmed_ && !window_.empty())) {
+        return false;
+    }
+    uint32_t sequence = window_.nextSequence();
+    window_.add(sequence, frame, Clock::now());
+    transmit(*frame, sequence);
+    ++stats_.sent;
+    armRetransmitTimer();
+    return true;
+}
+
+void DatagramChannel::close() {
+    ack_timer_.cancel();
+    retransmit_timer_.cancel();
+    handler_ = nullptr;
+    fallback_ = nullptr;
+    session_ = nullptr;
+    connected_ = false;
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+}
+
+void DatagramChannel::receive() {
+    socket_.async_receive_from(boost::asio::buffer(buffer_), sender_,
+        makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, std::size_t size) {
+                if (ec == boost::asio::error::operation_aborted || !socket_.is_open()) {
+                    return;
+                }
+                if (!ec) {
+                    handleDatagram(size);
+                }
+                receive();
+            }));
+}
+
+// Checked as the stream checks a frame: header first, then the CRC, or on
+// a secure connection the seal in its place
+void DatagramChannel::handleDatagram(size_t size) {
+    if (!connected_ || sender_ != remote_ || size < PACKET_HEADER_SIZE || size > MAX_DATAGRAM_SIZE ||
+        !isValidHeader(buffer_.data()) || readUint32(buffer_.data(), 4) != size - PACKET_HEADER_SIZE ||
+        (buffer_[17] & (PACKET_FLAG_FRAGMENT | PACKET_FLAG_LAST_FRAGMENT)) ||
+        ((buffer_[17] & PACKET_FLAG_SEALED) != 0) != (session_ != nullptr)) {
+        ++stats_.rejected;
+        return;
+    }
+    Packet packet;
+    try {
+        if (session_) {
+            packet = session_->openDatagram(buffer_.data(), buffer_.data() + PACKET_HEADER_SIZE,
+                                            size - PACKET_HEADER_SIZE);
+        } else {
+            packet = deserializePacket(buffer_.data(),
+                                       std::vector<uint8_t>(buffer_.begin() + PACKET_HEADER_SIZE, buffer_.begin() + size));
+        }
+    } catch (const std::exception& e) {
+        ++stats_.rejected;
+        Debug::log("Dropping datagram: " + std::string(e.what()));
+        return;
+    }
+
+    if (packet.type == PacketType::Ack) {
+        confirmed_ = true;
+        if (window_.acknowledge(packet) > 0) {
+            fallbacks_ = 0;
+        }
+        if (packet.payload.size() % 8 == 4) {
+            acks_.skipTo(readUint32(packet.payload.data(), packet.payload.size() - 4));
+        }
+        return;
+    }
+    if (!carriesType(packet.type) || packet.sequence == 0) {
+        ++stats_.rejected;
+        return;
+    }
+    AckTracker::Result result = acks_.check(packet.sequence);
+    if (result == AckTracker::Result::Full) {
+        Debug::log("Too many gaps, leaving datagram " + std::to_string(packet.sequence) + " for a retransmit");
+        return;
+    }
+    if (result == AckTracker::Result::Duplicate) {
+        // Acknowledged again in case our ack was lost
+        acks_.record(packet.sequence);
+        scheduleAck();
+        ++stats_.duplicates;
+        return;
+    }
+    if (handler_ && !handler_(packet)) {
+        return;
+    }
+    acks_.record(packet.sequence);
+    scheduleAck();
+    ++stats_.received;
+}
+
+void DatagramChannel::transmit(const EncodedFrame& frame, uint32_t sequence) {
+    PacketHeader header;
+    boost::asio::const_buffer payload;
+    if (session_) {
+        header = session_->sealDatagram(frame, sequence, sealed_);
+        payload = boost::asio::buffer(sealed_);
+    } else {
+        header = makePacketHeader(frame, sequence);
+        payload = boost::asio::buffer(frame.payload);
+    }
+    std::array<boost::asio::const_buffer, 2> buffers = {boost::asio::buffer(header), payload};
+    boost::system::error_code ec;
+    socket_.send_to(buffers, remote_, 0, ec);
+    if (ec) {
+        Debug::log("Datagram to " + remote_.address().to_string() + " not sent: " + ec.message());
+    }
+}
+
+void DatagramChannel::scheduleAck() {
+    if (acks_.pendingCount() >= ACK_EVERY_FRAMES) {
+        sendAck();
+        return;
+    }
+    if (!ack_timer_.armed()) {
+        ack_timer_.arm(ACK_DELAY);
+    }
+}
+
+// Sent when asked even with nothing new to acknowledge, to pass on the
+// settled sequence
+void DatagramChannel::sendAck() {
+    if (!ready()) {
+        return;
+    }
+    ack_timer_.cancel();
+    Packet ack = acks_.buildAck();
+    appendUint32(ack.payload, window_.settledSequence());
+    transmit(*makeFrame(PacketType::Ack, std::move(ack.payload)), ack.sequence);
+}
+
+void DatagramChannel::armRetransmitTimer() {
+    if (retransmit_timer_.armed() || window_.empty()) {
+        return;
+    }
+    retransmit_timer_.arm(RETRANSMIT_TICK);
+}
+
+void DatagramChannel::retransmitExpired() {
+    if (!ready()) {
+        return;
+    }
+    std::vector<SendWindow::Retransmit> abandoned;
+    for (const auto& retransmit : window_.collectExpired(Clock::now(), &abandoned)) {
+        transmit(*retransmit.second, retransmit.first);
+        window_.markSent(retransmit.first, Clock::now());
+        ++stats_.retransmitted;
+    }
+    if (!abandoned.empty()) {
+        stats_.fell_back += abandoned.size();
+        fallbacks_ += static_cast<int>(abandoned.size());
+        if (!disabled_ && (!confirmed_ || fallbacks_ >= MAX_FALLBACKS)) {
+            disabled_ = true;
+            Debug::log("Datagrams to " + remote_.address().to_string() + " are not getting through, using the stream");
+        }
+        if (fallback_) {
+            for (auto& frame : abandoned) {
+                fallback_(std::move(frame.second));
+            }
+        }
+        sendAck();
+    }
+    armRetransmitTimer();
+}
@@ -0,0 +1,73 @@
+#include "FrameParser.h"
+#include <algorithm>
+#include <cstring>
+
+// Returns the next bytes as one run, or null if fewer have arrived. While
+// the buffer is empty the fed piece is used in place; otherwise just
+// enough of the piece is moved over to complete the run.
+const uint8_t* FrameParser::contiguous(size_t bytes) {
+    size_t buffered = buffer_.size() - offset_;
+    if (buffered == 0 && view_size_ >= bytes) {
+        return view_;
+    }
+    if (buffered >= bytes) {
+        return buffer_.data() + offset_;
+    }
+    if (buffered + view_size_ < bytes) {
+        return nullptr;
+    }
+    size_t take = bytes - buffered;
+    buffer_.insert(buffer_.end(), view_, view_ + take);
+    view_ += take;
+    view_size_ -= take;
+    return buffer_.data() + offset_;
+}
+
+void FrameParser::consume(size_t bytes) {
+    size_t buffered = buffer_.size() - offset_;
+    if (buffered == 0) {
+        view_ += bytes;
+        view_size_ -= bytes;
+        return;
+    }
+    offset_ += bytes;
+    if (offset_ == buffer_.size()) {
+        buffer_.clear();
+        offset_ = 0;
+    }
+}
+
+bool FrameParser::peekHeader(PacketHeader& header) {
+    const uint8_t* data = contiguous(PACKET_HEADER_SIZE);
+    if (!data) {
+        return false;
+    }
+    std::memcpy(header.data(), data, PACKET_HEADER_SIZE);
+    return true;
+}
+
+bool FrameParser::takeFrame(size_t length, std::vector<uint8_t>& payload) {
+    const uint8_t* data = contiguous(PACKET_HEADER_SIZE + length);
+    if (!data) {
+        return false;
+    }
+    payload.assign(data + PACKET_HEADER_SIZE, data + PACKET_HEADER_SIZE + length);
+    consume(PACKET_HEADER_SIZE + length);
+    return true;
+}
+
+void FrameParser::skip(size_t bytes) {
+    if (contiguous(bytes)) {
+        consume(bytes);
+    }
+}
+
+void FrameParser::keepRest() {
+    if (offset_ > 0) {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + offset_);
+        offset_ = 0;
+    }
+    buffer_.insert(buffer_.end(), view_, view_ + view_size_);
+    view_ = nullptr;
+    view_size_ = 0;
+}
@@ -0,0 +1,30 @@
+#include "Ingress.h"
+#include <algorithm>
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate_(rate), burst_(burst), tokens_(burst), last_refill_(Clock::now()) {}
+
+void TokenBucket::refill(Clock::time_point now) {
+    if (now > last_refill_) {
+        std::chrono::duration<double> elapsed = now - last_refill_;
+        tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+        last_refill_ = now;
+    }
+}
+
+TokenBucket::Clock::duration TokenBucket::timeUntil(Clock::time_point now, double tokens) {
+    refill(now);
+    if (tokens_ >= tokens) {
+        return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((tokens - tokens_) / rate_));
+}
+
+bool TokenBucket::consume(Clock::time_point now, double tokens) {
+    refill(now);
+    if (tokens_ < tokens) {
+        return false;
+    }
+    tokens_ -= tokens;
+    return true;
+}
@@ -0,0 +1,98 @@
+#include "InterestFilter.h"
+#include <stdexcept>
+
+InterestFilter::Key InterestFilter::keyFor(const std::string& group) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (unsigned char c : group) {
+        hash = (hash ^ c) * 0x100000001B3ULL;
+    }
+    // Second hash for double hashing, from a splitmix64 round of the first
+    uint64_t second = hash + 0x9E3779B97F4A7C15ULL;
+    second = (second ^ (second >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    second = (second ^ (second >> 27)) * 0x94D049BB133111EBULL;
+    return Key{hash, (second ^ (second >> 31)) | 1};
+}
+
+void InterestFilter::add(const Key& key) {
+    for (size_t i = 0; i < NUM_HASHES; ++i) {
+        size_t bit = (key.h1 + i * key.h2) % BITS;
+        words_[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
+bool InterestFilter::contains(const Key& key) const {
+    for (size_t i = 0; i < NUM_HASHES; ++i) {
+        size_t bit = (key.h1 + i * key.h2) % BITS;
+        if (!(words_[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void InterestFilter::merge(const InterestFilter& other) {
+    for (size_t i = 0; i < words_.size(); ++i) {
+        words_[i] |= other.words_[i];
+    }
+}
+
+bool InterestFilter::empty() const {
+    for (uint64_t word : words_) {
+        if (word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void InterestFilter::appendTo(std::vector<uint8_t>& out) const {
+    for (uint64_t word : words_) {
+        appendUint64(out, word);
+    }
+}
+
+InterestFilter InterestFilter::read(const uint8_t* data) {
+    InterestFilter filter;
+    for (size_t i = 0; i < filter.words_.size(); ++i) {
+        filter.words_[i] = readUint64(data, i * 8);
+    }
+    return filter;
+}
+
+bool InterestAdvert::mayReach(const InterestFilter::Key& key) const {
+    for (const auto& layer : layers) {
+        if (layer.contains(key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool InterestAdvert::empty() const {
+    for (const auto& layer : layers) {
+        if (!layer.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Packet InterestAdvert::toPacket() const {
+    std::vector<uint8_t> payload;
+    payload.reserve(DEPTH * InterestFilter::BYTES);
+    for (const auto& layer : layers) {
+        layer.appendTo(payload);
+    }
+    return createPacket(PacketType::Interest, std::move(payload), 0);
+}
+
+InterestAdvert InterestAdvert::fromPacket(const Packet& packet) {
+    if (packet.payload.size() != DEPTH * InterestFilter::BYTES) {
+        throw std::runtime_error("Invalid interest advert: wrong size");
+    }
+    InterestAdvert advert;
+    for (size_t i = 0; i < DEPTH; ++i) {
+        advert.layers[i] = InterestFilter::read(packet.payload.data() + i * InterestFilter::BYTES);
+    }
+    return advert;
+}
@@ -0,0 +1,205 @@
+#include "MemeAssembler.h"
+#include "Debug.h"
+#include <algorithm>
+
+std::vector<MemeAssembler::Parked> MemeAssembler::addPreview(const Message& preview, bool deliver) {
+    const MessageId& id = preview.getMessageId();
+    auto inserted = memes_.emplace(id, Meme{});
+    if (!inserted.second) {
+        return {};
+    }
+    Meme& meme = inserted.first->second;
+    meme.preview = preview;
+    meme.deliver = deliver;
+    order_.push_back(id);
+    meme.received.assign(preview.getChunkIds().size(), false);
+    meme.missing = meme.received.size();
+
+    // Older memes give up their buffered bodies first, then their chunk lists
+    size_t claimed = preview.getBodySize();
+    bool room = claimed <= MAX_BUFFERED_BYTES;
+    while (room && reserved_bytes_ + claimed > MAX_BUFFERED_BYTES) {
+        auto old = victim(id, true);
+        room = old != order_.end();
+        if (room) {
+            Debug::log("Dropping body of meme " + old->toHex() + " to stay within the buffer budget");
+            dropBody(memes_.at(*old));
+        }
+    }
+    if (room) {
+        meme.keep_body = true;
+        meme.chunks.resize(meme.received.size());
+        reserved_bytes_ += claimed;
+    } else if (meme.missing > 0) {
+        abandon(meme);
+    }
+    while (order_.size() > MAX_MEMES) {
+        auto old = victim(id, false);
+        if (old == order_.end()) {
+            old = order_.front() == id ? std::next(order_.begin()) : order_.begin();
+        }
+        dropBody(memes_.at(*old));
+        memes_.erase(*old);
+        order_.erase(old);
+    }
+
+    std::vector<Parked> released;
+    auto parked = parked_.find(id);
+    if (parked != parked_.end()) {
+        released = std::move(parked->second);
+        for (const auto& entry : released) {
+            parked_bytes_ -= entry.chunk.getContent().size();
+        }
+        parked_.erase(parked);
+        parked_order_.erase(std::find(parked_order_.begin(), parked_order_.end(), id));
+    }
+    return released;
+}
+
+// The chunk id is recomputed from the bytes, so a chunk listed by a
+// verified preview cannot be swapped for other content on the way
+MemeAssembler::Check MemeAssembler::check(const Message& chunk) const {
+    auto it = memes_.find(chunk.getParentId());
+    if (it == memes_.end()) {
+        return Check::Unknown;
+    }
+    const Message& preview = it->second.preview;
+    const auto& ids = preview.getChunkIds();
+    size_t index = chunk.getChunkIndex();
+    if (index >= ids.size() || ids[index] != chunk.getMessageId() ||
+        chunk.getGroupId() != preview.getGroupId()) {
+        return Check::Invalid;
+    }
+    size_t expected = std::min(Message::CHUNK_SIZE, preview.getBodySize() - index * Message::CHUNK_SIZE);
+    if (chunk.getContent().size() != expected ||
+        MessageId::forChunk(chunk.getParentId(), chunk.getChunkIndex(), chunk.getContent()) != chunk.getMessageId()) {
+        return Check::Invalid;
+    }
+    return Check::Valid;
+}
+
+// When full, the chunks parked longest give way
+void MemeAssembler::park(const std::shared_ptr<Peer>& from, const Message& chunk) {
+    const MessageId& parent = chunk.getParentId();
+    auto existing = parked_.find(parent);
+    if (existing != parked_.end()) {
+        for (const auto& entry : existing->second) {
+            if (entry.chunk.getMessageId() == chunk.getMessageId()) {
+                return;
+            }
+        }
+    }
+    size_t bytes = chunk.getContent().size();
+    while (parked_bytes_ + bytes > MAX_PARKED_BYTES && !parked_order_.empty()) {
+        evictParked(parked_order_.front());
+    }
+    auto& entries = parked_[parent];
+    if (entries.empty()) {
+        parked_order_.push_back(parent);
+    }
+    entries.push_back({from, chunk});
+    parked_bytes_ += bytes;
+}
+
+bool MemeAssembler::addChunk(const Message& chunk, Message& complete) {
+    auto it = memes_.find(chunk.getParentId());
+    if (it == memes_.end() || !it->second.keep_body) {
+        return false;
+    }
+    Meme& meme = it->second;
+    size_t index = chunk.getChunkIndex();
+    if (meme.received[index]) {
+        return false;
+    }
+    meme.received[index] = true;
+    meme.chunks[index] = chunk.getContent();
+    buffered_bytes_ += meme.chunks[index].size();
+    if (--meme.missing > 0 || !meme.deliver) {
+        return false;
+    }
+    // The chunks stay, to be served to neighbours
+    std::string body;
+    body.reserve(meme.preview.getBodySize());
+    for (const auto& stored : meme.chunks) {
+        body += stored;
+    }
+    complete = Message::assembled(meme.preview, body);
+    return true;
+}
+
+bool MemeAssembler::piece(const MessageId& parent, uint32_t index, Message& chunk) const {
+    auto it = memes_.find(parent);
+    if (it == memes_.end() || !it->second.keep_body || index >= it->second.received.size() ||
+        !it->second.received[index]) {
+        return false;
+    }
+    chunk = Message::chunk(it->second.preview, index, it->second.chunks[index]);
+    return true;
+}
+
+std::vector<bool> MemeAssembler::pieces(const MessageId& parent) const {
+    auto it = memes_.find(parent);
+    return it == memes_.end() ? std::vector<bool>() : it->second.received;
+}
+
+void MemeAssembler::shrinkTo(size_t bytes) {
+    while (buffered_bytes_ + parked_bytes_ > bytes && !parked_order_.empty()) {
+        evictParked(parked_order_.front());
+    }
+    for (auto it = order_.begin(); buffered_bytes_ > bytes && it != order_.end(); ++it) {
+        Meme& meme = memes_.at(*it);
+        if (meme.keep_body && !awaited(meme) && meme.missing < meme.received.size()) {
+            Debug::log("Dropping body of meme " + it->toHex() + " to stay within the memory budget");
+            dropBody(meme);
+        }
+    }
+}
+
+std::deque<MessageId>::iterator MemeAssembler::victim(const MessageId& keep, bool want_body) {
+    auto oldest = order_.end();
+    for (auto it = order_.begin(); it != order_.end(); ++it) {
+        const Meme& meme = memes_.at(*it);
+        if (*it == keep || awaited(meme) || (want_body && !meme.keep_body)) {
+            continue;
+        }
+        if (meme.missing == meme.preview.getChunkIds().size()) {
+            return it;
+        }
+        if (oldest == order_.end()) {
+            oldest = it;
+        }
+    }
+    return oldest;
+}
+
+void MemeAssembler::dropBody(Meme& meme) {
+    if (!meme.keep_body) {
+        return;
+    }
+    reserved_bytes_ -= meme.preview.getBodySize();
+    for (const auto& stored : meme.chunks) {
+        buffered_bytes_ -= stored.size();
+    }
+    meme.keep_body = false;
+    std::vector<std::string>().swap(meme.chunks);
+    std::vector<bool>().swap(meme.received);
+    if (meme.missing > 0) {
+        abandon(meme);
+    }
+}
+
+void MemeAssembler::abandon(const Meme& meme) {
+    if (meme.deliver) {
+        Debug::log("Giving up on delivering meme " + meme.preview.getMessageId().toHex() + ", no room for its body");
+    }
+    abandoned_.push_back(meme.preview.getMessageId());
+}
+
+void MemeAssembler::evictParked(const MessageId& parent) {
+    auto it = parked_.find(parent);
+    for (const auto& entry : it->second) {
+        parked_bytes_ -= entry.chunk.getContent().size();
+    }
+    parked_.erase(it);
+    parked_order_.erase(std::find(parked_order_.begin(), parked_order_.end(), parent));
+}
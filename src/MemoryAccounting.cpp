@@ -0,0 +1,67 @@
+#include "MemoryAccounting.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+std::string formatBytes(size_t bytes) {
+    char text[32];
+    if (bytes >= 1024 * 1024) {
+        std::snprintf(text, sizeof(text), "%.1f MiB", bytes / (1024.0 * 1024.0));
+    } else if (bytes >= 1024) {
+        std::snprintf(text, sizeof(text), "%.1f KiB", bytes / 1024.0);
+    } else {
+        std::snprintf(text, sizeof(text), "%zu B", bytes);
+    }
+    return text;
+}
+
+std::string formatLine(const std::string& owner, size_t bytes, int indent) {
+    char text[128];
+    std::snprintf(text, sizeof(text), "%*s%-*s %12s\n", indent, "", 28 - indent, owner.c_str(),
+                  formatBytes(bytes).c_str());
+    return text;
+}
+
+}
+
+size_t MemoryReport::accounted() const {
+    size_t total = 0;
+    for (const auto& entry : subsystems) {
+        total += entry.bytes;
+    }
+    for (const auto& entry : connections) {
+        total += entry.bytes;
+    }
+    return total;
+}
+
+std::string MemoryReport::format(size_t max_connections) const {
+    std::string text = formatLine("resident", resident, 0);
+    for (const auto& entry : subsystems) {
+        text += formatLine(entry.owner, entry.bytes, 2);
+    }
+    size_t connection_total = 0;
+    for (const auto& entry : connections) {
+        connection_total += entry.bytes;
+    }
+    text += formatLine("connections (" + std::to_string(connections.size()) + ")", connection_total, 2);
+    for (size_t i = 0; i < connections.size() && i < max_connections; ++i) {
+        text += formatLine(connections[i].owner, connections[i].bytes, 4);
+    }
+    size_t total = accounted();
+    text += formatLine("unattributed", resident > total ? resident - total : 0, 2);
+    return text;
+}
+
+size_t residentMemory() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident_pages = 0;
+    if (!(statm >> pages >> resident_pages)) {
+        return 0;
+    }
+    return resident_pages * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
@@ -1,25 +1,152 @@
 #include "Message.h"
 #include "Debug.h"
-#include <sstream>
-#include <iomanip>
-#include <random>
+#include <cstdint>
+#include <stdexcept>
 
 Message::Message() 
-    : timestamp(std::time(nullptr)), ttl(10), is_acknowledgment(false) {}
+    : timestamp(std::time(nullptr)), ttl(10) {}
 
 Message::Message(const std::string& group_id, const std::string& sender_id, const std::string& content)
-    : message_id(generateMessageId()), group_id(group_id), sender_id(sender_id),
-      timestamp(std::time(nullptr)), content(content), ttl(10), is_acknowledgment(false) {}
+    : message_id(MessageId::random()), group_id(group_id), sender_id(sender_id),
+      timestamp(std::time(nullptr)), content(content), ttl(10) {}
+
+Message Message::contentAddressed(const std::string& group_id, const std::string& sender_id,
+                                  const std::string& content) {
+    Message msg(group_id, sender_id, content);
+    msg.message_id = MessageId::fromContent(sender_id, msg.timestamp, content);
+    return msg;
+}
+
+std::vector<Message> Message::progressive(const std::string& group_id, const std::string& sender_id,
+                                          const std::string& preview, const std::string& body) {
+    if (preview.empty() || preview.size() > MAX_PREVIEW_SIZE) {
+        throw std::runtime_error("Preview must be 1 to " + std::to_string(MAX_PREVIEW_SIZE) + " bytes");
+    }
+    if (body.empty() || body.size() > MAX_BODY_SIZE) {
+        throw std::runtime_error("Meme body must be 1 to " + std::to_string(MAX_BODY_SIZE) + " bytes");
+    }
+
+    std::vector<Message> parts;
+    parts.reserve(1 + (body.size() + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    parts.emplace_back(group_id, sender_id, preview);
+    Message& head = parts[0];
+    head.kind = MessageKind::Preview;
+    head.body_size = body.size();
+    for (size_t offset = 0; offset < body.size(); offset += CHUNK_SIZE) {
+        Message part = chunk(head, static_cast<uint32_t>(offset / CHUNK_SIZE), body.substr(offset, CHUNK_SIZE));
+        head.chunk_ids.push_back(part.message_id);
+        parts.push_back(std::move(part));
+    }
+    return parts;
+}
+
+Message Message::chunk(const Message& preview, uint32_t index, std::string content) {
+    Message part;
+    part.group_id = preview.group_id;
+    part.sender_id = preview.sender_id;
+    part.timestamp = preview.timestamp;
+    part.content = std::move(content);
+    part.kind = MessageKind::Chunk;
+    part.parent_id = preview.message_id;
+    part.chunk_index = index;
+    part.message_id = MessageId::forChunk(part.parent_id, index, part.content);
+    return part;
+}
+
+Message Message::assembled(const Message& preview, std::string body) {
+    Message msg = preview;
+    msg.kind = MessageKind::Whole;
+    msg.content = std::move(body);
+    msg.body_size = 0;
+    msg.chunk_ids.clear();
+    msg.trace.reset();
+    msg.encoded_.reset();
+    return msg;
+}
+
+// Wire layout (big endian): id[16] ttl[1] timestamp[8] then group, sender
+// and signature with u16 length prefixes and content with a u32 prefix. The
+// id always sits at offset 0 so it can be read without parsing the rest.
+// Parts of a progressive meme append kind[1], then for a preview
+// body_size[4] count[4] and the chunk ids, or for a chunk parent[16]
+// index[4]. A whole message ends after its content, as it always has,
+// unless it is traced: a sampled message of any kind then carries kind[1]
+// and its kind's fields, followed by TRACE_EXTENSION[1] id[8] count[1] and
+// count hops of node[8] received[8] dequeued[8] forwarded[8].
+namespace {
+
+void appendField(std::vector<uint8_t>& payload, const char* name, const std::string& field) {
+    if (field.size() > UINT16_MAX) {
+        throw std::runtime_error(std::string("Message ") + name + " is over " + std::to_string(UINT16_MAX) + " bytes");
+    }
+    appendUint16(payload, static_cast<uint16_t>(field.size()));
+    payload.insert(payload.end(), field.begin(), field.end());
+}
+
+}
+
+FramePtr Message::encode() const {
+    if (encoded_) {
+        return encoded_;
+    }
+
+    std::vector<uint8_t> payload;
+    payload.reserve(MessageId::SIZE + 1 + 8 + 2 + group_id.size() + 2 + sender_id.size() +
+                    2 + signature.size() + 4 + content.size() +
+                    1 + 8 + chunk_ids.size() * MessageId::SIZE + MessageId::SIZE + 4 +
+                    (trace ? 1 + 8 + 1 + trace->hops.size() * 32 : 0));
+
+    payload.insert(payload.end(), message_id.bytes.begin(), message_id.bytes.end());
+    payload.push_back(static_cast<uint8_t>(ttl));
+    appendUint64(payload, static_cast<uint64_t>(timestamp));
+    appendField(payload, "group", group_id);
+    appendField(payload, "sender", sender_id);
+    appendField(payload, "signature", signature);
+    appendUint32(payload, static_cast<uint32_t>(content.size()));
+    payload.insert(payload.end(), content.begin(), content.end());
+    if (kind == MessageKind::Preview) {
+        payload.push_back(static_cast<uint8_t>(kind));
+        appendUint32(payload, static_cast<uint32_t>(body_size));
+        appendUint32(payload, static_cast<uint32_t>(chunk_ids.size()));
+        for (const auto& id : chunk_ids) {
+            payload.insert(payload.end(), id.bytes.begin(), id.bytes.end());
+        }
+    } else if (kind == MessageKind::Chunk) {
+        payload.push_back(static_cast<uint8_t>(kind));
+        payload.insert(payload.end(), parent_id.bytes.begin(), parent_id.bytes.end());
+        appendUint32(payload, chunk_index);
+    } else if (trace) {
+        payload.push_back(static_cast<uint8_t>(kind));
+    }
+    if (trace) {
+        payload.push_back(TRACE_EXTENSION);
+        appendUint64(payload, trace->id);
+        payload.push_back(static_cast<uint8_t>(trace->hops.size()));
+        for (const auto& hop : trace->hops) {
+            appendUint64(payload, hop.node);
+            appendUint64(payload, hop.received_us);
+            appendUint64(payload, hop.dequeued_us);
+            appendUint64(payload, hop.forwarded_us);
+        }
+    }
+
+    encoded_ = makeFrame(PacketType::Data, std::move(payload));
+    return encoded_;
+}
 
 std::vector<Packet> Message::serialize() const {
-    std::stringstream ss;
-    ss << message_id << "|" << group_id << "|" << sender_id << "|"
-       << timestamp << "|" << content << "|" << signature << "|" << ttl;
-    std::string serialized = ss.str();
-    
+    FramePtr frame = encode();
+
     // For simplicity, we're creating a single packet. In a real-world scenario,
     // you might want to split large messages into multiple packets.
-    return {createPacket(serialized, 0)};
+    Packet packet;
+    packet.magic = MAGIC_NUMBER;
+    packet.type = PacketType::Data;
+    packet.payload = frame->payload;
+    packet.length = packet.payload.size();
+    packet.sequence = 0;
+    packet.checksum = frame->checksum;
+    return {packet};
 }
 
 Message Message::deserialize(const std::vector<Packet>& packets) {
@@ -29,59 +156,134 @@ Message Message::deserialize(const std::vector<Packet>& packets) {
 
     // For now, we're assuming a single packet. In the future, you might want to
     // handle multiple packets and reassemble them.
-    std::string serialized(packets[0].payload.begin(), packets[0].payload.end());
-    
-    Debug::log("Deserializing message: " + serialized);
-    std::istringstream ss(serialized);
-    Message msg;
+    return decode(makeFrame(packets[0]));
+}
 
-    std::getline(ss, msg.message_id, '|');
-    std::getline(ss, msg.group_id, '|');
-    std::getline(ss, msg.sender_id, '|');
-    std::string timestamp_str;
-    std::getline(ss, timestamp_str, '|');
-    std::getline(ss, msg.content, '|');
-    std::getline(ss, msg.signature, '|');
-    ss >> msg.ttl;
-
-    if (ss.fail()) {
-        Debug::log("Failed to parse message");
-        throw std::runtime_error("Failed to parse message: " + serialized);
-    }
+Message Message::decode(FramePtr frame) {
+    const std::vector<uint8_t>& payload = frame->payload;
+    size_t offset = 0;
 
-    msg.timestamp = std::stoll(timestamp_str);
-    Debug::log("Successfully parsed message");
-    return msg;
-}
+    auto require = [&](size_t count) {
+        if (payload.size() - offset < count) {
+            throw std::runtime_error("Failed to parse message: truncated payload");
+        }
+    };
+    auto readString = [&](std::string& out, size_t length) {
+        require(length);
+        out.assign(reinterpret_cast<const char*>(payload.data()) + offset, length);
+        offset += length;
+    };
 
+    Message msg;
+    require(MessageId::SIZE + 1 + 8);
+    msg.message_id = MessageId::fromBytes(payload.data());
+    offset += MessageId::SIZE;
+    msg.ttl = payload[offset++];
+    msg.timestamp = static_cast<time_t>(readUint64(payload.data(), offset));
+    offset += 8;
 
+    require(2);
+    size_t length = readUint16(payload.data(), offset);
+    offset += 2;
+    readString(msg.group_id, length);
+    require(2);
+    length = readUint16(payload.data(), offset);
+    offset += 2;
+    readString(msg.sender_id, length);
+    require(2);
+    length = readUint16(payload.data(), offset);
+    offset += 2;
+    readString(msg.signature, length);
+    require(4);
+    length = readUint32(payload.data(), offset);
+    offset += 4;
+    readString(msg.content, length);
 
+    if (offset < payload.size()) {
+        msg.kind = static_cast<MessageKind>(payload[offset++]);
+        if (msg.kind == MessageKind::Preview) {
+            require(8);
+            msg.body_size = readUint32(payload.data(), offset);
+            size_t count = readUint32(payload.data(), offset + 4);
+            offset += 8;
+            if (msg.body_size == 0 || msg.body_size > MAX_BODY_SIZE ||
+                count != (msg.body_size + CHUNK_SIZE - 1) / CHUNK_SIZE) {
+                throw std::runtime_error("Failed to parse message: bad chunk list");
+            }
+            require(count * MessageId::SIZE);
+            for (size_t i = 0; i < count; ++i) {
+                msg.chunk_ids.push_back(MessageId::fromBytes(payload.data() + offset));
+                offset += MessageId::SIZE;
+            }
+        } else if (msg.kind == MessageKind::Chunk) {
+            require(MessageId::SIZE + 4);
+            msg.parent_id = MessageId::fromBytes(payload.data() + offset);
+            msg.chunk_index = readUint32(payload.data(), offset + MessageId::SIZE);
+            offset += MessageId::SIZE + 4;
+        } else if (msg.kind != MessageKind::Whole) {
+            throw std::runtime_error("Failed to parse message: unknown kind");
+        }
+    }
+    if (offset < payload.size()) {
+        if (payload[offset++] != TRACE_EXTENSION) {
+            throw std::runtime_error("Failed to parse message: unknown extension");
+        }
+        require(8 + 1);
+        MessageTrace trace;
+        trace.id = readUint64(payload.data(), offset);
+        size_t count = payload[offset + 8];
+        offset += 8 + 1;
+        if (count == 0 || count > MessageTrace::MAX_HOPS) {
+            throw std::runtime_error("Failed to parse message: bad trace");
+        }
+        require(count * 32);
+        trace.hops.resize(count);
+        for (auto& hop : trace.hops) {
+            hop.node = readUint64(payload.data(), offset);
+            hop.received_us = readUint64(payload.data(), offset + 8);
+            hop.dequeued_us = readUint64(payload.data(), offset + 16);
+            hop.forwarded_us = readUint64(payload.data(), offset + 24);
+            offset += 32;
+        }
+        msg.trace = std::make_shared<const MessageTrace>(std::move(trace));
+    }
 
+    if (Debug::enabled) {
+        Debug::log("Parsed message " + msg.message_id.toHex() + " (" + std::to_string(payload.size()) + " bytes)");
+    }
+    msg.encoded_ = std::move(frame);
+    return msg;
+}
 
-std::string Message::generateMessageId() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> dis(0, 15);
-    const char* hex_chars = "0123456789abcdef";
-    std::string uuid;
-    for (int i = 0; i < 32; ++i) {
-        uuid += hex_chars[dis(gen)];
+bool Message::peekId(const std::vector<uint8_t>& payload, MessageId& id) {
+    if (payload.size() < MessageId::SIZE) {
+        return false;
     }
-    return uuid;
+    id = MessageId::fromBytes(payload.data());
+    return true;
+}
+
+void Message::setMessageId(const MessageId& id) {
+    message_id = id;
+    encoded_.reset();
 }
 
 void Message::setContent(const std::string& new_content) {
     content = new_content;
+    encoded_.reset();
 }
 
 void Message::setSignature(const std::string& sig) {
     signature = sig;
+    encoded_.reset();
 }
 
 void Message::setTTL(int new_ttl) {
     ttl = new_ttl;
+    encoded_.reset();
 }
 
-void Message::setAsAcknowledgment(bool is_ack) {
-    is_acknowledgment = is_ack;
+void Message::setTrace(MessageTrace new_trace) {
+    trace = std::make_shared<const MessageTrace>(std::move(new_trace));
+    encoded_.reset();
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "MessageId.h"
+#include "Packet.h"
+#include <openssl/evp.h>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+// A single 32-bit seed would give two in a few hundred thousand nodes the
+// same stream of ids, and each would drop the other's messages as seen
+std::mt19937_64 seededGenerator() {
+    std::random_device device;
+    std::seed_seq seed{device(), device(), device(), device(), device(), device(), device(), device()};
+    return std::mt19937_64(seed);
+}
+
+}
+
+MessageId MessageId::random() {
+    static thread_local std::mt19937_64 gen = seededGenerator();
+    MessageId id;
+    uint64_t high = gen();
+    uint64_t low = gen();
+    std::memcpy(id.bytes.data(), &high, 8);
+    std::memcpy(id.bytes.data() + 8, &low, 8);
+    return id;
+}
+
+MessageId MessageId::fromContent(const std::string& sender_id, time_t timestamp,
+                                 const std::string& content) {
+    // Length-prefix each field so ("ab", "c") and ("a", "bc") hash differently
+    std::vector<uint8_t> prefix;
+    appendUint32(prefix, static_cast<uint32_t>(sender_id.size()));
+    appendUint64(prefix, static_cast<uint64_t>(timestamp));
+    appendUint32(prefix, static_cast<uint32_t>(content.size()));
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    if (!mdctx ||
+        EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1 ||
+        EVP_DigestUpdate(mdctx, prefix.data(), prefix.size()) != 1 ||
+        EVP_DigestUpdate(mdctx, sender_id.data(), sender_id.size()) != 1 ||
+        EVP_DigestUpdate(mdctx, content.data(), content.size()) != 1 ||
+        EVP_DigestFinal_ex(mdctx, digest, &digest_len) != 1) {
+        EVP_MD_CTX_free(mdctx);
+        throw std::runtime_error("Failed to hash message content");
+    }
+    EVP_MD_CTX_free(mdctx);
+
+    return fromBytes(digest);
+}
+
+MessageId MessageId::forChunk(const MessageId& parent, uint32_t index, const std::string& content) {
+    std::vector<uint8_t> prefix(parent.bytes.begin(), parent.bytes.end());
+    appendUint32(prefix, index);
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    if (!mdctx ||
+        EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1 ||
+        EVP_DigestUpdate(mdctx, prefix.data(), prefix.size()) != 1 ||
+        EVP_DigestUpdate(mdctx, content.data(), content.size()) != 1 ||
+        EVP_DigestFinal_ex(mdctx, digest, &digest_len) != 1) {
+        EVP_MD_CTX_free(mdctx);
+        throw std::runtime_error("Failed to hash chunk content");
+    }
+    EVP_MD_CTX_free(mdctx);
+
+    return fromBytes(digest);
+}
+
+MessageId MessageId::fromBytes(const uint8_t* data) {
+    MessageId id;
+    std::memcpy(id.bytes.data(), data, SIZE);
+    return id;
+}
+
+bool MessageId::isNull() const {
+    for (uint8_t b : bytes) {
+        if (b != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string MessageId::toHex() const {
+    const char* hex_chars = "0123456789abcdef";
+    std::string hex(SIZE * 2, '0');
+    for (size_t i = 0; i < SIZE; ++i) {
+        hex[2 * i] = hex_chars[bytes[i] >> 4];
+        hex[2 * i + 1] = hex_chars[bytes[i] & 0x0F];
+    }
+    return hex;
+}
@@ -2,6 +2,7 @@
 #include "Debug.h"
 #include "Packet.h"
 #include "PeerConnection.h"
+#include "Admission.h"
 #include <iostream>
 #include <boost/bind/bind.hpp>
 #include <openssl/evp.h>
@@ -9,231 +10,1378 @@
 #include <iomanip>
 #include <random>
 #include <cmath>
+#include <algorithm>
+#include <cstring>
 
 PeerConnection::PeerConnection(boost::asio::io_context& io_context, 
                                const std::string& server, const std::string& port)
-    : socket_(io_context), server_(server), port_(port) {}
+    : socket_(io_context), server_(server), port_(port),
+      ack_timer_(TimerWheel::of(io_context)), retransmit_timer_(TimerWheel::of(io_context)),
+      idle_timer_(TimerWheel::of(io_context)), keepalive_timer_(TimerWheel::of(io_context)),
+      handshake_timer_(TimerWheel::of(io_context)), reassembly_timer_(TimerWheel::of(io_context)),
+      throttle_timer_(TimerWheel::of(io_context)), ingress_bucket_(INGRESS_RATE, INGRESS_BURST) {
+    // Below INITIAL_RTO a resend would only ever duplicate what TCP delivers
+    send_window_.adaptRto(SendWindow::INITIAL_RTO);
+    // Each callback holds a reference, since closing may release the last other one
+    ack_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        if (connected_) {
+            sendAck();
+        }
+    });
+    retransmit_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        retransmitExpired();
+    });
+    idle_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        checkIdle();
+    });
+    keepalive_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        checkKeepalive();
+    });
+    handshake_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        Debug::log("Handshake with " + getAddress() + " timed out");
+        close();
+    });
+    reassembly_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        checkReassembly();
+    });
+    throttle_timer_.setCallback([this]() {
+        auto self = shared_from_this();
+        resumeReceive();
+    });
+}
+
+// The channel may outlive us in its own pending receive, and must not keep
+// a pointer to session_
+PeerConnection::~PeerConnection() {
+    if (datagrams_) {
+        datagrams_->close();
+    }
+#ifdef TELELIBRE_IO_URING
+    if (receiving_) {
+        UringReactor::of(static_cast<boost::asio::io_context&>(socket_.get_executor().context()))
+            .stopReceive(receive_token_);
+    }
+#endif
+}
+
+void PeerConnection::setIdentity(std::shared_ptr<const NodeIdentity> identity) {
+    session_ = std::make_unique<SecureSession>(std::move(identity));
+}
 
 void PeerConnection::start() {
+    // Our Handshake goes out ahead of anything else queued for this peer
+    if (session_) {
+        scheduler_.push(makeFrame(session_->hello()), 0, true);
+        handshake_timer_.arm(HANDSHAKE_TIMEOUT);
+    }
     boost::asio::ip::tcp::resolver resolver(socket_.get_executor());
     auto endpoints = resolver.resolve(server_, port_);
     boost::asio::async_connect(socket_, endpoints,
-        [this](boost::system::error_code ec, boost::asio::ip::tcp::endpoint) {
-            if (!ec) {
-                std::cout << "Connected to " << server_ << ":" << port_ << std::endl;
-                receiveMessage();
-            } else {
-                std::cout << "Failed to connect to " << server_ << ":" << port_ << ": " << ec.message() << std::endl;
-            }
-        });
+        makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, boost::asio::ip::tcp::endpoint endpoint) {
+                if (!ec) {
+                    std::cout << "Connected to " << server_ << ":" << port_ << std::endl;
+                    connected_ = true;
+                    remote_endpoint_ = endpoint;
+                    connected_at_ = Clock::now();
+                    last_received_ = connected_at_;
+                    idle_timer_.arm(IDLE_TIMEOUT);
+                    keepalive_timer_.arm(KEEPALIVE_INTERVAL);
+                    armRetransmitTimer();
+                    // A secure connection waits until its keys are agreed
+                    if (!session_) {
+                        offerDatagrams();
+                    }
+                    writeNext();
+                    receiveMessage();
+                } else {
+                    std::cout << "Failed to connect to " << server_ << ":" << port_ << ": " << ec.message() << std::endl;
+                    close();
+                }
+            }));
+}
+
+// A neighbour that is not keeping up loses memes before anything else
+bool PeerConnection::sendMessage(const Message& msg) {
+    FramePtr frame = msg.encode();
+    if (memory_budget_ != 0 && SendScheduler::classify(*frame) == SendClass::Bulk &&
+        memoryUsage() + frame->payload.size() > memory_budget_) {
+        ++shed_frames_;
+        Debug::log("Over memory budget, dropping bulk frame for " + getAddress());
+        return false;
+    }
+    sendFrame(std::move(frame));
+    return true;
+}
+
+void PeerConnection::sendControl(Packet packet) {
+    sendFrame(makeFrame(std::move(packet)));
+}
+
+void PeerConnection::sendFrame(FramePtr frame) {
+    if (datagrams_ && DatagramChannel::carries(*frame) && datagrams_->send(frame)) {
+        return;
+    }
+    sendOnStream(std::move(frame));
 }
 
-void PeerConnection::sendMessage(const Message& msg) {
-    auto packets = msg.serialize();
-    for (const auto& packet : packets) {
-        auto serialized = serializePacket(packet);
-        Debug::log("Sending packet of size " + std::to_string(serialized.size()) + " bytes");
-        boost::asio::async_write(socket_, boost::asio::buffer(serialized),
+// Messages are sequenced and acknowledged on the stream; control frames are not
+void PeerConnection::sendOnStream(FramePtr frame) {
+    if (frame->type != PacketType::Data) {
+        queueFrame(std::move(frame), 0);
+    } else if (send_window_.full()) {
+        backlog_bytes_ += frame->payload.size();
+        window_backlog_.push_back(std::move(frame));
+    } else {
+        sendSequenced(std::move(frame));
+    }
+}
+
+void PeerConnection::sendSequenced(FramePtr frame) {
+    uint32_t sequence = send_window_.nextSequence();
+    send_window_.add(sequence, frame);
+    queueFrame(std::move(frame), sequence);
+    armRetransmitTimer();
+}
+
+void PeerConnection::queueFrame(FramePtr frame, uint32_t sequence) {
+    if (session_ && !session_->established()) {
+        backlog_bytes_ += frame->payload.size();
+        awaiting_handshake_.emplace_back(std::move(frame), sequence);
+        return;
+    }
+    Debug::log("Queued packet of size " + std::to_string(PACKET_HEADER_SIZE + frame->payload.size()) + " bytes");
+    scheduler_.push(std::move(frame), sequence);
+    if (connected_) {
+        writeNext();
+    }
+}
+
+// Data frames are sequenced and stay in send_window_ from before they are
+// queued until they are acked, so of the scheduler's queues only control
+// frames are counted on top of the window. Receive buffers are counted at
+// capacity, which is what they keep allocated between frames.
+size_t PeerConnection::memoryUsage() const {
+    size_t bytes = send_window_.retainedBytes() + backlog_bytes_ + scheduler_.queuedBytes(SendClass::Control) +
+                   in_flight_.sealed.capacity() + payload_buffer_.capacity() + reassembler_.bufferedBytes();
+#ifdef TELELIBRE_IO_URING
+    bytes += parser_.bufferedBytes();
+#endif
+    if (datagrams_) {
+        bytes += datagrams_->memoryUsage();
+    }
+    return bytes;
+}
+
+// Pieces are written one at a time in the order scheduler_ picks them: a
+// whole frame, or one fragment of a bulk frame. in_flight_ owns the bytes
+// until the write completes and keeps the handler down to a single pointer.
+// Header and shared payload go out in one gathered write. Sealing happens
+// here rather than when a frame is queued because the session's nonces must
+// follow the order pieces reach the wire.
+void PeerConnection::writeNext() {
+    if (writing_ || !scheduler_.next(in_flight_.piece)) {
+        return;
+    }
+    const SendScheduler::Piece& piece = in_flight_.piece;
+    const EncodedFrame& frame = *piece.frame;
+    boost::asio::const_buffer payload;
+    // Our Handshake and Admission solution are the only frames a secure
+    // connection sends in the clear
+    if (session_ && frame.type != PacketType::Handshake && frame.type != PacketType::Admission) {
+        // Ciphertext is per connection, so only sealed links copy the payload
+        in_flight_.header = session_->seal(frame, piece.offset, piece.length, piece.sequence,
+                                           piece.flags, in_flight_.sealed);
+        payload = boost::asio::buffer(in_flight_.sealed);
+    } else {
+        in_flight_.header = makePacketHeader(frame.type, static_cast<uint32_t>(piece.length),
+                                             piece.sequence, frame.checksum, piece.flags);
+        payload = boost::asio::buffer(frame.payload.data() + piece.offset, piece.length);
+    }
+    writing_ = true;
+    std::array<boost::asio::const_buffer, 2> buffers = {boost::asio::buffer(in_flight_.header), payload};
+    boost::asio::async_write(socket_, buffers,
+        makeCustomAllocHandler(handler_memory_,
             [this, self = shared_from_this()](boost::system::error_code ec, std::size_t bytes_transferred) {
                 if (ec) {
                     Debug::log("Error sending message: " + ec.message());
-                } else {
-                    Debug::log("Successfully sent " + std::to_string(bytes_transferred) + " bytes");
+                    close();
+                    return;
                 }
-            });
+                Debug::log("Successfully sent " + std::to_string(bytes_transferred) + " bytes");
+                writing_ = false;
+                // A message's ack can only be due once its last fragment is out
+                const SendScheduler::Piece& sent = in_flight_.piece;
+                if (sent.frame->type == PacketType::Data && sent.offset + sent.length == sent.frame->payload.size()) {
+                    send_window_.markSent(sent.sequence, Clock::now());
+                }
+                in_flight_.piece.frame.reset();
+                writeNext();
+            }));
+}
+
+#ifdef TELELIBRE_IO_URING
+void PeerConnection::receiveMessage() {
+    auto& io_context = static_cast<boost::asio::io_context&>(socket_.get_executor().context());
+    receive_token_ = UringReactor::of(io_context).startReceive(socket_.native_handle(), this);
+    receiving_ = true;
+}
+
+// The same checks as the async_read path, run over however many frames
+// the kernel delivered in one piece
+void PeerConnection::onReceive(const uint8_t* data, size_t size) {
+    auto self = shared_from_this();
+    last_received_ = Clock::now();
+    parser_.feed(data, size);
+    if (throttle_timer_.armed()) {
+        if (parser_.unreadBytes() > MAX_THROTTLED_BYTES) {
+            Debug::log("Closing " + getAddress() + ", it kept sending while throttled");
+            close();
+            return;
+        }
+        parser_.keepRest();
+        return;
     }
+    parseFrames();
 }
 
+// A frame the peer has no token for stops the loop until the token is due.
+// A multishot receive cannot leave bytes in the kernel, so while throttled
+// what arrives waits in parser_, and a peer that sends more than
+// MAX_THROTTLED_BYTES meanwhile is disconnected.
+void PeerConnection::parseFrames() {
+    while (!closed_ && parser_.peekHeader(header_buffer_)) {
+        if (!isValidHeader(header_buffer_.data())) {
+            ++ingress_stats_.bad_headers;
+            Debug::log("Invalid packet header from " + getAddress());
+            close();
+            return;
+        }
+        if (!header_admitted_) {
+            if (!admitFrame()) {
+                break;
+            }
+            header_admitted_ = true;
+        }
+        if (!parser_.takeFrame(readUint32(header_buffer_.data(), 4), payload_buffer_)) {
+            break;
+        }
+        header_admitted_ = false;
+        handlePayload();
+    }
+    if (!closed_) {
+        parser_.keepRest();
+    }
+}
 
+void PeerConnection::resumeReceive() {
+    if (closed_) {
+        return;
+    }
+    parser_.feed(nullptr, 0);
+    parseFrames();
+}
+
+void PeerConnection::onReceiveError(int error) {
+    auto self = shared_from_this();
+    Debug::log("Error receiving message: " + std::string(error ? std::strerror(error) : "connection closed"));
+    close();
+}
+#else
 void PeerConnection::receiveMessage() {
-    auto self(shared_from_this());
-    boost::asio::async_read(socket_, receive_buffer_, boost::asio::transfer_exactly(16),
-        [this, self](boost::system::error_code ec, std::size_t length) {
-            if (!ec) {
-                std::vector<uint8_t> header(boost::asio::buffers_begin(receive_buffer_.data()),
-                                            boost::asio::buffers_begin(receive_buffer_.data()) + 16);
-                receive_buffer_.consume(16);
-
-                uint32_t payload_length = (static_cast<uint32_t>(header[4]) << 24) |
-                                          (static_cast<uint32_t>(header[5]) << 16) |
-                                          (static_cast<uint32_t>(header[6]) << 8) |
-                                          static_cast<uint32_t>(header[7]);
-
-                boost::asio::async_read(socket_, receive_buffer_, boost::asio::transfer_exactly(payload_length),
-                    [this, self, header](boost::system::error_code ec, std::size_t length) {
-                        if (!ec) {
-                            std::vector<uint8_t> payload(boost::asio::buffers_begin(receive_buffer_.data()),
-                                                         boost::asio::buffers_begin(receive_buffer_.data()) + length);
-                            receive_buffer_.consume(length);
-
-                            std::vector<uint8_t> packet_data = header;
-                            packet_data.insert(packet_data.end(), payload.begin(), payload.end());
-
-                            try {
-                                Packet packet = deserializePacket(packet_data);
-                                Message msg = Message::deserialize({packet});
-                                if (message_handler_) {
-                                    message_handler_(msg);
-                                }
-                            } catch (const std::exception& e) {
-                                Debug::log("Error parsing message: " + std::string(e.what()));
-                            }
-
-                            receiveMessage();  // Continue receiving messages
-                        } else {
-                            Debug::log("Error receiving message payload: " + ec.message());
-                        }
-                    });
-            } else {
-                Debug::log("Error receiving message header: " + ec.message());
+    boost::asio::async_read(socket_, boost::asio::buffer(header_buffer_),
+        makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    Debug::log("Error receiving message header: " + ec.message());
+                    close();
+                    return;
+                }
+                last_received_ = Clock::now();
+                // A bad header means the stream is out of sync or the peer
+                // is not speaking our protocol; nothing after it can be trusted.
+                if (!isValidHeader(header_buffer_.data())) {
+                    ++ingress_stats_.bad_headers;
+                    Debug::log("Invalid packet header from " + getAddress());
+                    close();
+                    return;
+                }
+                if (admitFrame()) {
+                    receivePayload(readUint32(header_buffer_.data(), 4));
+                }
+            }));
+}
+
+void PeerConnection::resumeReceive() {
+    if (!closed_ && admitFrame()) {
+        receivePayload(readUint32(header_buffer_.data(), 4));
+    }
+}
+
+void PeerConnection::receivePayload(uint32_t payload_length) {
+    // resize() keeps the capacity of earlier frames, so steady-state reads
+    // reuse the same payload storage.
+    payload_buffer_.resize(payload_length);
+    boost::asio::async_read(socket_, boost::asio::buffer(payload_buffer_),
+        makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    Debug::log("Error receiving message payload: " + ec.message());
+                    close();
+                    return;
+                }
+                handlePayload();
+                receiveMessage();  // Continue receiving messages
+            }));
+}
+#endif
+
+// Acks only release our own state, and later fragments of a frame ride on
+// the token paid for its first one, so neither is charged
+bool PeerConnection::chargesIngress() const {
+    PacketType type = static_cast<PacketType>(header_buffer_[16]);
+    bool fragment = header_buffer_[17] & PACKET_FLAG_FRAGMENT;
+    bool continuation = fragment && (reassembler_.active() || discarding_fragments_);
+    return type != PacketType::Ack && !continuation;
+}
+
+// Called with a frame's header read and its payload not yet taken. A peer
+// over its rate is not dropped from, since the reliability layer has
+// promised its frames will arrive; reading stops instead until its bucket
+// refills, so the frames wait in the socket buffers and TCP's flow control
+// slows the peer down.
+bool PeerConnection::admitFrame() {
+    if (!chargesIngress() || ingress_bucket_.consume(Clock::now())) {
+        return true;
+    }
+    ++ingress_stats_.rate_limited;
+    throttle_timer_.arm(ingress_bucket_.timeUntil(Clock::now()));
+    return false;
+}
+
+// Inbound frames pass through stages in order of cost: the peer's token
+// bucket was charged and the header checked before the payload was read,
+// then a Data frame's id is peeked and checked against the seen filter,
+// and only then is the CRC computed and the frame parsed. On a sealed
+// connection the AEAD tag takes the place of the CRC and is checked before
+// the id, since acknowledging an unauthenticated sequence number would let
+// a forged frame shadow the real one.
+void PeerConnection::handlePayload() {
+    PacketType type = static_cast<PacketType>(header_buffer_[16]);
+    uint8_t flags = header_buffer_[17];
+    bool sealed = flags & PACKET_FLAG_SEALED;
+    bool fragment = flags & PACKET_FLAG_FRAGMENT;
+    bool last = flags & PACKET_FLAG_LAST_FRAGMENT;
+    // Later fragments of a frame ride on the checks made for its first one,
+    // and a frame dropped at its first fragment takes the rest with it
+    bool continuation = fragment && (reassembler_.active() || discarding_fragments_);
+    if (continuation && discarding_fragments_) {
+        if (session_ && session_->established()) {
+            session_->discardIncoming();
+        }
+        discarding_fragments_ = !last;
+        return;
+    }
+    bool more = fragment && !last;
+
+    // A loaded server may set a puzzle before it answers anything else
+    if (type == PacketType::Admission && !sealed) {
+        handleAdmission();
+        return;
+    }
+    admission_open_ = false;
+
+    if (session_) {
+        if (!session_->established()) {
+            handleHandshake();
+            return;
+        }
+        if (!sealed) {
+            Debug::log("Unsealed frame on a secure connection to " + getAddress());
+            close();
+            return;
+        }
+        Packet packet;
+        try {
+            packet = session_->open(header_buffer_.data(), payload_buffer_);
+        } catch (const std::exception& e) {
+            ++ingress_stats_.corrupt;
+            Debug::log("Closing " + getAddress() + ": " + e.what());
+            close();
+            return;
+        }
+        if (!continuation && dropIfSeen(packet.type, packet.sequence, packet.payload)) {
+            discarding_fragments_ = more;
+            return;
+        }
+        acceptPiece(std::move(packet));
+        return;
+    }
+
+    if (!continuation && dropIfSeen(type, readUint32(header_buffer_.data(), 8), payload_buffer_)) {
+        discarding_fragments_ = more;
+        return;
+    }
+
+    try {
+        acceptPiece(deserializePacket(header_buffer_.data(), payload_buffer_));
+    } catch (const std::exception& e) {
+        ++ingress_stats_.corrupt;
+        Debug::log("Error parsing message: " + std::string(e.what()));
+    }
+}
+
+// Whole frames go straight on; fragments are held until the last one
+// arrives. Sealed fragments were authenticated one by one, so only an
+// unsealed frame's CRC is checked once it is joined.
+void PeerConnection::acceptPiece(Packet packet) {
+    if (packet.flags & PACKET_FLAG_FRAGMENT) {
+        last_fragment_ = Clock::now();
+        if (!reassembly_timer_.armed()) {
+            reassembly_timer_.arm(REASSEMBLY_TIMEOUT);
+        }
+        try {
+            if (!reassembler_.add(packet, !session_)) {
+                return;
+            }
+        } catch (const std::exception& e) {
+            ++ingress_stats_.corrupt;
+            discarding_fragments_ = !(packet.flags & PACKET_FLAG_LAST_FRAGMENT);
+            Debug::log("Error reassembling frame: " + std::string(e.what()));
+            return;
+        }
+    }
+    processPacket(std::move(packet));
+}
+
+// Until the handshake completes the only frame a secure connection accepts
+// is the remote Handshake; anything else, or a bad signature, closes it.
+void PeerConnection::handleHandshake() {
+    try {
+        if (static_cast<PacketType>(header_buffer_[16]) != PacketType::Handshake) {
+            throw std::runtime_error("expected a handshake");
+        }
+        session_->accept(deserializePacket(header_buffer_.data(), payload_buffer_));
+    } catch (const std::exception& e) {
+        Debug::log("Handshake with " + getAddress() + " failed: " + e.what());
+        close();
+        return;
+    }
+    handshake_timer_.cancel();
+    Debug::log("Secure session established with " + getAddress());
+    while (!awaiting_handshake_.empty()) {
+        auto pending = std::move(awaiting_handshake_.front());
+        awaiting_handshake_.pop_front();
+        backlog_bytes_ -= pending.first->payload.size();
+        queueFrame(std::move(pending.first), pending.second);
+    }
+    offerDatagrams();
+}
+
+// A server sets at most one puzzle, before it sends anything else, so a
+// challenge later on or a second one closes the connection. The puzzle is
+// solved on the shared AdmissionSolver so other connections on the
+// io_context keep moving; the work guard keeps the io_context running until
+// the solution is posted back. The handshake deadline starts over once the
+// solution is queued.
+void PeerConnection::handleAdmission() {
+    AdmissionChallenge challenge;
+    try {
+        if (!admission_open_) {
+            throw std::runtime_error("only one challenge is accepted, ahead of anything else");
+        }
+        admission_open_ = false;
+        challenge = AdmissionChallenge::fromPacket(deserializePacket(header_buffer_.data(), payload_buffer_));
+        if (challenge.difficulty > MAX_ADMISSION_DIFFICULTY) {
+            throw std::runtime_error("difficulty " + std::to_string(challenge.difficulty) + " is too high");
+        }
+    } catch (const std::exception& e) {
+        Debug::log("Refusing admission challenge from " + getAddress() + ": " + e.what());
+        close();
+        return;
+    }
+    Debug::log("Solving admission challenge of " + std::to_string(challenge.difficulty) + " bits from " + getAddress());
+    auto work = boost::asio::make_work_guard(socket_.get_executor());
+    bool queued = AdmissionSolver::shared().submit(challenge,
+        [this, self = shared_from_this(), work](Packet solution) mutable {
+            boost::asio::post(work.get_executor(), [this, self, solution = std::move(solution)]() mutable {
+                if (!connected_) {
+                    return;
+                }
+                if (handshake_timer_.armed()) {
+                    handshake_timer_.arm(HANDSHAKE_TIMEOUT);
+                }
+                scheduler_.push(makeFrame(std::move(solution)), 0, true);
+                writeNext();
+            });
+            work.reset();
+        });
+    if (!queued) {
+        Debug::log("Too many admission puzzles being solved, closing " + getAddress());
+        close();
+    }
+}
+
+// Duplicates are still acknowledged so the sender stops resending them
+bool PeerConnection::dropIfSeen(PacketType type, uint32_t sequence, const std::vector<uint8_t>& payload) {
+    MessageId id;
+    if (type != PacketType::Data || !seen_filter_ || !Message::peekId(payload, id) || !seen_filter_(id)) {
+        return false;
+    }
+    ++ingress_stats_.duplicates;
+    if (sequence != 0) {
+        ack_tracker_.record(sequence);
+        scheduleAck();
+    }
+    return true;
+}
+
+void PeerConnection::processPacket(Packet packet) {
+    try {
+        if (packet.type == PacketType::Ack) {
+            send_window_.acknowledge(packet);
+            while (!window_backlog_.empty() && !send_window_.full()) {
+                FramePtr frame = std::move(window_backlog_.front());
+                window_backlog_.pop_front();
+                backlog_bytes_ -= frame->payload.size();
+                sendSequenced(std::move(frame));
+            }
+            return;
+        }
+
+        if (packet.type == PacketType::Datagram) {
+            handleDatagramOffer(packet);
+            return;
+        }
+
+        if (packet.type == PacketType::Keepalive) {
+            if (!packet.payload.empty() && packet.payload[0] == KEEPALIVE_PING) {
+                sendControl(createPacket(PacketType::Keepalive, {KEEPALIVE_PONG}, 0));
+            }
+            return;
+        }
+
+        if (packet.sequence != 0) {
+            AckTracker::Result result = ack_tracker_.record(packet.sequence);
+            if (result == AckTracker::Result::Full) {
+                Debug::log("Too many gaps from " + getAddress() + ", leaving frame " +
+                           std::to_string(packet.sequence) + " for a retransmit");
+                return;
+            }
+            scheduleAck();
+            if (result == AckTracker::Result::Duplicate) {
+                Debug::log("Dropping retransmitted frame " + std::to_string(packet.sequence));
+                return;
+            }
+        }
+
+        if (packet.type != PacketType::Data) {
+            ++ingress_stats_.accepted;
+            if (control_handler_) {
+                control_handler_(shared_from_this(), packet);
+            }
+            return;
+        }
+
+        // The received bytes become the message's encoded form, so relaying
+        // it unchanged sends exactly these bytes on every outgoing link.
+        // Sealed frames arrive without a CRC, which unsealed links need.
+        uint64_t received_us = traceClockNow();
+        if (session_) {
+            packet.checksum = calculateCRC32(packet.payload);
+        }
+        Message msg = Message::decode(makeFrame(std::move(packet)));
+        if (msg.getTrace()) {
+            msg.setReceivedAt(received_us);
+        }
+        ++ingress_stats_.accepted;
+        if (message_handler_) {
+            message_handler_(shared_from_this(), msg);
+        }
+    } catch (const std::exception& e) {
+        ++ingress_stats_.corrupt;
+        Debug::log("Error parsing message: " + std::string(e.what()));
+    }
+}
+
+// Opens our socket on the address the stream uses and tells the peer its
+// port. The channel holds only weak references back, so it cannot keep a
+// closed connection alive.
+void PeerConnection::offerDatagrams() {
+    if (!datagrams_enabled_ || datagrams_) {
+        return;
+    }
+    std::weak_ptr<PeerConnection> weak = std::static_pointer_cast<PeerConnection>(shared_from_this());
+    auto& io_context = static_cast<boost::asio::io_context&>(socket_.get_executor().context());
+    datagrams_ = std::make_shared<DatagramChannel>(io_context,
+        [weak](const Packet& packet) {
+            auto self = weak.lock();
+            return self && self->acceptDatagram(packet);
+        },
+        [weak](FramePtr frame) {
+            if (auto self = weak.lock()) {
+                self->sendOnStream(std::move(frame));
             }
         });
+    try {
+        if (session_) {
+            datagrams_->setSession(session_.get());
+        }
+        uint16_t port = datagrams_->open(socket_.local_endpoint().address());
+        std::vector<uint8_t> payload;
+        appendUint16(payload, port);
+        queueFrame(makeFrame(PacketType::Datagram, std::move(payload)), 0);
+    } catch (const std::exception& e) {
+        Debug::log("No datagrams with " + getAddress() + ": " + e.what());
+        datagrams_->close();
+        datagrams_.reset();
+    }
+}
+
+// The peer's port, sent when it opened its socket. A side that has not
+// opened one yet does so now and answers with its own; a side that does not
+// take datagrams ignores the frame, and both keep to the stream.
+void PeerConnection::handleDatagramOffer(const Packet& packet) {
+    if (packet.payload.size() != 2) {
+        throw std::runtime_error("malformed datagram offer");
+    }
+    offerDatagrams();
+    if (!datagrams_) {
+        return;
+    }
+    uint16_t port = readUint16(packet.payload.data(), 0);
+    datagrams_->connect(boost::asio::ip::udp::endpoint(remote_endpoint_.address(), port));
+    Debug::log("Datagrams to " + getAddress() + " on port " + std::to_string(port));
+}
+
+// Datagrams pass the checks frames off the stream do. Their sequences are
+// the channel's own, which acknowledges whatever is not refused here.
+bool PeerConnection::acceptDatagram(const Packet& packet) {
+    if (!connected_) {
+        return false;
+    }
+    last_received_ = Clock::now();
+    if (dropIfSeen(packet.type, 0, packet.payload)) {
+        return true;
+    }
+    if (!ingress_bucket_.consume(last_received_)) {
+        ++ingress_stats_.rate_limited;
+        return false;
+    }
+    Packet frame = packet;
+    frame.sequence = 0;
+    processPacket(std::move(frame));
+    return true;
 }
 
-void PeerConnection::setMessageHandler(std::function<void(const Message&)> handler) {
-    message_handler_ = handler;
+// Acks are held back for ACK_DELAY so that one Ack packet covers every frame
+// received in that window, unless enough frames pile up to flush early.
+void PeerConnection::scheduleAck() {
+    if (ack_tracker_.pendingCount() >= ACK_EVERY_FRAMES) {
+        sendAck();
+        return;
+    }
+    if (!ack_timer_.armed()) {
+        ack_timer_.arm(ACK_DELAY);
+    }
 }
+
+void PeerConnection::sendAck() {
+    if (ack_tracker_.pendingCount() == 0) {
+        return;
+    }
+    // The cumulative sequence travels in the header's sequence field
+    Packet ack = ack_tracker_.buildAck();
+    uint32_t cumulative = ack.sequence;
+    queueFrame(makeFrame(std::move(ack)), cumulative);
+}
+
+void PeerConnection::armRetransmitTimer() {
+    if (retransmit_timer_.armed() || !connected_ || send_window_.empty()) {
+        return;
+    }
+    retransmit_timer_.arm(RETRANSMIT_TICK);
+}
+
+void PeerConnection::retransmitExpired() {
+    if (!connected_) {
+        return;
+    }
+    // Only frames written in full expire, so none of these is still queued
+    for (auto& retransmit : send_window_.collectExpired(Clock::now())) {
+        Debug::log("Retransmitting frame " + std::to_string(retransmit.first));
+        queueFrame(std::move(retransmit.second), retransmit.first);
+    }
+    armRetransmitTimer();
+}
+
+// The idle and keepalive timers are not re-armed per frame; when one fires
+// it measures the silence since last_received_ and sleeps for the rest.
+void PeerConnection::checkIdle() {
+    auto silent = Clock::now() - last_received_;
+    if (silent >= IDLE_TIMEOUT) {
+        Debug::log("Closing idle connection to " + getAddress());
+        close();
+        return;
+    }
+    idle_timer_.arm(IDLE_TIMEOUT - silent);
+}
+
+void PeerConnection::checkKeepalive() {
+    auto silent = Clock::now() - last_received_;
+    if (silent >= KEEPALIVE_INTERVAL) {
+        sendControl(createPacket(PacketType::Keepalive, {KEEPALIVE_PING}, 0));
+        keepalive_timer_.arm(KEEPALIVE_INTERVAL);
+        return;
+    }
+    keepalive_timer_.arm(KEEPALIVE_INTERVAL - silent);
+}
+
+// A sender that stops partway through a fragmented frame would pin up to
+// MAX_PAYLOAD_SIZE of reassembly buffer, and the stream cannot skip the rest
+void PeerConnection::checkReassembly() {
+    if (!reassembler_.active()) {
+        return;
+    }
+    auto stalled = Clock::now() - last_fragment_;
+    if (stalled >= REASSEMBLY_TIMEOUT) {
+        Debug::log("Reassembly from " + getAddress() + " stalled, closing");
+        close();
+        return;
+    }
+    reassembly_timer_.arm(REASSEMBLY_TIMEOUT - stalled);
+}
+
+void PeerConnection::close() {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    connected_ = false;
+    ack_timer_.cancel();
+    retransmit_timer_.cancel();
+    idle_timer_.cancel();
+    keepalive_timer_.cancel();
+    handshake_timer_.cancel();
+    reassembly_timer_.cancel();
+    if (datagrams_) {
+        datagrams_->close();
+    }
+#ifdef TELELIBRE_IO_URING
+    if (receiving_) {
+        receiving_ = false;
+        UringReactor::of(static_cast<boost::asio::io_context&>(socket_.get_executor().context()))
+            .stopReceive(receive_token_);
+    }
+#endif
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    if (close_handler_) {
+        close_handler_(shared_from_this());
+    }
+}
+
 // Update the constructor to initialize peer_update_timer_
 Network::Network(boost::asio::io_context& io_context, size_t estimated_network_size)
     : io_context_(io_context), 
-      bloom_filter_(estimated_network_size * 10, 5),
+      routing_table_(&routing_memory_),
+      bloom_filter_(bloomBitsFor(estimated_network_size), 5, &seen_memory_),
       estimated_network_size_(estimated_network_size),
-      peer_update_timer_(io_context) {}
+      peer_update_timer_(io_context),
+      rng_(std::random_device{}()),
+      peer_factory_([this](const std::string& server, const std::string& port) {
+          auto connection = std::make_shared<PeerConnection>(io_context_, server, port);
+          if (identity_) {
+              connection->setIdentity(identity_);
+          }
+          if (datagrams_) {
+              connection->enableDatagrams();
+          }
+          return connection;
+      }),
+      wall_clock_([]() { return std::time(nullptr); }),
+      steady_clock_([]() { return Swarm::Clock::now(); }),
+      trace_clock_(traceClockNow),
+      swarm_timer_(io_context),
+      bootstrap_timer_(io_context),
+      memory_timer_(io_context),
+      advertised_(AdvertMap::allocator_type(&routing_memory_)) {
+    node_id_ = std::uniform_int_distribution<uint64_t>()(rng_);
+    size_estimator_.setNodeId(node_id_);
+}
+
+void Network::setPeerFactory(PeerFactory factory) {
+    peer_factory_ = std::move(factory);
+}
+
+void Network::setMessageVerifier(MessageVerifier verifier) {
+    message_verifier_ = std::move(verifier);
+}
+
+void Network::setDeliveryHandler(DeliveryHandler handler) {
+    delivery_handler_ = std::move(handler);
+}
+
+void Network::setDeliveryWorkers(size_t threads, size_t capacity) {
+    delivery_pool_ = std::make_unique<WorkerPool>(threads, capacity, delivery_handler_);
+    delivery_pool_->setByteBudget(memory_budgets_.worker_queue);
+}
+
+WorkerPool::Stats Network::deliveryStats() const {
+    return delivery_pool_ ? delivery_pool_->stats() : WorkerPool::Stats();
+}
+
+void Network::setVerificationWorkers(size_t threads, size_t capacity) {
+    verify_pool_ = std::make_unique<WorkerPool>(threads, capacity, [this](const Message& msg) {
+        bool valid = message_verifier_(msg);
+        boost::asio::post(io_context_, [this, id = msg.getMessageId(), valid]() { verified(id, valid); });
+    });
+    verify_pool_->setByteBudget(memory_budgets_.worker_queue);
+}
+
+// The io thread never waits on the application. A full queue is reported
+// once when it fills and once when it drains, not per dropped message.
+void Network::deliver(Message msg) {
+    if (!delivery_pool_) {
+        delivery_handler_(msg);
+        return;
+    }
+    bool accepted = delivery_pool_->submit(std::move(msg));
+    if (accepted == delivery_backlogged_) {
+        delivery_backlogged_ = !accepted;
+        Debug::log(accepted ? "Delivery queue draining, " + std::to_string(delivery_pool_->stats().dropped) +
+                                  " messages dropped so far"
+                            : "Delivery queue full, dropping messages until the workers catch up");
+    }
+}
+
+void Network::setListenPort(uint16_t port) {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    listen_port_ = port;
+}
 
+void Network::setIdentity(std::shared_ptr<const NodeIdentity> identity) {
+    identity_ = std::move(identity);
+}
+
+void Network::setDatagrams(bool enabled) {
+    datagrams_ = enabled;
+}
+
+void Network::seedRandom(uint32_t seed) {
+    rng_.seed(seed);
+    node_id_ = std::uniform_int_distribution<uint64_t>()(rng_);
+    size_estimator_.setNodeId(node_id_);
+    swarm_.seed(seed);
+}
+
+void Network::setWallClock(WallClock clock) {
+    wall_clock_ = std::move(clock);
+}
 
+void Network::setSteadyClock(SteadyClock clock) {
+    steady_clock_ = std::move(clock);
+}
+
+void Network::setTraceClock(TraceClock clock) {
+    trace_clock_ = std::move(clock);
+}
+
+void Network::setTracing(double sample_rate, std::shared_ptr<TraceCollector> collector) {
+    trace_sample_rate_ = sample_rate;
+    trace_collector_ = std::move(collector);
+}
+
+void Network::openPeerCache(const std::string& path) {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    peer_cache_ = std::make_unique<PeerCache>(path);
+    Debug::log("Peer cache " + path + " holds " + std::to_string(peer_cache_->size()) + " peers");
+}
+
+size_t Network::estimatedNetworkSize() const {
+    return estimated_network_size_;
+}
+
+// Peers cached by the last run are all dialled at once, and each is asked
+// for peers the moment it is up. The seeds are only contacted when nothing
+// is cached, or when fewer than MIN_WARM_PEERS of the cached peers have
+// connected after SEED_FALLBACK_DELAY.
 void Network::bootstrapNetwork(const std::vector<std::string>& seedNodes) {
+    std::unique_lock<std::mutex> lock(peers_mutex_);
+    size_t dialled = 0;
+    if (peer_cache_) {
+        for (const auto& entry : peer_cache_->best(CACHED_DIALS, wall_clock_())) {
+            std::string server = entry.address.address.to_string();
+            std::string port = std::to_string(entry.address.port);
+            if (std::find(seedNodes.begin(), seedNodes.end(), server + ":" + port) != seedNodes.end()) {
+                continue;
+            }
+            if (addPeerIfNew(server, port)) {
+                outbox_.emplace_back(peers_.back(), makePeerRequest());
+                ++dialled;
+            }
+        }
+    }
+    if (dialled == 0) {
+        dialSeeds(seedNodes);
+        lock.unlock();
+        sendQueued();
+        return;
+    }
+    Debug::log("Dialled " + std::to_string(dialled) + " cached peers");
+    lock.unlock();
+    sendQueued();
+
+    bootstrap_timer_.expires_after(SEED_FALLBACK_DELAY);
+    bootstrap_timer_.async_wait(makeCustomAllocHandler(handler_memory_,
+        [this, seedNodes](const boost::system::error_code& ec) {
+            if (ec) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(peers_mutex_);
+                size_t connected = std::count_if(peers_.begin(), peers_.end(),
+                                                 [](const std::shared_ptr<Peer>& peer) { return peer->isConnected(); });
+                if (connected < MIN_WARM_PEERS) {
+                    Debug::log("Only " + std::to_string(connected) + " peers connected, contacting seeds");
+                    dialSeeds(seedNodes);
+                }
+            }
+            sendQueued();
+        }));
+}
+
+// Caller holds peers_mutex_ and calls sendQueued once it is released
+void Network::dialSeeds(const std::vector<std::string>& seedNodes) {
     for (const auto& node : seedNodes) {
         std::string server = node.substr(0, node.find(":"));
         std::string port = node.substr(node.find(":") + 1);
-
-        auto peer = std::make_shared<PeerConnection>(io_context_, server, port);
-        peers_.push_back(peer);
-        peer->start();
-
-        peer->setMessageHandler([this](const Message& message) {
-            handleIncomingMessage(message);
-        });
+        if (addPeerIfNew(server, port)) {
+            outbox_.emplace_back(peers_.back(), makePeerRequest());
+        }
     }
-
-    // Wait for a short time to allow connections to be established
-    boost::asio::steady_timer timer(io_context_, boost::asio::chrono::seconds(1));
-    timer.async_wait([this](const boost::system::error_code&) {
-        Message requestPeersMsg("", "", "RequestPeers");
-        broadcastMessage(requestPeersMsg);
-    });
 }
 
 void Network::sendMessage(const Message& msg) {
     if (bloom_filter_.probably_contains(msg.getMessageId())) {
-        std::cout << "Message already seen, not forwarding: " << msg.getMessageId() << std::endl;
+        std::cout << "Message already seen, not forwarding: " << msg.getMessageId().toHex() << std::endl;
         return;
     }
 
     bloom_filter_.add(msg.getMessageId());
-    forwardMessage(msg);
+    // A meme's body is not pushed: neighbours that get its preview fetch the
+    // chunks from every node announcing them, this one first
+    if (msg.getKind() == MessageKind::Preview) {
+        memes_.addPreview(msg, false);
+        swarm_.add(msg.getMessageId(), msg.getChunkIds().size(), false);
+        stopAbandonedMemes();
+    } else if (msg.getKind() == MessageKind::Chunk && memes_.check(msg) == MemeAssembler::Check::Valid) {
+        Message complete;
+        memes_.addChunk(msg, complete);
+        swarm_.received(msg.getParentId(), msg.getChunkIndex(), nullptr, steady_clock_());
+        announcePieces(msg.getParentId());
+        return;
+    }
+    if (trace_sample_rate_ > 0 && std::uniform_real_distribution<>(0, 1)(rng_) < trace_sample_rate_) {
+        uint64_t now = trace_clock_();
+        Message sampled = msg;
+        sampled.setTrace(MessageTrace{std::uniform_int_distribution<uint64_t>()(rng_), {}});
+        forwardMessage(addTraceHop(sampled, now, now), nullptr);
+        return;
+    }
+    forwardMessage(msg, nullptr);
 }
 
 void Network::broadcastMessage(const Message& msg) {
-    for (const auto& peer : peers_) {
+    for (const auto& peer : peersSnapshot()) {
         if (shouldForwardMessage()) {
             peer->sendMessage(msg);
         }
     }
 }
 
-void Network::addPeer(std::shared_ptr<PeerConnection> peer) {
-    peers_.push_back(peer);
-    peer->setMessageHandler([this](const Message& message) {
-        handleIncomingMessage(message);
-    });
+// Sending can close a connection, whose close handler takes peers_mutex_
+// and changes peers_, so peers are never sent to while it is held or while
+// iterating peers_ itself
+std::vector<std::shared_ptr<Peer>> Network::peersSnapshot() {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    return peers_;
 }
-void Network::sendPeerList() {
-    std::string peerList;
-    for (const auto& peer : peers_) {
-        peerList += peer->getAddress() + ",";
+
+void Network::sendQueued() {
+    std::vector<std::pair<std::shared_ptr<Peer>, Packet>> queued;
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        queued.swap(outbox_);
     }
-    if (!peerList.empty()) {
-        peerList.pop_back(); // Remove trailing comma
+    for (auto& entry : queued) {
+        entry.first->sendControl(std::move(entry.second));
     }
-    Message response("", "", "PeerList: " + peerList);
-    sendMessage(response);
-    std::cout << "Sent peer list in response to RequestPeers" << std::endl;
 }
+
+void Network::addPeer(std::shared_ptr<Peer> peer) {
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        peers_.push_back(peer);
+        attachPeer(peer);
+    }
+    sendQueued();
+}
+
+void Network::attachPeer(const std::shared_ptr<Peer>& peer) {
+    peer->setSeenFilter([this](const MessageId& id) {
+        return bloom_filter_.probably_contains(id);
+    });
+    peer->setMessageHandler([this](const std::shared_ptr<Peer>& from, const Message& message) {
+        handleIncomingMessage(from, message);
+    });
+    peer->setControlHandler([this](const std::shared_ptr<Peer>& from, const Packet& packet) {
+        handleControlPacket(from, packet);
+    });
+    peer->setCloseHandler([this](const std::shared_ptr<Peer>& closed) {
+        handlePeerClosed(closed);
+    });
+    peer->setMemoryBudget(memory_budgets_.per_connection);
+    advertiseInterests();
+}
+
+// Caller holds peers_mutex_
 bool Network::addPeerIfNew(const std::string& server, const std::string& port) {
     for (const auto& peer : peers_) {
         if (peer->getAddress() == server + ":" + port) {
             return false;  // Peer already exists
         }
     }
-    auto newPeer = std::make_shared<PeerConnection>(io_context_, server, port);
+    auto newPeer = peer_factory_(server, port);
+    if (!newPeer) {
+        return false;
+    }
+    try {
+        newPeer->start();  // Start the connection for the new peer
+    } catch (const std::exception& e) {
+        Debug::log("Failed to start connection to " + server + ":" + port + ": " + e.what());
+        return false;
+    }
     peers_.push_back(newPeer);
-    newPeer->start();  // Start the connection for the new peer
+    attachPeer(newPeer);
     return true;  // Peer was added
 }
 
+void Network::requestPeers() {
+    Packet request;
+    std::vector<std::shared_ptr<Peer>> peers;
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        request = makePeerRequest();
+        peers = peers_;
+    }
+    for (const auto& peer : peers) {
+        peer->sendControl(request);
+    }
+}
 
-void Network::updatePeerList(const std::string& peerListStr) {
-    std::istringstream iss(peerListStr);
-    std::string peerAddress;
-    std::vector<std::shared_ptr<PeerConnection>> new_peers;
+// Caller holds peers_mutex_. The request carries our size sketch so both
+// sides of an exchange merge.
+Packet Network::makePeerRequest() {
+    PeerRequest request;
+    size_estimator_.advance(currentEpoch());
+    request.size_sketch = size_estimator_.snapshot();
+    request.listen_port = listen_port_;
+    return request.toPacket();
+}
 
-    std::lock_guard<std::mutex> lock(peers_mutex_);
+void Network::handleControlPacket(const std::shared_ptr<Peer>& peer, const Packet& packet) {
+    if (peer_cache_) {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        auto endpoint = peer->remoteEndpoint();
+        peer_cache_->recordSeen({endpoint.address(), endpoint.port()}, wall_clock_(), peer->remoteIdentity());
+    }
+    switch (packet.type) {
+    case PacketType::PeerRequest: {
+        PeerRequest request = PeerRequest::fromPacket(packet);
+        if (request.size_sketch) {
+            std::lock_guard<std::mutex> lock(peers_mutex_);
+            mergeSizeSketch(peer, *request.size_sketch);
+        }
+        sendPeerExchange(peer);
+        break;
+    }
+    case PacketType::PeerExchange:
+        applyPeerExchange(peer, PeerExchange::fromPacket(packet));
+        break;
+    case PacketType::Interest: {
+        InterestAdvert advert = InterestAdvert::fromPacket(packet);
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex_);
+            if (routing_table_.updatePeerInterests(peer, advert)) {
+                advertiseInterests();
+            }
+        }
+        sendQueued();
+        break;
+    }
+    case PacketType::Have:
+        swarm_.setHolder(peer, PieceHave::fromPacket(packet));
+        requestPieces();
+        break;
+    case PacketType::PieceRequest:
+        servePiece(peer, PieceRequest::fromPacket(packet));
+        break;
+    default:
+        Debug::log("Ignoring control packet of type " + std::to_string(static_cast<int>(packet.type)));
+        break;
+    }
+}
 
-    while (std::getline(iss, peerAddress, ',')) {
-        std::string server = peerAddress.substr(0, peerAddress.find(":"));
-        std::string port = peerAddress.substr(peerAddress.find(":") + 1);
+// Answers only the requester, with a bounded random sample of the peers
+// that connected since its last exchange and the ones that went away, so
+// repeated exchanges cost O(churn) rather than O(peers).
+void Network::sendPeerExchange(const std::shared_ptr<Peer>& requester) {
+    auto now = steady_clock_();
+    auto since = requester->lastPeerExchange();
+    PeerExchange exchange;
 
-        // Check if the peer already exists
-        auto it = std::find_if(peers_.begin(), peers_.end(),
-            [&](const std::shared_ptr<PeerConnection>& peer) {
-                return peer->getAddress() == peerAddress;
-            });
-
-        if (it == peers_.end()) {
-            auto newPeer = std::make_shared<PeerConnection>(io_context_, server, port);
-            new_peers.push_back(newPeer);
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        for (const auto& peer : peers_) {
+            if (peer != requester && peer->isConnected() && peer->connectedAt() > since) {
+                auto endpoint = peer->remoteEndpoint();
+                exchange.added.push_back({endpoint.address(), endpoint.port()});
+            }
+        }
+        for (const auto& entry : removed_peers_) {
+            if (entry.first > since) {
+                exchange.removed.push_back(entry.second);
+            }
         }
+        size_estimator_.advance(currentEpoch());
+        exchange.size_sketch = size_estimator_.snapshot();
     }
 
-    // Add new peers
-    for (const auto& peer : new_peers) {
-        peers_.push_back(peer);
-        peer->start();
-        peer->setMessageHandler([this](const Message& message) {
-            handleIncomingMessage(message);
-        });
+    std::shuffle(exchange.added.begin(), exchange.added.end(), rng_);
+    if (exchange.added.size() > PeerExchange::MAX_ENTRIES) {
+        exchange.added.resize(PeerExchange::MAX_ENTRIES);
     }
 
-    if (!new_peers.empty()) {
-        std::cout << "Added " << new_peers.size() << " new peers." << std::endl;
+    requester->setLastPeerExchange(now);
+    requester->sendControl(exchange.toPacket());
+    Debug::log("Sent peer exchange to " + requester->getAddress() + " with " +
+               std::to_string(exchange.added.size()) + " added, " +
+               std::to_string(exchange.removed.size()) + " removed");
+}
+
+void Network::applyPeerExchange(const std::shared_ptr<Peer>& from, const PeerExchange& exchange) {
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+
+        if (exchange.size_sketch) {
+            mergeSizeSketch(from, *exchange.size_sketch);
+        }
+
+        for (const auto& gone : exchange.removed) {
+            candidates_.erase(std::remove(candidates_.begin(), candidates_.end(), gone), candidates_.end());
+        }
+
+        size_t added = 0;
+        for (const auto& peer : exchange.added) {
+            if (peers_.size() < MAX_PEERS) {
+                if (addPeerIfNew(peer.address.to_string(), std::to_string(peer.port))) {
+                    ++added;
+                }
+            } else if (candidates_.size() < MAX_CANDIDATES &&
+                       std::find(candidates_.begin(), candidates_.end(), peer) == candidates_.end()) {
+                candidates_.push_back(peer);
+            }
+        }
+
+        if (added > 0) {
+            std::cout << "Added " << added << " new peers." << std::endl;
+        }
+    }
+    sendQueued();
+}
+
+void Network::handlePeerClosed(const std::shared_ptr<Peer>& peer) {
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        peers_.erase(std::remove(peers_.begin(), peers_.end(), peer), peers_.end());
+        advertised_.erase(peer);
+        neighbour_sizes_.erase(peer);
+        served_.erase(peer);
+        swarm_.removePeer(peer);
+        if (routing_table_.removePeer(peer)) {
+            advertiseInterests();
+        }
+
+        if (peer->connectedAt() != Peer::Clock::time_point()) {
+            auto endpoint = peer->remoteEndpoint();
+            removed_peers_.emplace_back(steady_clock_(), PeerAddress{endpoint.address(), endpoint.port()});
+            if (removed_peers_.size() > MAX_REMOVED_HISTORY) {
+                removed_peers_.pop_front();
+            }
+            if (peer_cache_) {
+                peer_cache_->recordSession(removed_peers_.back().second, wall_clock_(), true);
+            }
+        } else if (peer_cache_) {
+            // Never connected, so only the dialled address is known
+            std::string address = peer->getAddress();
+            size_t colon = address.rfind(':');
+            boost::system::error_code ec;
+            auto ip = boost::asio::ip::make_address(address.substr(0, colon), ec);
+            if (!ec && colon != std::string::npos) {
+                uint16_t port = static_cast<uint16_t>(std::stoul(address.substr(colon + 1)));
+                peer_cache_->recordSession({ip, port}, wall_clock_(), false);
+            }
+        }
+
+        // Replace the lost connection from the candidates learned earlier
+        while (!candidates_.empty() && peers_.size() < MAX_PEERS) {
+            std::uniform_int_distribution<size_t> pick(0, candidates_.size() - 1);
+            size_t index = pick(rng_);
+            PeerAddress candidate = candidates_[index];
+            candidates_.erase(candidates_.begin() + index);
+            if (addPeerIfNew(candidate.address.to_string(), std::to_string(candidate.port))) {
+                break;
+            }
+        }
     }
+    sendQueued();
 }
 
 void Network::startPeriodicPeerListUpdate() {
     peer_update_timer_.expires_from_now(boost::asio::chrono::minutes(5));
-    peer_update_timer_.async_wait([this](const boost::system::error_code& ec) {
+    peer_update_timer_.async_wait(makeCustomAllocHandler(handler_memory_, [this](const boost::system::error_code& ec) {
         if (!ec) {
-            Message requestPeersMsg("", "", "RequestPeers");
-            broadcastMessage(requestPeersMsg);
+            requestPeers();
+            if (peer_cache_) {
+                peer_cache_->flush();
+            }
             startPeriodicPeerListUpdate();
         }
-    });
+    }));
 }
 
+void Network::setMemoryBudgets(const MemoryBudgets& budgets) {
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        memory_budgets_ = budgets;
+        for (const auto& peer : peers_) {
+            peer->setMemoryBudget(budgets.per_connection);
+        }
+    }
+    for (WorkerPool* pool : {delivery_pool_.get(), verify_pool_.get()}) {
+        if (pool) {
+            pool->setByteBudget(budgets.worker_queue);
+        }
+    }
+    memory_timer_.cancel();
+    if (budgets.per_connection != 0 || budgets.connections != 0 || budgets.memes != 0) {
+        scheduleMemoryCheck();
+    }
+}
 
-void Network::handleIncomingMessage(const Message& msg) {
-    if (msg.isAcknowledgment()) {
-        Debug::log("Received acknowledgment: " + msg.getContent());
-        return;
+// Caller holds peers_mutex_
+std::vector<MemoryReport::Entry> Network::subsystemMemory() {
+    size_t peer_lists = peers_.capacity() * sizeof(peers_[0]) + candidates_.capacity() * sizeof(PeerAddress) +
+                        removed_peers_.size() * sizeof(removed_peers_[0]) +
+                        neighbour_sizes_.size() * sizeof(*neighbour_sizes_.begin());
+    size_t verification = verify_pool_ ? verify_pool_->memoryUsage() : 0;
+    for (const auto& entry : verifying_) {
+        for (const auto& copy : entry.second) {
+            verification += sizeof(copy) + copy.msg.getContent().size();
+        }
+    }
+    size_t swarm = swarm_.memoryUsage();
+    for (const auto& entry : served_) {
+        const Served& served = entry.second;
+        swarm += sizeof(entry) + served.order.size() * sizeof(served.order[0]) +
+                 served.at.size() * (sizeof(*served.at.begin()) + 2 * sizeof(void*));
+    }
+    return {
+        {seen_memory_.name(), seen_memory_.bytes()},
+        {routing_memory_.name(), routing_memory_.bytes()},
+        {"memes", memes_.bufferedBytes() + memes_.parkedBytes()},
+        {"swarm", swarm},
+        {"delivery queue", delivery_pool_ ? delivery_pool_->memoryUsage() : 0},
+        {"verification", verification},
+        {"peer lists", peer_lists},
+        {"peer cache", peer_cache_ ? peer_cache_->memoryUsage() : 0},
+    };
+}
+
+MemoryReport Network::memoryReport() {
+    MemoryReport report;
+    report.resident = residentMemory();
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    report.subsystems = subsystemMemory();
+    for (const auto& peer : peers_) {
+        report.connections.push_back({peer->getAddress(), peer->memoryUsage()});
     }
+    std::sort(report.connections.begin(), report.connections.end(),
+              [](const MemoryReport::Entry& a, const MemoryReport::Entry& b) { return a.bytes > b.bytes; });
+    return report;
+}
 
-    if (msg.getMessageId().empty()) {
-        Debug::log("Received system message: " + msg.getContent());
-        if (msg.getContent().substr(0, 9) == "PeerList:") {
-            updatePeerList(msg.getContent().substr(10));
-        } else if (msg.getContent() == "RequestPeers") {
-            sendPeerList();
+void Network::scheduleMemoryCheck() {
+    memory_timer_.expires_after(MEMORY_CHECK_INTERVAL);
+    memory_timer_.async_wait(makeCustomAllocHandler(handler_memory_, [this](const boost::system::error_code& ec) {
+        if (!ec) {
+            enforceMemoryBudgets();
+            scheduleMemoryCheck();
         }
+    }));
+}
+
+// Victims are disconnected after peers_mutex_ is released, since closing a
+// peer runs handlePeerClosed, which takes it
+void Network::enforceMemoryBudgets() {
+    std::vector<std::pair<size_t, std::shared_ptr<Peer>>> victims;
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        if (memory_budgets_.memes != 0) {
+            memes_.shrinkTo(memory_budgets_.memes);
+            stopAbandonedMemes();
+        }
+        std::vector<std::pair<size_t, std::shared_ptr<Peer>>> by_usage;
+        size_t total = 0;
+        for (const auto& peer : peers_) {
+            by_usage.emplace_back(peer->memoryUsage(), peer);
+            total += by_usage.back().first;
+        }
+        std::sort(by_usage.begin(), by_usage.end(),
+                  [](const auto& a, const auto& b) { return a.first > b.first; });
+        for (auto& entry : by_usage) {
+            bool over_own = memory_budgets_.per_connection != 0 && entry.first > memory_budgets_.per_connection;
+            bool over_total = memory_budgets_.connections != 0 && total > memory_budgets_.connections;
+            if ((!over_own && !over_total) || entry.first == 0) {
+                break;
+            }
+            total -= entry.first;
+            victims.push_back(std::move(entry));
+        }
+    }
+    for (const auto& victim : victims) {
+        std::cout << "Disconnecting " << victim.second->getAddress() << ", which holds " << victim.first
+                  << " bytes, to stay within the memory budget" << std::endl;
+        victim.second->disconnect();
+    }
+}
+
+void Network::handleIncomingMessage(const std::shared_ptr<Peer>& from, const Message& msg) {
+    uint64_t dequeued_us = msg.getTrace() ? trace_clock_() : 0;
+    if (msg.getMessageId().isNull()) {
+        Debug::log("Received message without an id, ignoring.");
+        return;
+    }
+
+    if (msg.getKind() == MessageKind::Chunk) {
+        handleChunk(from, msg);
         return;
     }
 
@@ -243,60 +1391,347 @@ void Network::handleIncomingMessage(const Message& msg) {
     }
 
     if (bloom_filter_.probably_contains(msg.getMessageId())) {
-        Debug::log("Message already seen, not processing: " + msg.getMessageId());
+        if (Debug::enabled) {
+            Debug::log("Message already seen, not processing: " + msg.getMessageId().toHex());
+        }
+        return;
+    }
+
+    // Verified after the dedup check so only the first copy pays for it, and
+    // before the id is marked seen so a forged copy cannot shadow the real
+    // one. A relay only checks what arrives over unauthenticated links;
+    // authenticated neighbours are trusted to have done so, and the origin
+    // signature is left to the nodes that deliver the message locally.
+    bool consumer = delivery_handler_ && isSubscribed(msg.getGroupId());
+    if (message_verifier_ && (consumer || !from->isAuthenticated())) {
+        if (verify_pool_) {
+            auto& copies = verifying_[msg.getMessageId()];
+            if (copies.size() < MAX_WAITING_COPIES) {
+                copies.push_back({from, msg, dequeued_us});
+                if (copies.size() == 1) {
+                    verify(msg);
+                }
+            }
+            return;
+        }
+        if (!message_verifier_(msg)) {
+            Debug::log("Dropping message with invalid signature: " + msg.getMessageId().toHex());
+            return;
+        }
+    }
+    acceptMessage(from, msg, consumer, dequeued_us);
+}
+
+// A full queue is worked off on the io thread, which slows reading rather
+// than dropping messages the sender was promised delivery of
+void Network::verify(const Message& msg) {
+    if (!verify_pool_->submit(msg)) {
+        verified(msg.getMessageId(), message_verifier_(msg));
+    }
+}
+
+// Takes id by value, as the next copy of a forged one may be checked inline,
+// popping the entry a reference could point into
+void Network::verified(MessageId id, bool valid) {
+    auto it = verifying_.find(id);
+    if (it == verifying_.end()) {
         return;
     }
+    PendingVerification checked = std::move(it->second.front());
+    it->second.pop_front();
+    // A copy from a neighbour trusted to have checked it may have won
+    if (bloom_filter_.probably_contains(id)) {
+        verifying_.erase(it);
+        return;
+    }
+    if (!valid) {
+        Debug::log("Dropping message with invalid signature: " + id.toHex());
+        if (it->second.empty()) {
+            verifying_.erase(it);
+        } else {
+            verify(it->second.front().msg);
+        }
+        return;
+    }
+    verifying_.erase(it);
+    bool consumer = delivery_handler_ && isSubscribed(checked.msg.getGroupId());
+    acceptMessage(checked.from.lock(), checked.msg, consumer, checked.dequeued_us);
+}
 
+void Network::acceptMessage(const std::shared_ptr<Peer>& from, const Message& msg, bool consumer,
+                            uint64_t dequeued_us) {
     bloom_filter_.add(msg.getMessageId());
 
+    std::vector<MemeAssembler::Parked> parked;
+    if (msg.getKind() == MessageKind::Preview) {
+        parked = memes_.addPreview(msg, consumer);
+        swarm_.add(msg.getMessageId(), msg.getChunkIds().size(), true);
+        stopAbandonedMemes();
+    }
+
     Debug::log("Processing message: " + msg.getContent());
-    forwardMessage(msg);
-    sendAcknowledgment(msg);
+    if (consumer) {
+        deliver(msg);
+    }
+    forwardMessage(msg.getTrace() ? addTraceHop(msg, msg.getReceivedAt(), dequeued_us) : msg, from);
+
+    for (const auto& entry : parked) {
+        handleChunk(entry.from.lock(), entry.chunk);
+    }
+    if (msg.getKind() == MessageKind::Preview) {
+        requestPieces();
+    }
 }
 
+// Body chunks carry no signature of their own; each is checked against the
+// chunk ids of its already verified preview and announced at once, so a
+// meme streams through relays a chunk at a time instead of waiting at each
+// hop for the whole body, and a neighbour can fetch each chunk from
+// whichever node it reached first.
+void Network::handleChunk(const std::shared_ptr<Peer>& from, const Message& chunk) {
+    if (bloom_filter_.probably_contains(chunk.getMessageId())) {
+        return;
+    }
+    switch (memes_.check(chunk)) {
+    case MemeAssembler::Check::Unknown:
+        memes_.park(from, chunk);
+        return;
+    case MemeAssembler::Check::Invalid:
+        Debug::log("Dropping chunk that does not match its preview: " + chunk.getMessageId().toHex());
+        return;
+    case MemeAssembler::Check::Valid:
+        break;
+    }
+    bloom_filter_.add(chunk.getMessageId());
+    Message complete;
+    bool whole = memes_.addChunk(chunk, complete);
+    swarm_.received(chunk.getParentId(), chunk.getChunkIndex(), from, steady_clock_());
+    announcePieces(chunk.getParentId());
+    requestPieces();
+    if (whole && delivery_handler_) {
+        deliver(std::move(complete));
+    }
+}
 
+// Chunks of a meme whose body was dropped would only be thrown away
+void Network::stopAbandonedMemes() {
+    for (const auto& id : memes_.takeAbandoned()) {
+        swarm_.stop(id);
+    }
+}
 
-void Network::sendAcknowledgment(const Message& msg) {
-    Message ack;
-    ack.setContent("Message received");
-    ack.setAsAcknowledgment(true);
+void Network::announcePieces(const MessageId& meme) {
+    PieceHave have{meme, memes_.pieces(meme)};
+    if (have.pieces.empty()) {
+        return;
+    }
+    Packet packet = have.toPacket();
+    for (const auto& peer : peersSnapshot()) {
+        peer->sendControl(packet);
+    }
+}
 
-    // Send acknowledgment to the sender
+void Network::pollPieceRequests() {
+    requestPieces();
+}
+
+// Timed-out requests are only noticed here, so while anything is being
+// fetched this runs every SWARM_TICK as well as whenever a piece or an
+// announcement arrives
+void Network::requestPieces() {
+    for (const auto& request : swarm_.pick(steady_clock_())) {
+        request.peer->sendControl(PieceRequest{request.meme, request.index}.toPacket());
+    }
+    if (swarm_timer_armed_ || !swarm_.downloading()) {
+        return;
+    }
+    swarm_timer_armed_ = true;
+    swarm_timer_.expires_after(SWARM_TICK);
+    swarm_timer_.async_wait(makeCustomAllocHandler(handler_memory_, [this](const boost::system::error_code& ec) {
+        swarm_timer_armed_ = false;
+        if (!ec) {
+            requestPieces();
+        }
+    }));
+}
+
+// A request costs its sender 20 bytes and us a chunk, so a neighbour gets
+// no more than its requests could have outstanding at once, and a piece
+// repeated no faster than an honest requester would ask for it again
+void Network::servePiece(const std::shared_ptr<Peer>& peer, const PieceRequest& request) {
+    if (peer->unackedBytes() >= MAX_SERVING_BYTES) {
+        Debug::log("Not serving " + peer->getAddress() + ", too much is unacked");
+        return;
+    }
+    Message chunk;
+    if (!memes_.piece(request.meme, request.index, chunk)) {
+        return;
+    }
+    auto now = steady_clock_();
+    Served& served = served_[peer];
+    while (!served.order.empty() && now - served.order.front().first >= SERVE_AGAIN_AFTER) {
+        auto last = served.at.find(served.order.front().second);
+        if (last != served.at.end() && last->second == served.order.front().first) {
+            served.at.erase(last);
+        }
+        served.order.pop_front();
+    }
+    if (served.at.count(chunk.getMessageId()) != 0) {
+        Debug::log("Not serving " + peer->getAddress() + " a piece it was just sent");
+        return;
+    }
+    // Recorded only once queued; a copy shed over the budget may be asked for at once
+    if (peer->sendMessage(chunk)) {
+        served.at.emplace(chunk.getMessageId(), now);
+        served.order.emplace_back(now, chunk.getMessageId());
+    }
+}
+
+
+// A message goes to the neighbours that advertise a subscriber to its group
+// within InterestAdvert::DEPTH hops behind them. Where no neighbour does, the
+// node is too far from every subscriber to choose, so it falls back to
+// probabilistic flooding until the message reaches a scented neighbourhood.
+// Targets are picked under peers_mutex_, since the application thread sends
+// too, and sent to once it is released.
+void Network::forwardMessage(const Message& msg, const std::shared_ptr<Peer>& from) {
+    std::vector<std::shared_ptr<Peer>> targets;
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        targets = routing_table_.getPeersForCategory(msg.getGroupId());
+        if (!targets.empty()) {
+            targets.erase(std::remove(targets.begin(), targets.end(), from), targets.end());
+        } else {
+            int flood_radius = calculateFloodRadius();
+            for (int i = 0; i < flood_radius && i < peers_.size(); ++i) {
+                if (shouldForwardMessage()) {
+                    targets.push_back(peers_[i]);
+                }
+            }
+        }
+    }
+    for (const auto& peer : targets) {
+        peer->sendMessage(msg);
+    }
+}
+
+// The copy forwarded carries this hop and is encoded afresh, once for all
+// neighbours; untraced messages keep the bytes they arrived in
+Message Network::addTraceHop(const Message& msg, uint64_t received_us, uint64_t dequeued_us) {
+    MessageTrace trace = *msg.getTrace();
+    if (trace.hops.size() < MessageTrace::MAX_HOPS) {
+        trace.hops.push_back({node_id_, received_us, dequeued_us, trace_clock_()});
+    }
+    if (trace_collector_) {
+        trace_collector_->record(msg.getMessageId(), trace);
+    }
+    Message stamped = msg;
+    stamped.setTrace(std::move(trace));
+    return stamped;
+}
+
+void Network::joinGroup(const std::string& group) {
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        if (groups_.insert(group).second) {
+            local_interests_.add(InterestFilter::keyFor(group));
+            advertiseInterests();
+        }
+    }
+    sendQueued();
+}
+
+void Network::leaveGroup(const std::string& group) {
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        if (groups_.erase(group) == 0) {
+            return;
+        }
+        // Bloom filters cannot delete, so rebuild from the remaining groups
+        local_interests_ = InterestFilter();
+        for (const auto& joined : groups_) {
+            local_interests_.add(InterestFilter::keyFor(joined));
+        }
+        advertiseInterests();
+    }
+    sendQueued();
+}
+
+bool Network::isSubscribed(const std::string& group) {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    return groups_.count(group) > 0;
+}
+
+// Caller holds peers_mutex_ and calls sendQueued once it is released.
+// Each neighbour gets its own split-horizon advert, and only when it
+// differs from the last one it was sent. A peer that has never been told
+// anything is not sent an empty advert.
+void Network::advertiseInterests() {
     for (const auto& peer : peers_) {
-        if (peer->getAddress() == msg.getSenderId()) {
-            peer->sendMessage(ack);
-            break;
+        InterestAdvert advert = routing_table_.advertFor(peer, local_interests_);
+        auto sent = advertised_.find(peer);
+        if (sent == advertised_.end() ? advert.empty() : sent->second == advert) {
+            continue;
         }
+        advertised_[peer] = advert;
+        outbox_.emplace_back(peer, advert.toPacket());
     }
 }
 
-// Add this new method
-void Network::forwardMessage(const Message& msg) {
-    auto peers = routing_table_.getPeersForCategory(msg.getGroupId());
-    if (!peers.empty()) {
-        for (const auto& peer : peers) {
-            peer->sendMessage(msg);
+uint32_t Network::currentEpoch() const {
+    return static_cast<uint32_t>(wall_clock_() / SizeEstimator::EPOCH_SECONDS);
+}
+
+size_t Network::bloomBitsFor(size_t network_size) {
+    return std::clamp(network_size * BLOOM_BITS_PER_NODE, MIN_BLOOM_BITS, MAX_BLOOM_BITS);
+}
+
+// Caller holds peers_mutex_. Once a neighbour's sketch has been merged the
+// live estimate replaces the constructor's guess, and everything sized by
+// it follows: forwarding probability and flood radius read it directly, and
+// the dedup filter is rebuilt when it is off by more than a factor of two.
+//
+// Sketches are unauthenticated and a merge cannot be undone, so a single
+// neighbour claiming far more nodes than the others is left out; honest
+// neighbours see the same overlay and claim about the same size.
+void Network::mergeSizeSketch(const std::shared_ptr<Peer>& from, const SizeSketch& sketch) {
+    double claimed = sketch.sketch.estimate();
+    neighbour_sizes_[from] = claimed;
+    if (neighbour_sizes_.size() >= SIZE_QUORUM) {
+        std::vector<double> sizes;
+        sizes.reserve(neighbour_sizes_.size());
+        for (const auto& entry : neighbour_sizes_) {
+            sizes.push_back(entry.second);
         }
-    } else {
-        int flood_radius = calculateFloodRadius();
-        for (int i = 0; i < flood_radius && i < peers_.size(); ++i) {
-            if (shouldForwardMessage()) {
-                peers_[i]->sendMessage(msg);
-            }
+        std::nth_element(sizes.begin(), sizes.begin() + sizes.size() / 2, sizes.end());
+        if (claimed > SIZE_OUTLIER_FACTOR * sizes[sizes.size() / 2]) {
+            Debug::log("Ignoring size sketch claiming " + std::to_string(std::llround(claimed)) + " nodes from " +
+                       from->getAddress());
+            return;
         }
     }
+    if (!size_estimator_.merge(sketch, currentEpoch()) || !size_estimator_.heardFromPeers()) {
+        return;
+    }
+    estimated_network_size_ = std::max<size_t>(1, std::llround(size_estimator_.estimate()));
+
+    size_t target_bits = bloomBitsFor(estimated_network_size_);
+    if (bloom_filter_.size() < target_bits / 2 || bloom_filter_.size() > target_bits * 2) {
+        Debug::log("Resizing dedup filter to " + std::to_string(target_bits) + " bits for an estimated " +
+                   std::to_string(estimated_network_size_) + " nodes");
+        bloom_filter_.resize(target_bits);
+    }
 }
-bool Network::shouldForwardMessage() const {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_real_distribution<> dis(0, 1);
+
+bool Network::shouldForwardMessage() {
+    std::uniform_real_distribution<> dis(0, 1);
 
     const double C = 1000.0;  // Adjust this constant as needed
-    return dis(gen) < (C / estimated_network_size_);
+    return dis(rng_) < (C / estimated_network_size_);
 }
 
 int Network::calculateFloodRadius() const {
-    return static_cast<int>(std::ceil(std::log2(estimated_network_size_)));
+    return std::max(1, static_cast<int>(std::ceil(std::log2(estimated_network_size_))));
 }
 
 std::string computeProofOfWork(const std::string& challenge, int difficulty) {
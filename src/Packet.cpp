@@ -6,35 +6,74 @@
 
 
 Packet createPacket(const std::string& message, uint32_t sequence) {
+    return createPacket(PacketType::Data, std::vector<uint8_t>(message.begin(), message.end()), sequence);
+}
+
+Packet createPacket(PacketType type, std::vector<uint8_t> payload, uint32_t sequence) {
     Packet packet;
     packet.magic = MAGIC_NUMBER;
-    packet.payload = std::vector<uint8_t>(message.begin(), message.end());
+    packet.type = type;
+    packet.payload = std::move(payload);
     packet.length = packet.payload.size();
     packet.sequence = sequence;
     packet.checksum = calculateCRC32(packet.payload);
     return packet;
 }
 
-std::vector<uint8_t> serializePacket(const Packet& packet) {
-    std::vector<uint8_t> serialized;
-    serialized.reserve(16 + packet.payload.size());
+FramePtr makeFrame(PacketType type, std::vector<uint8_t> payload) {
+    uint32_t checksum = calculateCRC32(payload);
+    return std::make_shared<const EncodedFrame>(EncodedFrame{type, checksum, std::move(payload)});
+}
+
+FramePtr makeFrame(Packet packet) {
+    return std::make_shared<const EncodedFrame>(EncodedFrame{packet.type, packet.checksum, std::move(packet.payload)});
+}
+
+PacketHeader makePacketHeader(const EncodedFrame& frame, uint32_t sequence, uint8_t flags) {
+    return makePacketHeader(frame.type, static_cast<uint32_t>(frame.payload.size()), sequence, frame.checksum, flags);
+}
 
-    auto appendUint32 = [&serialized](uint32_t value) {
-        serialized.push_back((value >> 24) & 0xFF);
-        serialized.push_back((value >> 16) & 0xFF);
-        serialized.push_back((value >> 8) & 0xFF);
-        serialized.push_back(value & 0xFF);
+PacketHeader makePacketHeader(PacketType type, uint32_t length, uint32_t sequence,
+                              uint32_t checksum, uint8_t flags) {
+    PacketHeader header{};
+    auto put = [&header](size_t offset, uint32_t value) {
+        header[offset] = (value >> 24) & 0xFF;
+        header[offset + 1] = (value >> 16) & 0xFF;
+        header[offset + 2] = (value >> 8) & 0xFF;
+        header[offset + 3] = value & 0xFF;
     };
+    put(0, MAGIC_NUMBER);
+    put(4, length);
+    put(8, sequence);
+    put(12, checksum);
+    header[16] = static_cast<uint8_t>(type);
+    header[17] = flags;
+    return header;
+}
+
+bool isValidHeader(const uint8_t* header) {
+    return readUint32(header, 0) == MAGIC_NUMBER &&
+           readUint32(header, 4) <= MAX_PAYLOAD_SIZE &&
+           header[16] <= static_cast<uint8_t>(PacketType::Datagram);
+}
 
-    appendUint32(packet.magic);
-    appendUint32(packet.length);
-    appendUint32(packet.sequence);
-    appendUint32(packet.checksum);
+std::vector<uint8_t> serializePacket(const Packet& packet) {
+    std::vector<uint8_t> serialized;
+    serialized.reserve(PACKET_HEADER_SIZE + packet.payload.size());
+
+    appendUint32(serialized, packet.magic);
+    appendUint32(serialized, packet.length);
+    appendUint32(serialized, packet.sequence);
+    appendUint32(serialized, packet.checksum);
+    serialized.push_back(static_cast<uint8_t>(packet.type));
+    serialized.push_back(packet.flags);
+    serialized.push_back(0);  // Reserved
+    serialized.push_back(0);
     serialized.insert(serialized.end(), packet.payload.begin(), packet.payload.end());
 
     std::stringstream ss;
     ss << "Raw bytes: ";
-    for (int i = 0; i < 16; ++i) {
+    for (size_t i = 0; i < PACKET_HEADER_SIZE; ++i) {
         ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(serialized[i]) << " ";
     }
     Debug::log(ss.str());
@@ -49,43 +88,112 @@ std::vector<uint8_t> serializePacket(const Packet& packet) {
 }
 
 Packet deserializePacket(const std::vector<uint8_t>& data) {
-    if (data.size() < 16) {
+    if (data.size() < PACKET_HEADER_SIZE) {
         throw std::runtime_error("Invalid packet: too short");
     }
 
-    Packet packet;
-    auto readUint32 = [&data](size_t offset) {
-        return (static_cast<uint32_t>(data[offset]) << 24) |
-               (static_cast<uint32_t>(data[offset + 1]) << 16) |
-               (static_cast<uint32_t>(data[offset + 2]) << 8) |
-               static_cast<uint32_t>(data[offset + 3]);
-    };
+    std::vector<uint8_t> payload(data.begin() + PACKET_HEADER_SIZE, data.end());
+    return deserializePacket(data.data(), payload);
+}
 
-    packet.magic = readUint32(0);
-    if (packet.magic != MAGIC_NUMBER) {
-        throw std::runtime_error("Invalid packet: wrong magic number");
+Packet deserializePacket(const uint8_t* header, const std::vector<uint8_t>& payload) {
+    Packet packet = parsePacketHeader(header);
+
+    if (payload.size() != packet.length) {
+        throw std::runtime_error("Invalid packet: length mismatch");
     }
 
-    packet.length = readUint32(4);
-    packet.sequence = readUint32(8);
-    packet.checksum = readUint32(12);
+    if (!(packet.flags & PACKET_FLAG_FRAGMENT)) {
+        uint32_t calculatedChecksum = calculateCRC32(payload);
+        if (calculatedChecksum != packet.checksum) {
+            throw std::runtime_error("Invalid packet: checksum mismatch");
+        }
+    }
 
-    if (data.size() != 16 + packet.length) {
-        throw std::runtime_error("Invalid packet: length mismatch");
+    packet.payload = payload;
+    return packet;
+}
+
+bool FragmentReassembler::add(Packet& piece, bool verify_checksum) {
+    if (!active_) {
+        active_ = true;
+        payload_ = std::move(piece.payload);
+    } else {
+        payload_.insert(payload_.end(), piece.payload.begin(), piece.payload.end());
+    }
+    if (payload_.size() > MAX_PAYLOAD_SIZE) {
+        active_ = false;
+        payload_ = {};
+        throw std::runtime_error("Invalid fragment: frame too large");
+    }
+    if (!(piece.flags & PACKET_FLAG_LAST_FRAGMENT)) {
+        return false;
     }
 
-    packet.payload = std::vector<uint8_t>(data.begin() + 16, data.end());
+    active_ = false;
+    piece.payload = std::move(payload_);
+    payload_ = {};
+    piece.length = static_cast<uint32_t>(piece.payload.size());
+    piece.flags &= ~(PACKET_FLAG_FRAGMENT | PACKET_FLAG_LAST_FRAGMENT);
+    if (verify_checksum && calculateCRC32(piece.payload) != piece.checksum) {
+        throw std::runtime_error("Invalid fragment: checksum mismatch");
+    }
+    return true;
+}
 
-    uint32_t calculatedChecksum = calculateCRC32(packet.payload);
-    if (calculatedChecksum != packet.checksum) {
-        throw std::runtime_error("Invalid packet: checksum mismatch");
+Packet parsePacketHeader(const uint8_t* header) {
+    Packet packet;
+    packet.magic = readUint32(header, 0);
+    if (packet.magic != MAGIC_NUMBER) {
+        throw std::runtime_error("Invalid packet: wrong magic number");
     }
 
+    packet.length = readUint32(header, 4);
+    packet.sequence = readUint32(header, 8);
+    packet.checksum = readUint32(header, 12);
+    packet.type = static_cast<PacketType>(header[16]);
+    packet.flags = header[17];
     return packet;
 }
 
+uint16_t readUint16(const uint8_t* data, size_t offset) {
+    return static_cast<uint16_t>((data[offset] << 8) | data[offset + 1]);
+}
+
+uint32_t readUint32(const uint8_t* data, size_t offset) {
+    return (static_cast<uint32_t>(data[offset]) << 24) |
+           (static_cast<uint32_t>(data[offset + 1]) << 16) |
+           (static_cast<uint32_t>(data[offset + 2]) << 8) |
+           static_cast<uint32_t>(data[offset + 3]);
+}
+
+uint64_t readUint64(const uint8_t* data, size_t offset) {
+    return (static_cast<uint64_t>(readUint32(data, offset)) << 32) | readUint32(data, offset + 4);
+}
+
+void appendUint16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+void appendUint32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back((value >> 24) & 0xFF);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+void appendUint64(std::vector<uint8_t>& out, uint64_t value) {
+    appendUint32(out, static_cast<uint32_t>(value >> 32));
+    appendUint32(out, static_cast<uint32_t>(value));
+}
+
 uint32_t calculateCRC32(const std::vector<uint8_t>& data) {
+    return calculateCRC32(data.data(), data.size());
+}
+
+uint32_t calculateCRC32(const uint8_t* data, size_t size) {
     boost::crc_32_type result;
-    result.process_bytes(data.data(), data.size());
+    result.process_bytes(data, size);
     return result.checksum();
 }
\ No newline at end of file
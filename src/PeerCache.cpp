@@ -0,0 +1,209 @@
+#include "PeerCache.h"
+#include "Debug.h"
+#include "Packet.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Writes the address into a 16-byte field and returns its family
+uint8_t packAddress(const boost::asio::ip::address& address, uint8_t* out) {
+    std::memset(out, 0, 16);
+    if (address.is_v4()) {
+        auto bytes = address.to_v4().to_bytes();
+        std::memcpy(out, bytes.data(), bytes.size());
+        return 4;
+    }
+    auto bytes = address.to_v6().to_bytes();
+    std::memcpy(out, bytes.data(), bytes.size());
+    return 6;
+}
+
+}
+
+PeerCache::PeerCache(const std::string& path) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to open peer cache " + path);
+    }
+    if (::ftruncate(fd_, FILE_SIZE) != 0) {
+        ::close(fd_);
+        throw std::runtime_error("Failed to size peer cache " + path);
+    }
+    void* map = ::mmap(nullptr, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd_);
+        throw std::runtime_error("Failed to map peer cache " + path);
+    }
+    map_ = static_cast<uint8_t*>(map);
+    if (!valid()) {
+        Debug::log("Peer cache " + path + " is empty or damaged, starting afresh");
+        reset();
+    }
+}
+
+PeerCache::~PeerCache() {
+    applySeen();
+    ::msync(map_, FILE_SIZE, MS_SYNC);
+    ::munmap(map_, FILE_SIZE);
+    ::close(fd_);
+}
+
+uint32_t PeerCache::checksum() const {
+    return calculateCRC32(reinterpret_cast<const uint8_t*>(records()), header()->count * sizeof(Record));
+}
+
+bool PeerCache::valid() const {
+    const Header* h = header();
+    return h->magic == MAGIC && h->version == VERSION && h->count <= CAPACITY && h->checksum == checksum();
+}
+
+void PeerCache::reset() {
+    std::memset(map_, 0, FILE_SIZE);
+    header()->magic = MAGIC;
+    header()->version = VERSION;
+    commit();
+}
+
+// The table is small and only changes on connection events and flushes,
+// so the CRC is simply recomputed over it each time
+void PeerCache::commit() {
+    header()->checksum = checksum();
+}
+
+void PeerCache::applySeen() {
+    if (seen_.empty()) {
+        return;
+    }
+    for (const auto& entry : seen_) {
+        Record* record = findOrInsert(entry.first, entry.second.last_seen);
+        record->last_seen = std::max<int64_t>(record->last_seen, entry.second.last_seen);
+        if (entry.second.node_id != NodeId{}) {
+            std::memcpy(record->node_id, entry.second.node_id.data(), entry.second.node_id.size());
+        }
+    }
+    seen_.clear();
+    commit();
+}
+
+void PeerCache::flush() {
+    applySeen();
+    ::msync(map_, FILE_SIZE, MS_ASYNC);
+}
+
+size_t PeerCache::size() const {
+    return header()->count;
+}
+
+size_t PeerCache::memoryUsage() const {
+    return FILE_SIZE + seen_.size() * sizeof(std::pair<const PeerAddress, Seen>);
+}
+
+PeerCache::Record* PeerCache::find(const PeerAddress& address) const {
+    uint8_t bytes[16];
+    uint8_t family = packAddress(address.address, bytes);
+    Record* table = records();
+    for (uint32_t i = 0; i < header()->count; ++i) {
+        if (table[i].family == family && table[i].port == address.port &&
+            std::memcmp(table[i].address, bytes, sizeof(bytes)) == 0) {
+            return &table[i];
+        }
+    }
+    return nullptr;
+}
+
+// A full table gives up its lowest-ranked slot
+PeerCache::Record* PeerCache::findOrInsert(const PeerAddress& address, std::time_t now) {
+    if (Record* existing = find(address)) {
+        return existing;
+    }
+    Record* table = records();
+    Record* slot;
+    if (header()->count < CAPACITY) {
+        slot = &table[header()->count++];
+    } else {
+        slot = std::min_element(table, table + CAPACITY, [now](const Record& a, const Record& b) {
+            return rank(a, now) < rank(b, now);
+        });
+    }
+    std::memset(slot, 0, sizeof(Record));
+    slot->family = packAddress(address.address, slot->address);
+    slot->port = address.port;
+    slot->last_seen = now;
+    return slot;
+}
+
+void PeerCache::recordSeen(const PeerAddress& address, std::time_t now, const NodeId& node_id) {
+    auto it = seen_.find(address);
+    if (it == seen_.end()) {
+        if (seen_.size() >= CAPACITY) {
+            return;
+        }
+        it = seen_.emplace(address, Seen{now, NodeId{}}).first;
+    }
+    it->second.last_seen = now;
+    if (node_id != NodeId{}) {
+        it->second.node_id = node_id;
+    }
+}
+
+// Failures cost more than successes earn, so a peer that has gone for good
+// sinks below the live ones within a couple of restarts
+void PeerCache::recordSession(const PeerAddress& address, std::time_t now, bool connected) {
+    // A failed dial of a peer we never reached is not worth a slot
+    Record* record = connected ? findOrInsert(address, now) : find(address);
+    if (!record) {
+        return;
+    }
+    if (connected) {
+        record->last_seen = now;
+        record->score = std::min(MAX_SCORE, record->score + 1);
+    } else {
+        record->score = std::max(MIN_SCORE, record->score - 2);
+    }
+    commit();
+}
+
+// One point of score is worth a day of not having seen the peer
+double PeerCache::rank(const Record& record, std::time_t now) {
+    double age_days = std::max<double>(0, static_cast<double>(now - record.last_seen)) / 86400.0;
+    return record.score - age_days;
+}
+
+PeerCache::Entry PeerCache::toEntry(const Record& record) {
+    Entry entry;
+    if (record.family == 4) {
+        boost::asio::ip::address_v4::bytes_type bytes;
+        std::memcpy(bytes.data(), record.address, bytes.size());
+        entry.address.address = boost::asio::ip::address_v4(bytes);
+    } else {
+        boost::asio::ip::address_v6::bytes_type bytes;
+        std::memcpy(bytes.data(), record.address, bytes.size());
+        entry.address.address = boost::asio::ip::address_v6(bytes);
+    }
+    entry.address.port = record.port;
+    entry.last_seen = static_cast<std::time_t>(record.last_seen);
+    entry.score = record.score;
+    std::memcpy(entry.node_id.data(), record.node_id, entry.node_id.size());
+    return entry;
+}
+
+std::vector<PeerCache::Entry> PeerCache::best(size_t count, std::time_t now) const {
+    std::vector<const Record*> ranked;
+    const Record* table = records();
+    for (uint32_t i = 0; i < header()->count; ++i) {
+        ranked.push_back(&table[i]);
+    }
+    count = std::min(count, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(),
+                      [now](const Record* a, const Record* b) { return rank(*a, now) > rank(*b, now); });
+    std::vector<Entry> entries;
+    for (size_t i = 0; i < count; ++i) {
+        entries.push_back(toEntry(*ranked[i]));
+    }
+    return entries;
+}
@@ -0,0 +1,148 @@
+#include "PeerExchange.h"
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+void appendEntry(std::vector<uint8_t>& out, const PeerAddress& peer) {
+    if (peer.address.is_v4()) {
+        out.push_back(4);
+        auto bytes = peer.address.to_v4().to_bytes();
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    } else {
+        out.push_back(6);
+        auto bytes = peer.address.to_v6().to_bytes();
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    }
+    appendUint16(out, peer.port);
+}
+
+PeerAddress readEntry(const std::vector<uint8_t>& data, size_t& offset) {
+    if (offset >= data.size()) {
+        throw std::runtime_error("Invalid peer exchange: truncated entry");
+    }
+    PeerAddress peer;
+    uint8_t family = data[offset++];
+    if (family == 4) {
+        boost::asio::ip::address_v4::bytes_type bytes;
+        if (data.size() - offset < bytes.size() + 2) {
+            throw std::runtime_error("Invalid peer exchange: truncated entry");
+        }
+        std::copy(data.begin() + offset, data.begin() + offset + bytes.size(), bytes.begin());
+        peer.address = boost::asio::ip::address_v4(bytes);
+        offset += bytes.size();
+    } else if (family == 6) {
+        boost::asio::ip::address_v6::bytes_type bytes;
+        if (data.size() - offset < bytes.size() + 2) {
+            throw std::runtime_error("Invalid peer exchange: truncated entry");
+        }
+        std::copy(data.begin() + offset, data.begin() + offset + bytes.size(), bytes.begin());
+        peer.address = boost::asio::ip::address_v6(bytes);
+        offset += bytes.size();
+    } else {
+        throw std::runtime_error("Invalid peer exchange: unknown address family");
+    }
+    peer.port = readUint16(data.data(), offset);
+    offset += 2;
+    return peer;
+}
+
+}
+
+std::string PeerAddress::toString() const {
+    if (address.is_v6()) {
+        return "[" + address.to_string() + "]:" + std::to_string(port);
+    }
+    return address.to_string() + ":" + std::to_string(port);
+}
+
+size_t PeerAddressHash::operator()(const PeerAddress& address) const {
+    size_t hash;
+    if (address.address.is_v4()) {
+        hash = std::hash<uint32_t>()(address.address.to_v4().to_uint());
+    } else {
+        auto bytes = address.address.to_v6().to_bytes();
+        hash = std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+    }
+    return hash ^ (std::hash<uint16_t>()(address.port) * 0x9E3779B97F4A7C15ULL);
+}
+
+// Layout: an optional SizeSketch, then an optional u16 listen port; the
+// payload length tells which are present
+Packet PeerRequest::toPacket() const {
+    std::vector<uint8_t> payload;
+    if (size_sketch) {
+        size_sketch->appendTo(payload);
+    }
+    if (listen_port != 0) {
+        appendUint16(payload, listen_port);
+    }
+    return createPacket(PacketType::PeerRequest, std::move(payload), 0);
+}
+
+PeerRequest PeerRequest::fromPacket(const Packet& packet) {
+    const std::vector<uint8_t>& data = packet.payload;
+    PeerRequest request;
+    size_t offset = 0;
+    if (data.size() >= SizeSketch::WIRE_SIZE) {
+        request.size_sketch = SizeSketch::read(data.data());
+        offset = SizeSketch::WIRE_SIZE;
+    }
+    if (data.size() - offset == 2) {
+        request.listen_port = readUint16(data.data(), offset);
+    } else if (offset != data.size()) {
+        throw std::runtime_error("Invalid peer request: unexpected length");
+    }
+    return request;
+}
+
+// Layout: u16 added count, u16 removed count, the packed entries, then an
+// optional SizeSketch
+Packet PeerExchange::toPacket() const {
+    size_t added_count = std::min(added.size(), MAX_ENTRIES);
+    size_t removed_count = std::min(removed.size(), MAX_ENTRIES);
+
+    std::vector<uint8_t> payload;
+    payload.reserve(4 + (added_count + removed_count) * 19 + SizeSketch::WIRE_SIZE);
+    appendUint16(payload, static_cast<uint16_t>(added_count));
+    appendUint16(payload, static_cast<uint16_t>(removed_count));
+    for (size_t i = 0; i < added_count; ++i) {
+        appendEntry(payload, added[i]);
+    }
+    for (size_t i = 0; i < removed_count; ++i) {
+        appendEntry(payload, removed[i]);
+    }
+    if (size_sketch) {
+        size_sketch->appendTo(payload);
+    }
+    return createPacket(PacketType::PeerExchange, std::move(payload), 0);
+}
+
+PeerExchange PeerExchange::fromPacket(const Packet& packet) {
+    const std::vector<uint8_t>& data = packet.payload;
+    if (data.size() < 4) {
+        throw std::runtime_error("Invalid peer exchange: too short");
+    }
+    size_t added_count = readUint16(data.data(), 0);
+    size_t removed_count = readUint16(data.data(), 2);
+    if (added_count > MAX_ENTRIES || removed_count > MAX_ENTRIES) {
+        throw std::runtime_error("Invalid peer exchange: too many entries");
+    }
+
+    PeerExchange exchange;
+    size_t offset = 4;
+    for (size_t i = 0; i < added_count; ++i) {
+        exchange.added.push_back(readEntry(data, offset));
+    }
+    for (size_t i = 0; i < removed_count; ++i) {
+        exchange.removed.push_back(readEntry(data, offset));
+    }
+    if (data.size() - offset == SizeSketch::WIRE_SIZE) {
+        exchange.size_sketch = SizeSketch::read(data.data() + offset);
+    } else if (offset != data.size()) {
+        throw std::runtime_error("Invalid peer exchange: trailing bytes");
+    }
+    return exchange;
+}
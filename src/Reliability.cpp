@@ -0,0 +1,181 @@
+#include "Reliability.h"
+#include "Debug.h"
+#include <algorithm>
+#include <iterator>
+
+AckTracker::Result AckTracker::check(uint32_t sequence) const {
+    if (sequence <= cumulative_) {
+        return Result::Duplicate;
+    }
+    auto next = ranges_.upper_bound(sequence);
+    bool after = false;
+    if (next != ranges_.begin()) {
+        auto prev = std::prev(next);
+        if (sequence <= prev->second) {
+            return Result::Duplicate;
+        }
+        after = prev->second + 1 == sequence;
+    }
+    bool before = next != ranges_.end() && next->first == sequence + 1;
+    // A sequence that opens a range of its own needs room for it; the
+    // sender retransmits it once the gaps below have filled
+    if (!after && !before && sequence != cumulative_ + 1 && ranges_.size() >= MAX_TRACKED_RANGES) {
+        return Result::Full;
+    }
+    return Result::New;
+}
+
+AckTracker::Result AckTracker::record(uint32_t sequence) {
+    Result result = check(sequence);
+    if (result == Result::Full) {
+        return result;
+    }
+    ++pending_;  // Duplicates are acknowledged again in case our ack was lost
+    if (result == Result::Duplicate) {
+        return result;
+    }
+
+    // Merge the sequence into its neighbouring ranges
+    uint32_t start = sequence;
+    uint32_t end = sequence;
+    auto next = ranges_.upper_bound(sequence);
+    if (next != ranges_.begin()) {
+        auto prev = std::prev(next);
+        if (prev->second + 1 == sequence) {
+            start = prev->first;
+            ranges_.erase(prev);
+        }
+    }
+    if (next != ranges_.end() && next->first == sequence + 1) {
+        end = next->second;
+        ranges_.erase(next);
+    }
+    ranges_[start] = end;
+
+    // Fold the lowest range into the cumulative point once the gap closes
+    auto first = ranges_.begin();
+    if (first != ranges_.end() && first->first == cumulative_ + 1) {
+        cumulative_ = first->second;
+        ranges_.erase(first);
+    }
+    return Result::New;
+}
+
+void AckTracker::skipTo(uint32_t sequence) {
+    if (sequence <= cumulative_) {
+        return;
+    }
+    cumulative_ = sequence;
+    while (!ranges_.empty() && ranges_.begin()->first <= cumulative_ + 1) {
+        cumulative_ = std::max(cumulative_, ranges_.begin()->second);
+        ranges_.erase(ranges_.begin());
+    }
+}
+
+Packet AckTracker::buildAck() {
+    std::vector<uint8_t> payload;
+    size_t count = 0;
+    for (auto it = ranges_.begin(); it != ranges_.end() && count < MAX_ACK_RANGES; ++it, ++count) {
+        appendUint32(payload, it->first);
+        appendUint32(payload, it->second);
+    }
+    pending_ = 0;
+    return createPacket(PacketType::Ack, std::move(payload), cumulative_);
+}
+
+void SendWindow::add(uint32_t sequence, FramePtr frame) {
+    Entry& entry = unacked_[sequence];
+    if (entry.frame) {
+        retained_bytes_ -= entry.frame->payload.size();
+    }
+    retained_bytes_ += frame->payload.size();
+    entry = Entry{std::move(frame), Clock::time_point(), Clock::time_point::max(), 1};
+}
+
+void SendWindow::add(uint32_t sequence, FramePtr frame, Clock::time_point now) {
+    add(sequence, std::move(frame));
+    markSent(sequence, now);
+}
+
+void SendWindow::markSent(uint32_t sequence, Clock::time_point now) {
+    auto it = unacked_.find(sequence);
+    if (it == unacked_.end()) {
+        return;
+    }
+    Entry& entry = it->second;
+    if (entry.attempts == 1) {
+        entry.sent = now;
+    }
+    // Exponential backoff between attempts
+    entry.deadline = now + std::min<Clock::duration>(rto_ * (1 << std::min(entry.attempts - 1, 16)), MAX_RTO);
+}
+
+void SendWindow::erase(std::map<uint32_t, Entry>::iterator first, std::map<uint32_t, Entry>::iterator last) {
+    for (auto it = first; it != last; ++it) {
+        retained_bytes_ -= it->second.frame->payload.size();
+        if (it->second.attempts == 1 && it->second.sent > newest_acked_) {
+            newest_acked_ = it->second.sent;
+        }
+    }
+    unacked_.erase(first, last);
+}
+
+// One sample per ack, from the newest frame it covers
+size_t SendWindow::acknowledge(const Packet& ack) {
+    size_t before = unacked_.size();
+    newest_acked_ = Clock::time_point();
+    erase(unacked_.begin(), unacked_.upper_bound(ack.sequence));
+
+    for (size_t offset = 0; offset + 8 <= ack.payload.size(); offset += 8) {
+        uint32_t start = readUint32(ack.payload.data(), offset);
+        uint32_t end = readUint32(ack.payload.data(), offset + 4);
+        if (end < start) {
+            continue;
+        }
+        erase(unacked_.lower_bound(start), unacked_.upper_bound(end));
+    }
+    if (adaptive_ && newest_acked_ != Clock::time_point()) {
+        sampleRtt(Clock::now() - newest_acked_);
+    }
+    return before - unacked_.size();
+}
+
+void SendWindow::sampleRtt(Clock::duration rtt) {
+    if (srtt_ == Clock::duration::zero()) {
+        srtt_ = rtt;
+        rttvar_ = rtt / 2;
+    } else {
+        Clock::duration error = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+        rttvar_ = (3 * rttvar_ + error) / 4;
+        srtt_ = (7 * srtt_ + rtt) / 8;
+    }
+    rto_ = std::min<Clock::duration>(std::max(srtt_ + 4 * rttvar_, min_rto_), MAX_RTO);
+}
+
+std::vector<SendWindow::Retransmit> SendWindow::collectExpired(Clock::time_point now,
+                                                               std::vector<Retransmit>* abandoned) {
+    std::vector<Retransmit> expired;
+    for (auto it = unacked_.begin(); it != unacked_.end();) {
+        Entry& entry = it->second;
+        if (entry.deadline > now) {
+            ++it;
+            continue;
+        }
+        if (entry.attempts >= max_attempts_) {
+            Debug::log("Giving up on frame " + std::to_string(it->first) + " after " +
+                       std::to_string(entry.attempts) + " attempts");
+            ++dropped_;
+            if (abandoned) {
+                abandoned->emplace_back(it->first, entry.frame);
+            }
+            retained_bytes_ -= entry.frame->payload.size();
+            it = unacked_.erase(it);
+            continue;
+        }
+        entry.deadline = Clock::time_point::max();
+        ++entry.attempts;
+        expired.emplace_back(it->first, entry.frame);
+        ++it;
+    }
+    return expired;
+}
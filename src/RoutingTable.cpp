@@ -1,26 +1,49 @@
 #include "RoutingTable.h"
 #include <algorithm>
 
-void RoutingTable::addPeer(const std::string& category, std::shared_ptr<PeerConnection> peer) {
-    table_[category].push_back(peer);
+bool RoutingTable::updatePeerInterests(const std::shared_ptr<Peer>& peer, const InterestAdvert& advert) {
+    for (auto& entry : entries_) {
+        if (entry.peer == peer) {
+            if (entry.advert == advert) {
+                return false;
+            }
+            entry.advert = advert;
+            return true;
+        }
+    }
+    entries_.push_back(Entry{peer, advert});
+    return true;
 }
 
-std::vector<std::shared_ptr<PeerConnection>> RoutingTable::getPeersForCategory(const std::string& category) {
-    if (table_.find(category) != table_.end()) {
-        return table_[category];
-    }
-    return {};
+bool RoutingTable::removePeer(const std::shared_ptr<Peer>& peer) {
+    auto it = std::remove_if(entries_.begin(), entries_.end(),
+                             [&peer](const Entry& entry) { return entry.peer == peer; });
+    bool removed = it != entries_.end();
+    entries_.erase(it, entries_.end());
+    return removed;
 }
 
-void RoutingTable::updatePeerInterests(std::shared_ptr<PeerConnection> peer, const std::vector<std::string>& categories) {
-    // Remove the peer from all categories
-    for (auto& entry : table_) {
-        auto& peers = entry.second;
-        peers.erase(std::remove(peers.begin(), peers.end(), peer), peers.end());
+std::vector<std::shared_ptr<Peer>> RoutingTable::getPeersForCategory(const std::string& category) const {
+    InterestFilter::Key key = InterestFilter::keyFor(category);
+    std::vector<std::shared_ptr<Peer>> peers;
+    for (const auto& entry : entries_) {
+        if (entry.advert.mayReach(key)) {
+            peers.push_back(entry.peer);
+        }
     }
+    return peers;
+}
 
-    // Add the peer to the specified categories
-    for (const auto& category : categories) {
-        addPeer(category, peer);
+InterestAdvert RoutingTable::advertFor(const std::shared_ptr<Peer>& peer, const InterestFilter& local) const {
+    InterestAdvert advert;
+    advert.layers[0] = local;
+    for (const auto& entry : entries_) {
+        if (entry.peer == peer) {
+            continue;
+        }
+        for (size_t i = 1; i < InterestAdvert::DEPTH; ++i) {
+            advert.layers[i].merge(entry.advert.layers[i - 1]);
+        }
     }
+    return advert;
 }
@@ -0,0 +1,279 @@
+#include "SecureSession.h"
+#include "KeyManagement.h"
+#include <openssl/kdf.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+const std::string HANDSHAKE_LABEL = "TeleLibre handshake v1";
+const std::string SESSION_LABEL = "TeleLibre session keys v1";
+
+// What a Handshake signature covers: the label and the ephemeral key
+std::vector<uint8_t> handshakeTranscript(const uint8_t* ephemeral_public) {
+    std::vector<uint8_t> data(HANDSHAKE_LABEL.begin(), HANDSHAKE_LABEL.end());
+    data.insert(data.end(), ephemeral_public, ephemeral_public + SecureSession::KEY_SIZE);
+    return data;
+}
+
+EVP_CIPHER_CTX* newCipher(const uint8_t* key, bool encrypt) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || EVP_CipherInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key, nullptr, encrypt ? 1 : 0) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("Failed to initialise session cipher");
+    }
+    return ctx;
+}
+
+// 96-bit nonce: four zero bytes then the little-endian frame counter.
+// Datagrams set the first byte, so their nonces never meet the stream's.
+const uint8_t DATAGRAM_NONCE = 1;
+
+std::array<uint8_t, SecureSession::NONCE_SIZE> makeNonce(uint64_t counter, uint8_t space = 0) {
+    std::array<uint8_t, SecureSession::NONCE_SIZE> nonce{};
+    nonce[0] = space;
+    for (size_t i = 0; i < 8; ++i) {
+        nonce[4 + i] = static_cast<uint8_t>(counter >> (8 * i));
+    }
+    return nonce;
+}
+
+}
+
+std::shared_ptr<NodeIdentity> NodeIdentity::generate() {
+    EVP_PKEY* private_key = nullptr;
+    EVP_PKEY* public_key = nullptr;
+    KeyManagement::generateKeys(&private_key, &public_key);
+    EVP_PKEY_free(public_key);
+    return std::make_shared<NodeIdentity>(private_key);
+}
+
+NodeIdentity::NodeIdentity(EVP_PKEY* private_key) : key_(private_key) {
+    size_t length = public_key_.size();
+    if (!key_ || EVP_PKEY_id(key_) != EVP_PKEY_ED25519 ||
+        EVP_PKEY_get_raw_public_key(key_, public_key_.data(), &length) != 1 || length != public_key_.size()) {
+        EVP_PKEY_free(key_);
+        throw std::runtime_error("Node identity must be an Ed25519 key");
+    }
+}
+
+NodeIdentity::~NodeIdentity() {
+    EVP_PKEY_free(key_);
+}
+
+std::vector<uint8_t> NodeIdentity::sign(const std::vector<uint8_t>& data) const {
+    unsigned char* signature = nullptr;
+    size_t signature_length = 0;
+    if (KeyManagement::signMessage(key_, data.data(), data.size(), &signature, &signature_length) != 1) {
+        throw std::runtime_error("Failed to sign handshake");
+    }
+    std::vector<uint8_t> result(signature, signature + signature_length);
+    OPENSSL_free(signature);
+    return result;
+}
+
+bool NodeIdentity::verify(const PublicKey& key, const std::vector<uint8_t>& data,
+                          const uint8_t* signature, size_t signature_length) {
+    EVP_PKEY* public_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, key.data(), key.size());
+    if (!public_key) {
+        return false;
+    }
+    int result = KeyManagement::verifyMessage(public_key, data.data(), data.size(), signature, signature_length);
+    EVP_PKEY_free(public_key);
+    return result == 1;
+}
+
+SecureSession::SecureSession(std::shared_ptr<const NodeIdentity> identity)
+    : identity_(std::move(identity)) {
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr);
+    size_t length = ephemeral_public_.size();
+    bool ok = ctx && EVP_PKEY_keygen_init(ctx) == 1 && EVP_PKEY_keygen(ctx, &ephemeral_) == 1 &&
+              EVP_PKEY_get_raw_public_key(ephemeral_, ephemeral_public_.data(), &length) == 1;
+    EVP_PKEY_CTX_free(ctx);
+    if (!ok) {
+        EVP_PKEY_free(ephemeral_);
+        throw std::runtime_error("Failed to generate session key");
+    }
+}
+
+SecureSession::~SecureSession() {
+    EVP_PKEY_free(ephemeral_);
+    EVP_CIPHER_CTX_free(send_ctx_);
+    EVP_CIPHER_CTX_free(receive_ctx_);
+}
+
+// Payload: ephemeral X25519 key[32], Ed25519 identity[32], signature[64]
+Packet SecureSession::hello() const {
+    std::vector<uint8_t> payload(ephemeral_public_.begin(), ephemeral_public_.end());
+    const auto& identity = identity_->publicKey();
+    payload.insert(payload.end(), identity.begin(), identity.end());
+    std::vector<uint8_t> signature = identity_->sign(handshakeTranscript(ephemeral_public_.data()));
+    payload.insert(payload.end(), signature.begin(), signature.end());
+    return createPacket(PacketType::Handshake, std::move(payload), 0);
+}
+
+void SecureSession::accept(const Packet& hello) {
+    if (established_) {
+        throw std::runtime_error("Handshake repeated on an established session");
+    }
+    if (hello.type != PacketType::Handshake || hello.payload.size() != HELLO_SIZE) {
+        throw std::runtime_error("Invalid handshake");
+    }
+    const uint8_t* remote_ephemeral = hello.payload.data();
+    std::copy_n(hello.payload.data() + KEY_SIZE, remote_identity_.size(), remote_identity_.begin());
+    if (!NodeIdentity::verify(remote_identity_, handshakeTranscript(remote_ephemeral),
+                              hello.payload.data() + KEY_SIZE + remote_identity_.size(),
+                              NodeIdentity::SIGNATURE_SIZE)) {
+        throw std::runtime_error("Handshake signature does not match its identity");
+    }
+    if (std::equal(ephemeral_public_.begin(), ephemeral_public_.end(), remote_ephemeral)) {
+        throw std::runtime_error("Handshake reflected back to us");
+    }
+
+    // X25519 shared secret
+    std::array<uint8_t, KEY_SIZE> secret{};
+    size_t secret_length = secret.size();
+    EVP_PKEY* remote = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, remote_ephemeral, KEY_SIZE);
+    EVP_PKEY_CTX* derive = EVP_PKEY_CTX_new(ephemeral_, nullptr);
+    bool ok = remote && derive && EVP_PKEY_derive_init(derive) == 1 &&
+              EVP_PKEY_derive_set_peer(derive, remote) == 1 &&
+              EVP_PKEY_derive(derive, secret.data(), &secret_length) == 1;
+    EVP_PKEY_CTX_free(derive);
+    EVP_PKEY_free(remote);
+    if (!ok) {
+        throw std::runtime_error("Failed to agree on a session secret");
+    }
+
+    // Both sides order the keys the same way, so the one with the lower
+    // ephemeral key sends with the first half of the HKDF output.
+    bool lower = std::lexicographical_compare(ephemeral_public_.begin(), ephemeral_public_.end(),
+                                              remote_ephemeral, remote_ephemeral + KEY_SIZE);
+    std::vector<uint8_t> salt;
+    const uint8_t* first = lower ? ephemeral_public_.data() : remote_ephemeral;
+    const uint8_t* second = lower ? remote_ephemeral : ephemeral_public_.data();
+    salt.insert(salt.end(), first, first + KEY_SIZE);
+    salt.insert(salt.end(), second, second + KEY_SIZE);
+    std::vector<uint8_t> info(SESSION_LABEL.begin(), SESSION_LABEL.end());
+    const auto& local_identity = identity_->publicKey();
+    const uint8_t* id_first = lower ? local_identity.data() : remote_identity_.data();
+    const uint8_t* id_second = lower ? remote_identity_.data() : local_identity.data();
+    info.insert(info.end(), id_first, id_first + remote_identity_.size());
+    info.insert(info.end(), id_second, id_second + remote_identity_.size());
+
+    std::array<uint8_t, 2 * KEY_SIZE> keys{};
+    size_t keys_length = keys.size();
+    EVP_PKEY_CTX* hkdf = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+    ok = hkdf && EVP_PKEY_derive_init(hkdf) == 1 &&
+         EVP_PKEY_CTX_set_hkdf_md(hkdf, EVP_sha256()) == 1 &&
+         EVP_PKEY_CTX_set1_hkdf_salt(hkdf, salt.data(), static_cast<int>(salt.size())) == 1 &&
+         EVP_PKEY_CTX_set1_hkdf_key(hkdf, secret.data(), static_cast<int>(secret_length)) == 1 &&
+         EVP_PKEY_CTX_add1_hkdf_info(hkdf, info.data(), static_cast<int>(info.size())) == 1 &&
+         EVP_PKEY_derive(hkdf, keys.data(), &keys_length) == 1;
+    EVP_PKEY_CTX_free(hkdf);
+    OPENSSL_cleanse(secret.data(), secret.size());
+    if (!ok) {
+        throw std::runtime_error("Failed to derive session keys");
+    }
+
+    send_ctx_ = newCipher(keys.data() + (lower ? 0 : KEY_SIZE), true);
+    receive_ctx_ = newCipher(keys.data() + (lower ? KEY_SIZE : 0), false);
+    OPENSSL_cleanse(keys.data(), keys.size());
+    EVP_PKEY_free(ephemeral_);
+    ephemeral_ = nullptr;
+    established_ = true;
+}
+
+PacketHeader SecureSession::seal(const EncodedFrame& frame, size_t offset, size_t length, uint32_t sequence,
+                                 uint8_t flags, std::vector<uint8_t>& out) {
+    if (!established_) {
+        throw std::runtime_error("Session not established");
+    }
+    if (offset > frame.payload.size() || length > frame.payload.size() - offset) {
+        throw std::runtime_error("Seal range outside frame");
+    }
+    const uint8_t* plaintext = frame.payload.data() + offset;
+    PacketHeader header = makePacketHeader(frame.type, static_cast<uint32_t>(length + TAG_SIZE),
+                                           sequence, 0, PACKET_FLAG_SEALED | flags);
+    auto nonce = makeNonce(send_counter_++);
+    out.resize(length + TAG_SIZE);
+    encrypt(nonce.data(), header, plaintext, length, out.data());
+    return header;
+}
+
+PacketHeader SecureSession::sealDatagram(const EncodedFrame& frame, uint32_t sequence, std::vector<uint8_t>& out) {
+    if (!established_) {
+        throw std::runtime_error("Session not established");
+    }
+    size_t length = frame.payload.size();
+    PacketHeader header = makePacketHeader(frame.type, static_cast<uint32_t>(length + DATAGRAM_OVERHEAD),
+                                           sequence, 0, PACKET_FLAG_SEALED);
+    uint64_t counter = datagram_counter_++;
+    out.clear();
+    appendUint64(out, counter);
+    out.resize(length + DATAGRAM_OVERHEAD);
+    encrypt(makeNonce(counter, DATAGRAM_NONCE).data(), header, frame.payload.data(), length, out.data() + 8);
+    return header;
+}
+
+void SecureSession::encrypt(const uint8_t* nonce, const PacketHeader& header, const uint8_t* plaintext,
+                            size_t length, uint8_t* out) {
+    int written = 0;
+    bool ok = EVP_EncryptInit_ex(send_ctx_, nullptr, nullptr, nullptr, nonce) == 1 &&
+              EVP_EncryptUpdate(send_ctx_, nullptr, &written, header.data(), static_cast<int>(header.size())) == 1 &&
+              EVP_EncryptUpdate(send_ctx_, out, &written, plaintext, static_cast<int>(length)) == 1 &&
+              EVP_EncryptFinal_ex(send_ctx_, out + written, &written) == 1 &&
+              EVP_CIPHER_CTX_ctrl(send_ctx_, EVP_CTRL_AEAD_GET_TAG, TAG_SIZE, out + length) == 1;
+    if (!ok) {
+        throw std::runtime_error("Failed to seal frame");
+    }
+}
+
+Packet SecureSession::open(const uint8_t* header, const std::vector<uint8_t>& ciphertext) {
+    if (!established_) {
+        throw std::runtime_error("Session not established");
+    }
+    Packet packet = parsePacketHeader(header);
+    auto nonce = makeNonce(receive_counter_++);
+    if (!(packet.flags & PACKET_FLAG_SEALED) || ciphertext.size() != packet.length || ciphertext.size() < TAG_SIZE) {
+        throw std::runtime_error("Invalid sealed frame");
+    }
+
+    size_t plaintext_size = ciphertext.size() - TAG_SIZE;
+    packet.payload.resize(plaintext_size);
+    if (!decrypt(nonce.data(), header, ciphertext.data(), plaintext_size, packet.payload.data())) {
+        throw std::runtime_error("Sealed frame failed authentication");
+    }
+    packet.length = static_cast<uint32_t>(plaintext_size);
+    return packet;
+}
+
+Packet SecureSession::openDatagram(const uint8_t* header, const uint8_t* data, size_t size) {
+    if (!established_) {
+        throw std::runtime_error("Session not established");
+    }
+    Packet packet = parsePacketHeader(header);
+    if (!(packet.flags & PACKET_FLAG_SEALED) || size != packet.length || size < DATAGRAM_OVERHEAD) {
+        throw std::runtime_error("Invalid sealed datagram");
+    }
+    size_t plaintext_size = size - DATAGRAM_OVERHEAD;
+    packet.payload.resize(plaintext_size);
+    auto nonce = makeNonce(readUint64(data, 0), DATAGRAM_NONCE);
+    if (!decrypt(nonce.data(), header, data + 8, plaintext_size, packet.payload.data())) {
+        throw std::runtime_error("Sealed datagram failed authentication");
+    }
+    packet.length = static_cast<uint32_t>(plaintext_size);
+    return packet;
+}
+
+bool SecureSession::decrypt(const uint8_t* nonce, const uint8_t* header, const uint8_t* ciphertext, size_t length,
+                            uint8_t* out) {
+    int written = 0;
+    return EVP_DecryptInit_ex(receive_ctx_, nullptr, nullptr, nullptr, nonce) == 1 &&
+           EVP_DecryptUpdate(receive_ctx_, nullptr, &written, header, static_cast<int>(PACKET_HEADER_SIZE)) == 1 &&
+           EVP_DecryptUpdate(receive_ctx_, out, &written, ciphertext, static_cast<int>(length)) == 1 &&
+           EVP_CIPHER_CTX_ctrl(receive_ctx_, EVP_CTRL_AEAD_SET_TAG, TAG_SIZE,
+                               const_cast<uint8_t*>(ciphertext + length)) == 1 &&
+           EVP_DecryptFinal_ex(receive_ctx_, out + written, &written) == 1;
+}
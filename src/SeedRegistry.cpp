@@ -0,0 +1,128 @@
+#include "SeedRegistry.h"
+#include <algorithm>
+
+namespace {
+
+bool addressLess(const PeerAddress& a, const PeerAddress& b) {
+    if (a.address != b.address) {
+        return a.address < b.address;
+    }
+    return a.port < b.port;
+}
+
+}
+
+SeedRegistry::SeedRegistry() : rng_(std::random_device()()) {}
+
+SeedRegistry::Shard& SeedRegistry::shardFor(const PeerAddress& address) {
+    return shards_[PeerAddressHash()(address) % SHARD_COUNT];
+}
+
+void SeedRegistry::touch(const PeerAddress& address, Clock::time_point now) {
+    Shard& shard = shardFor(address);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.last_seen.insert_or_assign(address, now).second) {
+        ++version_;
+    }
+}
+
+void SeedRegistry::remove(const PeerAddress& address) {
+    Shard& shard = shardFor(address);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.last_seen.erase(address) > 0) {
+        ++version_;
+    }
+}
+
+size_t SeedRegistry::expire(Clock::time_point now) {
+    size_t expired = 0;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.last_seen.begin(); it != shard.last_seen.end();) {
+            if (now - it->second >= LIVENESS_TIMEOUT) {
+                it = shard.last_seen.erase(it);
+                ++expired;
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (expired > 0) {
+        ++version_;
+    }
+    return expired;
+}
+
+size_t SeedRegistry::size() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.last_seen.size();
+    }
+    return total;
+}
+
+std::vector<PeerAddress> SeedRegistry::snapshot() const {
+    std::vector<PeerAddress> entries;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : shard.last_seen) {
+            entries.push_back(entry.first);
+        }
+    }
+    return entries;
+}
+
+SeedRegistry::ResponsePtr SeedRegistry::buildResponse(std::vector<PeerAddress> entries) const {
+    auto response = std::make_shared<Response>();
+    PeerExchange exchange;
+    exchange.added = entries;
+    response->packet = exchange.toPacket();
+    response->frame = serializePacket(response->packet);
+    std::sort(entries.begin(), entries.end(), addressLess);
+    response->entries = std::move(entries);
+    return response;
+}
+
+// Caller holds responses_mutex_. Each variant is a partial Fisher-Yates
+// shuffle of the same snapshot.
+void SeedRegistry::rebuildResponses(Clock::time_point now) {
+    responses_version_ = version_.load();
+    responses_built_ = now;
+    std::vector<PeerAddress> live = snapshot();
+    size_t count = std::min(live.size(), PeerExchange::MAX_ENTRIES);
+    responses_.clear();
+    for (size_t variant = 0; variant < RESPONSE_VARIANTS; ++variant) {
+        for (size_t i = 0; i < count; ++i) {
+            std::uniform_int_distribution<size_t> pick(i, live.size() - 1);
+            std::swap(live[i], live[pick(rng_)]);
+        }
+        responses_.push_back(buildResponse(std::vector<PeerAddress>(live.begin(), live.begin() + count)));
+    }
+}
+
+// A variant that happens to list the requester is passed over for the
+// next one. Only when every variant lists it, as in a registry small
+// enough that each variant holds all of it, is an answer built to order.
+SeedRegistry::ResponsePtr SeedRegistry::responseFor(const PeerAddress& requester, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(responses_mutex_);
+    if (responses_.empty() ||
+        (version_.load() != responses_version_ && now - responses_built_ >= MIN_REBUILD_INTERVAL)) {
+        rebuildResponses(now);
+    }
+    size_t start = std::uniform_int_distribution<size_t>(0, responses_.size() - 1)(rng_);
+    for (size_t i = 0; i < responses_.size(); ++i) {
+        const ResponsePtr& response = responses_[(start + i) % responses_.size()];
+        if (!std::binary_search(response->entries.begin(), response->entries.end(), requester, addressLess)) {
+            return response;
+        }
+    }
+
+    std::vector<PeerAddress> live = snapshot();
+    live.erase(std::remove(live.begin(), live.end(), requester), live.end());
+    std::shuffle(live.begin(), live.end(), rng_);
+    if (live.size() > PeerExchange::MAX_ENTRIES) {
+        live.resize(PeerExchange::MAX_ENTRIES);
+    }
+    return buildResponse(std::move(live));
+}
@@ -0,0 +1,83 @@
+#include "SendScheduler.h"
+#include <algorithm>
+
+SendScheduler::SendScheduler() {
+    queues_[static_cast<size_t>(SendClass::Control)].quantum = CONTROL_QUANTUM;
+    queues_[static_cast<size_t>(SendClass::Interactive)].quantum = INTERACTIVE_QUANTUM;
+    queues_[static_cast<size_t>(SendClass::Bulk)].quantum = BULK_QUANTUM;
+}
+
+// Anything too large for one fragment is bulk whatever its type, so only
+// the bulk queue ever fragments and fragments of two frames never mix.
+SendClass SendScheduler::classify(const EncodedFrame& frame) {
+    if (frame.payload.size() > FRAGMENT_SIZE) {
+        return SendClass::Bulk;
+    }
+    return frame.type == PacketType::Data ? SendClass::Interactive : SendClass::Control;
+}
+
+void SendScheduler::push(FramePtr frame, uint32_t sequence, bool front) {
+    Queue& queue = queues_[static_cast<size_t>(classify(*frame))];
+    queue.bytes += frame->payload.size();
+    Pending pending{std::move(frame), sequence, 0};
+    if (front) {
+        // A frame already partly written keeps its place, or its fragments
+        // would be interleaved with the new frame's
+        auto at = queue.frames.begin();
+        if (at != queue.frames.end() && at->offset != 0) {
+            ++at;
+        }
+        queue.frames.insert(at, std::move(pending));
+    } else {
+        queue.frames.push_back(std::move(pending));
+    }
+}
+
+bool SendScheduler::next(Piece& piece) {
+    if (empty()) {
+        return false;
+    }
+    // Terminates because every pass over a non-empty queue adds its quantum
+    for (;;) {
+        Queue& queue = queues_[current_];
+        if (queue.frames.empty()) {
+            queue.deficit = 0;
+        } else {
+            if (!topped_up_) {
+                queue.deficit += queue.quantum;
+                topped_up_ = true;
+            }
+            Pending& head = queue.frames.front();
+            size_t remaining = head.frame->payload.size() - head.offset;
+            bool fragmented = current_ == static_cast<size_t>(SendClass::Bulk);
+            size_t length = fragmented ? std::min(remaining, FRAGMENT_SIZE) : remaining;
+            if (queue.deficit >= length) {
+                queue.deficit -= length;
+                queue.bytes -= length;
+                piece.frame = head.frame;
+                piece.sequence = head.sequence;
+                piece.offset = head.offset;
+                piece.length = length;
+                piece.flags = 0;
+                if (fragmented) {
+                    piece.flags = PACKET_FLAG_FRAGMENT;
+                    if (length == remaining) {
+                        piece.flags |= PACKET_FLAG_LAST_FRAGMENT;
+                    }
+                }
+                head.offset += length;
+                if (head.offset == head.frame->payload.size()) {
+                    queue.frames.pop_front();
+                }
+                return true;
+            }
+        }
+        current_ = (current_ + 1) % queues_.size();
+        topped_up_ = false;
+    }
+}
+
+bool SendScheduler::empty() const {
+    return std::all_of(queues_.begin(), queues_.end(),
+                       [](const Queue& queue) { return queue.frames.empty(); });
+}
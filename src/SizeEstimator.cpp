@@ -0,0 +1,118 @@
+#include "SizeEstimator.h"
+#include "Packet.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// splitmix64 finaliser, so ids that are not uniformly random still spread
+// evenly over the registers
+uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+}
+
+void HyperLogLog::add(uint64_t hash) {
+    hash = mix(hash);
+    size_t index = hash >> (64 - PRECISION);
+    uint64_t rest = hash << PRECISION;
+    // Position of the first set bit in the remaining 54 bits, capped at 55
+    uint8_t rank = 1;
+    while (rank <= 64 - PRECISION && !(rest & (uint64_t(1) << 63))) {
+        rest <<= 1;
+        ++rank;
+    }
+    registers_[index] = std::max(registers_[index], std::min(rank, MAX_RANK));
+}
+
+void HyperLogLog::merge(const HyperLogLog& other) {
+    for (size_t i = 0; i < REGISTERS; ++i) {
+        registers_[i] = std::max(registers_[i], other.registers_[i]);
+    }
+}
+
+double HyperLogLog::estimate() const {
+    const double m = static_cast<double>(REGISTERS);
+    const double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double sum = 0;
+    size_t zeros = 0;
+    for (uint8_t value : registers_) {
+        sum += std::ldexp(1.0, -static_cast<int>(value));
+        if (value == 0) {
+            ++zeros;
+        }
+    }
+    double raw = alpha * m * m / sum;
+    // Linear counting is far more accurate while many registers are empty
+    if (raw <= 2.5 * m && zeros > 0) {
+        return m * std::log(m / static_cast<double>(zeros));
+    }
+    return raw;
+}
+
+HyperLogLog HyperLogLog::fromRegisters(const uint8_t* data) {
+    HyperLogLog sketch;
+    for (size_t i = 0; i < REGISTERS; ++i) {
+        sketch.registers_[i] = std::min(data[i], MAX_RANK);
+    }
+    return sketch;
+}
+
+void SizeSketch::appendTo(std::vector<uint8_t>& out) const {
+    appendUint32(out, epoch);
+    out.insert(out.end(), sketch.registers().begin(), sketch.registers().end());
+}
+
+SizeSketch SizeSketch::read(const uint8_t* data) {
+    return SizeSketch{readUint32(data, 0), HyperLogLog::fromRegisters(data + 4)};
+}
+
+void SizeEstimator::setNodeId(uint64_t node_id) {
+    node_id_ = node_id;
+    current_.clear();
+    previous_.clear();
+    current_.add(node_id_);
+    merges_ = 0;
+}
+
+void SizeEstimator::advance(uint32_t epoch) {
+    if (epoch <= epoch_) {
+        return;
+    }
+    if (epoch == epoch_ + 1) {
+        previous_ = current_;
+    } else {
+        previous_.clear();
+    }
+    epoch_ = epoch;
+    current_.clear();
+    current_.add(node_id_);
+}
+
+// A sender's epoch is only trusted as far as our own clock agrees, so one
+// claiming a far later epoch cannot roll ours forward and have every honest
+// sketch after it discarded as too old
+bool SizeEstimator::merge(const SizeSketch& remote, uint32_t now) {
+    advance(now);
+    if (remote.epoch > epoch_ + 1) {
+        return false;
+    }
+    advance(remote.epoch);
+    if (remote.epoch == epoch_) {
+        current_.merge(remote.sketch);
+    } else if (remote.epoch + 1 == epoch_) {
+        previous_.merge(remote.sketch);
+    } else {
+        return false;  // Too old to say anything about who is still around
+    }
+    ++merges_;
+    return true;
+}
+
+double SizeEstimator::estimate() const {
+    return std::min(MAX_ESTIMATE, std::max(current_.estimate(), previous_.estimate()));
+}
@@ -0,0 +1,344 @@
+#include "Swarm.h"
+#include <algorithm>
+#include <stdexcept>
+
+Packet PieceHave::toPacket() const {
+    std::vector<uint8_t> payload(meme.bytes.begin(), meme.bytes.end());
+    appendUint16(payload, static_cast<uint16_t>(pieces.size()));
+    payload.resize(payload.size() + (pieces.size() + 7) / 8, 0);
+    uint8_t* bits = payload.data() + MessageId::SIZE + 2;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        if (pieces[i]) {
+            bits[i / 8] |= static_cast<uint8_t>(0x80 >> (i % 8));
+        }
+    }
+    return createPacket(PacketType::Have, std::move(payload), 0);
+}
+
+PieceHave PieceHave::fromPacket(const Packet& packet) {
+    const std::vector<uint8_t>& data = packet.payload;
+    if (packet.type != PacketType::Have || data.size() < MessageId::SIZE + 2) {
+        throw std::runtime_error("Invalid piece announcement");
+    }
+    size_t count = readUint16(data.data(), MessageId::SIZE);
+    if (count == 0 || count > Message::MAX_CHUNKS || data.size() != MessageId::SIZE + 2 + (count + 7) / 8) {
+        throw std::runtime_error("Invalid piece announcement");
+    }
+    PieceHave have;
+    have.meme = MessageId::fromBytes(data.data());
+    have.pieces.resize(count);
+    const uint8_t* bits = data.data() + MessageId::SIZE + 2;
+    for (size_t i = 0; i < count; ++i) {
+        have.pieces[i] = (bits[i / 8] & (0x80 >> (i % 8))) != 0;
+    }
+    return have;
+}
+
+Packet PieceRequest::toPacket() const {
+    std::vector<uint8_t> payload(meme.bytes.begin(), meme.bytes.end());
+    appendUint32(payload, index);
+    return createPacket(PacketType::PieceRequest, std::move(payload), 0);
+}
+
+PieceRequest PieceRequest::fromPacket(const Packet& packet) {
+    if (packet.type != PacketType::PieceRequest || packet.payload.size() != MessageId::SIZE + 4) {
+        throw std::runtime_error("Invalid piece request");
+    }
+    PieceRequest request;
+    request.meme = MessageId::fromBytes(packet.payload.data());
+    request.index = readUint32(packet.payload.data(), MessageId::SIZE);
+    return request;
+}
+
+Swarm::Swarm() : rng_(std::random_device()()) {}
+
+// The oldest meme gives way when too many are tracked
+Swarm::Meme& Swarm::track(const MessageId& id, size_t pieces) {
+    auto inserted = memes_.emplace(id, Meme{});
+    Meme& meme = inserted.first->second;
+    if (!inserted.second) {
+        return meme;
+    }
+    meme.pieces = pieces;
+    meme.missing = pieces;
+    meme.unrequested = pieces;
+    meme.have.assign(pieces, false);
+    meme.availability.assign(pieces, 0);
+    meme.requested.resize(pieces);
+    order_.push_back(id);
+
+    while (order_.size() > MAX_MEMES) {
+        Meme& old = memes_.at(order_.front());
+        for (const auto& requests : old.requested) {
+            for (const auto& request : requests) {
+                --peers_[request.peer].in_flight;
+            }
+        }
+        memes_.erase(order_.front());
+        order_.pop_front();
+    }
+    return meme;
+}
+
+void Swarm::add(const MessageId& id, size_t pieces, bool download) {
+    Meme& meme = track(id, pieces);
+    meme.download = download && meme.missing > 0;
+    for (auto it = unknown_haves_.begin(); it != unknown_haves_.end();) {
+        auto& haves = it->second;
+        auto have = std::find_if(haves.begin(), haves.end(), [&id](const PieceHave& h) { return h.meme == id; });
+        if (have != haves.end()) {
+            applyHave(meme, it->first, have->pieces);
+            haves.erase(have);
+        }
+        it = haves.empty() ? unknown_haves_.erase(it) : std::next(it);
+    }
+}
+
+void Swarm::received(const MessageId& id, uint32_t index, const PeerPtr& from, Clock::time_point now) {
+    auto it = memes_.find(id);
+    if (it == memes_.end() || index >= it->second.pieces || it->second.have[index]) {
+        return;
+    }
+    Meme& meme = it->second;
+    auto& requests = meme.requested[index];
+    if (requests.empty()) {
+        --meme.unrequested;
+    }
+    for (const auto& request : requests) {
+        PeerState& state = peers_[request.peer];
+        --state.in_flight;
+        // Smoothed like TCP's srtt; includes the time to send the chunk
+        if (request.peer == from) {
+            state.rtt = (7 * state.rtt + (now - request.sent)) / 8;
+        }
+    }
+    requests.clear();
+    meme.have[index] = true;
+    if (--meme.missing == 0) {
+        meme.download = false;
+    }
+}
+
+void Swarm::stop(const MessageId& id) {
+    auto it = memes_.find(id);
+    if (it == memes_.end()) {
+        return;
+    }
+    Meme& meme = it->second;
+    meme.download = false;
+    for (uint32_t i = 0; i < meme.pieces; ++i) {
+        while (!meme.requested[i].empty()) {
+            withdraw(meme, i, meme.requested[i].front().peer);
+        }
+    }
+}
+
+// Announcements are merged rather than replaced, so one overtaken by a
+// later one cannot take pieces away
+void Swarm::setHolder(const PeerPtr& peer, const PieceHave& have) {
+    auto it = memes_.find(have.meme);
+    if (it != memes_.end()) {
+        applyHave(it->second, peer, have.pieces);
+        return;
+    }
+    auto& haves = unknown_haves_[peer];
+    auto earlier = std::find_if(haves.begin(), haves.end(),
+                                [&have](const PieceHave& h) { return h.meme == have.meme; });
+    if (earlier != haves.end() && earlier->pieces.size() == have.pieces.size()) {
+        for (size_t i = 0; i < have.pieces.size(); ++i) {
+            earlier->pieces[i] = earlier->pieces[i] || have.pieces[i];
+        }
+        return;
+    }
+    if (earlier != haves.end()) {
+        haves.erase(earlier);
+    }
+    haves.push_back(have);
+    if (haves.size() > MAX_UNKNOWN_HAVES) {
+        haves.pop_front();
+    }
+}
+
+void Swarm::applyHave(Meme& meme, const PeerPtr& peer, const std::vector<bool>& pieces) {
+    if (pieces.size() != meme.pieces) {
+        return;
+    }
+    std::vector<bool>& held = meme.holders[peer];
+    held.resize(meme.pieces, false);
+    for (size_t i = 0; i < meme.pieces; ++i) {
+        if (pieces[i] && !held[i]) {
+            held[i] = true;
+            ++meme.availability[i];
+        }
+    }
+    auto state = peers_.emplace(peer, PeerState{});
+    if (state.second) {
+        state.first->second.order = peers_seen_++;
+    }
+}
+
+void Swarm::removePeer(const PeerPtr& peer) {
+    for (auto& entry : memes_) {
+        Meme& meme = entry.second;
+        auto held = meme.holders.find(peer);
+        if (held != meme.holders.end()) {
+            for (size_t i = 0; i < meme.pieces; ++i) {
+                if (held->second[i]) {
+                    --meme.availability[i];
+                }
+            }
+            meme.holders.erase(held);
+        }
+        for (uint32_t i = 0; i < meme.pieces; ++i) {
+            withdraw(meme, i, peer);
+        }
+    }
+    peers_.erase(peer);
+    unknown_haves_.erase(peer);
+}
+
+Swarm::Clock::duration Swarm::timeoutFor(const PeerState& state) const {
+    return std::max<Clock::duration>(MIN_REQUEST_TIMEOUT, TIMEOUT_RTTS * state.rtt);
+}
+
+void Swarm::withdraw(Meme& meme, uint32_t index, const PeerPtr& peer) {
+    auto& requests = meme.requested[index];
+    auto it = std::find_if(requests.begin(), requests.end(),
+                           [&peer](const Outstanding& request) { return request.peer == peer; });
+    if (it == requests.end()) {
+        return;
+    }
+    requests.erase(it);
+    --peers_[peer].in_flight;
+    if (requests.empty() && !meme.have[index]) {
+        ++meme.unrequested;
+    }
+}
+
+// A neighbour that let a request time out is treated as at least that slow,
+// so it is asked later and given longer next time
+void Swarm::expire(Clock::time_point now) {
+    for (auto& entry : memes_) {
+        Meme& meme = entry.second;
+        if (!meme.download) {
+            continue;
+        }
+        for (uint32_t i = 0; i < meme.pieces; ++i) {
+            for (size_t r = 0; r < meme.requested[i].size();) {
+                Outstanding request = meme.requested[i][r];
+                PeerState& state = peers_[request.peer];
+                if (now - request.sent <= timeoutFor(state)) {
+                    ++r;
+                    continue;
+                }
+                state.rtt = std::max(state.rtt, now - request.sent);
+                withdraw(meme, i, request.peer);
+            }
+        }
+    }
+}
+
+std::vector<Swarm::Request> Swarm::pick(Clock::time_point now) {
+    expire(now);
+    std::vector<std::pair<std::pair<Clock::duration, uint64_t>, PeerPtr>> ready;
+    for (const auto& entry : peers_) {
+        if (entry.second.in_flight < REQUESTS_PER_PEER) {
+            ready.push_back({{entry.second.rtt, entry.second.order}, entry.first});
+        }
+    }
+    std::sort(ready.begin(), ready.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    // One piece per neighbour per pass, so slots fill evenly
+    std::vector<Request> requests;
+    for (bool progress = true; progress;) {
+        progress = false;
+        for (const auto& entry : ready) {
+            if (peers_[entry.second].in_flight < REQUESTS_PER_PEER && pickFor(entry.second, now, requests)) {
+                progress = true;
+            }
+        }
+    }
+    return requests;
+}
+
+bool Swarm::pickFor(const PeerPtr& peer, Clock::time_point now, std::vector<Request>& requests) {
+    for (const auto& id : order_) {
+        Meme& meme = memes_.at(id);
+        auto held = meme.holders.find(peer);
+        if (!meme.download || held == meme.holders.end()) {
+            continue;
+        }
+        bool endgame = meme.unrequested == 0;
+        size_t best = meme.pieces;
+        size_t ties = 0;
+        for (size_t i = 0; i < meme.pieces; ++i) {
+            const auto& outstanding = meme.requested[i];
+            if (meme.have[i] || !held->second[i]) {
+                continue;
+            }
+            if (!endgame && !outstanding.empty()) {
+                continue;
+            }
+            if (endgame && (outstanding.size() >= ENDGAME_REQUESTS ||
+                            std::any_of(outstanding.begin(), outstanding.end(),
+                                        [&peer](const Outstanding& request) { return request.peer == peer; }))) {
+                continue;
+            }
+            // Fewest requests first, which only differs in endgame, then rarest
+            if (best != meme.pieces) {
+                auto key = [&meme](size_t piece) {
+                    return std::make_pair(meme.requested[piece].size(), meme.availability[piece]);
+                };
+                if (key(i) > key(best)) {
+                    continue;
+                }
+                if (key(i) < key(best)) {
+                    ties = 0;
+                }
+            }
+            if (std::uniform_int_distribution<size_t>(0, ties++)(rng_) == 0) {
+                best = i;
+            }
+        }
+        if (best == meme.pieces) {
+            continue;
+        }
+        if (meme.requested[best].empty()) {
+            --meme.unrequested;
+        }
+        meme.requested[best].push_back({peer, now});
+        ++peers_[peer].in_flight;
+        requests.push_back({peer, id, static_cast<uint32_t>(best)});
+        return true;
+    }
+    return false;
+}
+
+bool Swarm::downloading() const {
+    return std::any_of(memes_.begin(), memes_.end(),
+                       [](const auto& entry) { return entry.second.download; });
+}
+
+size_t Swarm::memoryUsage() const {
+    size_t bytes = peers_.size() * sizeof(std::pair<const PeerPtr, PeerState>) +
+                   order_.size() * sizeof(MessageId);
+    for (const auto& entry : unknown_haves_) {
+        for (const auto& have : entry.second) {
+            bytes += sizeof(have) + have.pieces.capacity() / 8;
+        }
+    }
+    for (const auto& entry : memes_) {
+        const Meme& meme = entry.second;
+        bytes += sizeof(entry) + meme.have.capacity() / 8 + meme.availability.capacity() * sizeof(uint16_t) +
+                 meme.requested.capacity() * sizeof(std::vector<Outstanding>);
+        for (const auto& holder : meme.holders) {
+            bytes += sizeof(holder) + holder.second.capacity() / 8;
+        }
+        for (const auto& requests : meme.requested) {
+            bytes += requests.capacity() * sizeof(Outstanding);
+        }
+    }
+    return bytes;
+}
+
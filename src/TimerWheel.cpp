@@ -0,0 +1,161 @@
+#include "TimerWheel.h"
+#include <algorithm>
+
+boost::asio::execution_context::id TimerWheel::id;
+
+TimerWheel::TimerWheel(boost::asio::execution_context& context)
+    : boost::asio::execution_context::service(context),
+      timer_(static_cast<boost::asio::io_context&>(context)),
+      start_(Clock::now()) {}
+
+// Owners of armed timers may be destroyed after the io_context, so their
+// timers are detached here and will not reach back into the wheel
+void TimerWheel::shutdown() {
+    for (auto& level : slots_) {
+        for (auto& head : level) {
+            while (head) {
+                Timer* timer = head;
+                head = timer->next_;
+                timer->slot_ = nullptr;
+                timer->prev_ = timer->next_ = nullptr;
+                timer->wheel_ = nullptr;
+            }
+        }
+    }
+    count_ = 0;
+    boost::system::error_code ignored;
+    timer_.cancel(ignored);
+}
+
+uint64_t TimerWheel::tickAt(Clock::time_point when) const {
+    return static_cast<uint64_t>((when - start_) / TICK);
+}
+
+// Delays are rounded up to whole ticks and clamped to the wheel's range
+void TimerWheel::schedule(Timer& timer, Clock::duration delay) {
+    if (timer.slot_) {
+        unlink(timer);
+    }
+    uint64_t now_tick = tickAt(Clock::now());
+    if (count_ == 0) {
+        // Nothing is pending, so the idle gap need not be replayed tick by tick
+        current_tick_ = std::max(current_tick_, now_tick);
+    }
+    constexpr uint64_t MAX_TICKS = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    uint64_t ticks = static_cast<uint64_t>((std::max(delay, Clock::duration::zero()) + TICK - Clock::duration(1)) / TICK);
+    uint64_t base = std::max(current_tick_, now_tick);
+    timer.expiry_ = base + std::max<uint64_t>(1, ticks);
+    timer.expiry_ = std::min(timer.expiry_, current_tick_ + MAX_TICKS);
+    insert(timer);
+    if (!waiting_ || timer.expiry_ < wake_tick_) {
+        rearm();
+    }
+}
+
+// A timer goes in the lowest level whose span covers its distance from the
+// current tick, in the slot its expiry bits select at that level
+void TimerWheel::insert(Timer& timer) {
+    uint64_t expiry = std::max(timer.expiry_, current_tick_);
+    uint64_t delta = expiry - current_tick_;
+    size_t level = 0;
+    while (level + 1 < LEVELS && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    Timer*& head = slots_[level][(expiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    timer.slot_ = &head;
+    timer.prev_ = nullptr;
+    timer.next_ = head;
+    if (head) {
+        head->prev_ = &timer;
+    }
+    head = &timer;
+    ++count_;
+}
+
+void TimerWheel::unlink(Timer& timer) {
+    if (timer.prev_) {
+        timer.prev_->next_ = timer.next_;
+    } else {
+        *timer.slot_ = timer.next_;
+    }
+    if (timer.next_) {
+        timer.next_->prev_ = timer.prev_;
+    }
+    timer.slot_ = nullptr;
+    timer.prev_ = timer.next_ = nullptr;
+    --count_;
+}
+
+// Re-files every timer in the level's current slot, which now falls within
+// reach of the level below
+void TimerWheel::cascade(size_t level) {
+    Timer*& head = slots_[level][(current_tick_ >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    Timer* list = head;
+    head = nullptr;
+    while (list) {
+        Timer* timer = list;
+        list = timer->next_;
+        timer->slot_ = nullptr;
+        --count_;
+        insert(*timer);
+    }
+}
+
+// Each timer is unlinked before its callback runs, and the slot head is
+// re-read after every callback, so callbacks may arm, cancel or destroy
+// any timer, including their own.
+void TimerWheel::advance() {
+    uint64_t target = tickAt(Clock::now());
+    while (current_tick_ < target) {
+        ++current_tick_;
+        for (size_t level = 1; level < LEVELS; ++level) {
+            if ((current_tick_ & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            cascade(level);
+        }
+        Timer*& head = slots_[0][current_tick_ & (SLOTS - 1)];
+        while (head) {
+            Timer* timer = head;
+            unlink(*timer);
+            ++fired_;
+            if (timer->callback_) {
+                timer->callback_();
+            }
+        }
+    }
+}
+
+// Sleeps until the next level-0 slot holding a timer, or until level 0
+// wraps, whichever is first; a wrap may cascade timers into level 0
+void TimerWheel::rearm() {
+    if (count_ == 0) {
+        if (waiting_) {
+            boost::system::error_code ignored;
+            timer_.cancel(ignored);
+            waiting_ = false;
+        }
+        return;
+    }
+    uint64_t next = (current_tick_ | (SLOTS - 1)) + 1;
+    for (uint64_t tick = current_tick_ + 1; tick < next; ++tick) {
+        if (slots_[0][tick & (SLOTS - 1)]) {
+            next = tick;
+            break;
+        }
+    }
+    if (waiting_ && wake_tick_ == next) {
+        return;
+    }
+    wake_tick_ = next;
+    waiting_ = true;
+    timer_.expires_at(start_ + static_cast<Clock::duration::rep>(next) * TICK);
+    timer_.async_wait(makeCustomAllocHandler(handler_memory_, [this](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        waiting_ = false;
+        advance();
+        rearm();
+    }));
+}
@@ -0,0 +1,155 @@
+#include "Tracing.h"
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+// Clocks on different nodes disagree, so a stage can appear to end before
+// it began; it is drawn as instant instead
+uint64_t elapsed(uint64_t from, uint64_t to) {
+    return to > from ? to - from : 0;
+}
+
+std::string nodeName(uint64_t node) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "node %016" PRIx64, node);
+    return text;
+}
+
+void writeSlice(std::ostream& out, bool& first, const char* name, size_t pid, size_t tid, uint64_t ts,
+                uint64_t dur, const std::string& args) {
+    char text[160];
+    std::snprintf(text, sizeof(text),
+                  "%s\n{\"name\":\"%s\",\"cat\":\"hop\",\"ph\":\"X\",\"pid\":%zu,\"tid\":%zu,"
+                  "\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"args\":{",
+                  first ? "" : ",", name, pid, tid, ts, dur);
+    out << text << args << "}}";
+    first = false;
+}
+
+// Half of an arrow: "s" binds to the slice enclosing ts, "f" to the next
+// slice beginning at or after it
+void writeFlow(std::ostream& out, bool& first, char phase, size_t id, size_t pid, size_t tid, uint64_t ts) {
+    char text[160];
+    std::snprintf(text, sizeof(text),
+                  "%s\n{\"name\":\"forward\",\"cat\":\"hop\",\"ph\":\"%c\",\"id\":%zu,\"pid\":%zu,"
+                  "\"tid\":%zu,\"ts\":%" PRIu64 "}",
+                  first ? "" : ",", phase, id, pid, tid, ts);
+    out << text;
+    first = false;
+}
+
+}
+
+uint64_t traceClockNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void TraceCollector::record(const MessageId& message, const MessageTrace& trace) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto inserted = traces_.emplace(trace.id, Trace{});
+    Trace& merged = inserted.first->second;
+    if (inserted.second) {
+        merged.message = message;
+        order_.push_back(trace.id);
+        while (order_.size() > MAX_TRACES) {
+            traces_.erase(order_.front());
+            order_.pop_front();
+        }
+    }
+    // A hop already known came from an earlier copy of the same path
+    for (size_t i = 0; i < trace.hops.size(); ++i) {
+        Hop hop{trace.hops[i], i > 0, i > 0 ? trace.hops[i - 1].node : 0};
+        merged.hops.emplace(trace.hops[i].node, hop);
+    }
+}
+
+size_t TraceCollector::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return traces_.size();
+}
+
+TraceCollector::Breakdown TraceCollector::breakdown() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Breakdown result;
+    for (const auto& entry : traces_) {
+        const auto& hops = entry.second.hops;
+        for (const auto& node : hops) {
+            const Hop& hop = node.second;
+            auto previous = hops.find(hop.previous);
+            if (!hop.has_previous || previous == hops.end()) {
+                continue;
+            }
+            ++result.hops;
+            result.wire_us += elapsed(previous->second.hop.forwarded_us, hop.hop.received_us);
+            result.parse_us += elapsed(hop.hop.received_us, hop.hop.dequeued_us);
+            result.handle_us += elapsed(hop.hop.dequeued_us, hop.hop.forwarded_us);
+        }
+    }
+    if (result.hops > 0) {
+        result.wire_us /= result.hops;
+        result.parse_us /= result.hops;
+        result.handle_us /= result.hops;
+    }
+    return result;
+}
+
+// Each node is a process and each trace a thread within it, so the traces
+// passing through one node stack instead of overlapping
+void TraceCollector::writeChromeTrace(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<uint64_t, size_t> pids;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto pidFor = [&](uint64_t node) {
+        auto pid = pids.emplace(node, pids.size() + 1);
+        if (pid.second) {
+            out << (first ? "" : ",") << "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid.first->second
+                << ",\"args\":{\"name\":\"" << nodeName(node) << "\"}}";
+            first = false;
+        }
+        return pid.first->second;
+    };
+    size_t tid = 0;
+    size_t flows = 0;
+    for (uint64_t id : order_) {
+        const Trace& trace = traces_.at(id);
+        ++tid;
+        std::string message = "\"message\":\"" + trace.message.toHex() + "\"";
+        for (const auto& node : trace.hops) {
+            const Hop& hop = node.second;
+            size_t pid = pidFor(node.first);
+            auto previous = trace.hops.find(hop.previous);
+            if (hop.has_previous && previous != trace.hops.end()) {
+                const TraceHop& from = previous->second.hop;
+                uint64_t sent = from.forwarded_us;
+                writeSlice(out, first, "queue+wire", pid, tid, sent, elapsed(sent, hop.hop.received_us),
+                           message + ",\"from\":\"" + nodeName(hop.previous) + "\"");
+                writeSlice(out, first, "parse", pid, tid, hop.hop.received_us,
+                           elapsed(hop.hop.received_us, hop.hop.dequeued_us), message);
+                // Starts inside the slice that forwarded it, ends on queue+wire
+                ++flows;
+                writeFlow(out, first, 's', flows, pidFor(hop.previous), tid,
+                          from.dequeued_us + elapsed(from.dequeued_us, sent) / 2);
+                writeFlow(out, first, 'f', flows, pid, tid, sent);
+            }
+            writeSlice(out, first, hop.has_previous ? "handle" : "send", pid, tid,
+                       hop.hop.dequeued_us, elapsed(hop.hop.dequeued_us, hop.hop.forwarded_us), message);
+        }
+    }
+    out << "\n]}\n";
+}
+
+void TraceCollector::exportChromeTrace(const std::string& path) const {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Failed to open trace file " + path);
+    }
+    writeChromeTrace(file);
+    if (!file.flush()) {
+        throw std::runtime_error("Failed to write trace file " + path);
+    }
+}
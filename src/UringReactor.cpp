@@ -0,0 +1,392 @@
+#include "UringReactor.h"
+#include "Debug.h"
+#include "HandlerAllocator.h"
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+boost::asio::execution_context::id UringReactor::id;
+
+namespace {
+
+std::string errorText(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+void* mapOrThrow(size_t size, int fd, off_t offset, const std::string& what) {
+    int flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE;
+    void* map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error(errorText("Failed to map " + what));
+    }
+    return map;
+}
+
+}
+
+UringReactor::UringReactor(boost::asio::execution_context& context)
+    : boost::asio::execution_context::service(context),
+      event_(static_cast<boost::asio::io_context&>(context)) {
+    try {
+        io_uring_params params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = RING_ENTRIES * 4;  // Multishot requests complete many times each
+        ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+        if (ring_fd_ < 0) {
+            throw std::runtime_error(errorText("io_uring_setup failed"));
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            throw std::runtime_error("io_uring on this kernel is too old");
+        }
+
+        ring_map_size_ = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                          params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        ring_map_ = mapOrThrow(ring_map_size_, ring_fd_, IORING_OFF_SQ_RING, "io_uring rings");
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mapOrThrow(sqes_size_, ring_fd_, IORING_OFF_SQES, "io_uring entries"));
+
+        auto* base = static_cast<uint8_t*>(ring_map_);
+        sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+        // Receive buffers are allocated once and then only cycle between
+        // the kernel and us; the kernel picks one as data arrives
+        buffers_ = static_cast<uint8_t*>(mapOrThrow(BUFFER_COUNT * BUFFER_SIZE, -1, 0, "receive buffers"));
+        provideBuffers(0, BUFFER_COUNT);
+        submit();
+
+        event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd_ < 0 || ::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_EVENTFD, &event_fd_, 1) < 0) {
+            throw std::runtime_error(errorText("Failed to register completion eventfd"));
+        }
+        event_.assign(event_fd_);
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+UringReactor::~UringReactor() {
+    release();
+}
+
+void UringReactor::release() {
+    if (ring_fd_ >= 0) {
+        ::close(ring_fd_);  // Cancels whatever the kernel still holds
+        ring_fd_ = -1;
+    }
+    if (ring_map_) {
+        ::munmap(ring_map_, ring_map_size_);
+        ring_map_ = nullptr;
+    }
+    if (sqes_) {
+        ::munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if (buffers_) {
+        ::munmap(buffers_, BUFFER_COUNT * BUFFER_SIZE);
+        buffers_ = nullptr;
+    }
+    // Once assigned, the eventfd belongs to event_
+    if (event_fd_ >= 0 && !event_.is_open()) {
+        ::close(event_fd_);
+    }
+    event_fd_ = -1;
+}
+
+// Receivers may outlive the io_context, so they are detached here
+void UringReactor::shutdown() {
+    for (auto& slot : receives_) {
+        slot.receiver = nullptr;
+    }
+    accepts_.clear();
+    boost::system::error_code ignored;
+    event_.close(ignored);
+    event_fd_ = -1;
+}
+
+UringReactor::Token UringReactor::startReceive(int fd, Receiver* receiver) {
+    uint32_t index;
+    if (!free_receives_.empty()) {
+        index = free_receives_.back();
+        free_receives_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(receives_.size());
+        receives_.emplace_back();
+    }
+    ReceiveSlot& slot = receives_[index];
+    slot.fd = fd;
+    slot.receiver = receiver;
+    armReceive(index);
+    if (!reaping_) {
+        submit();
+    }
+    waitForCompletions();
+    return userData(KIND_RECEIVE, slot.generation, index);
+}
+
+// The kernel's request is cancelled, and the slot is reused only after
+// its final completion, so a late completion never reaches a new owner
+void UringReactor::stopReceive(Token token) {
+    uint32_t index = static_cast<uint32_t>(token);
+    uint32_t generation = static_cast<uint32_t>(token >> 32) & 0x3FFFFFFF;
+    if (index >= receives_.size() || receives_[index].generation != generation || !receives_[index].receiver) {
+        return;
+    }
+    ReceiveSlot& slot = receives_[index];
+    slot.receiver = nullptr;
+    if (!slot.active) {
+        releaseSlot(index);
+        return;
+    }
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = token;
+    sqe->user_data = userData(KIND_IGNORE, 0, 0);
+    if (!reaping_) {
+        submit();
+    }
+}
+
+void UringReactor::startAccept(int listen_fd, AcceptHandler handler) {
+    accepts_.push_back({listen_fd, std::move(handler)});
+    armAccept(static_cast<uint32_t>(accepts_.size() - 1));
+    if (!reaping_) {
+        submit();
+    }
+    waitForCompletions();
+}
+
+void UringReactor::releaseSlot(uint32_t index) {
+    ReceiveSlot& slot = receives_[index];
+    slot.fd = -1;
+    slot.generation = (slot.generation + 1) & 0x3FFFFFFF;
+    free_receives_.push_back(index);
+}
+
+io_uring_sqe* UringReactor::nextSqe() {
+    unsigned tail = *sq_tail_ + sq_pending_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        submit();
+        tail = *sq_tail_ + sq_pending_;
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+    }
+    unsigned index = tail & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_pending_;
+    return sqe;
+}
+
+void UringReactor::submit() {
+    if (sq_pending_ > 0) {
+        __atomic_store_n(sq_tail_, *sq_tail_ + sq_pending_, __ATOMIC_RELEASE);
+        sq_unsubmitted_ += sq_pending_;
+        sq_pending_ = 0;
+    }
+    if (sq_unsubmitted_ == 0) {
+        return;
+    }
+    ++submit_calls_;
+    long submitted = ::syscall(__NR_io_uring_enter, ring_fd_, sq_unsubmitted_, 0, 0, nullptr, 0);
+    if (submitted < 0) {
+        // Left in the ring; the next submit passes them again
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            Debug::log(errorText("io_uring_enter failed"));
+        }
+        return;
+    }
+    sq_unsubmitted_ -= static_cast<unsigned>(submitted);
+}
+
+void UringReactor::armReceive(uint32_t index) {
+    ReceiveSlot& slot = receives_[index];
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = slot.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = userData(KIND_RECEIVE, slot.generation, index);
+    slot.active = true;
+    ++active_requests_;
+}
+
+void UringReactor::armAccept(uint32_t index) {
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = accepts_[index].fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData(KIND_ACCEPT, 0, index);
+    ++active_requests_;
+}
+
+void UringReactor::provideBuffers(uint16_t first, uint16_t count) {
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(first) * BUFFER_SIZE);
+    sqe->len = BUFFER_SIZE;
+    sqe->off = first;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = userData(KIND_BUFFERS, 0, 0);
+}
+
+// Buffers read in one pass go back together, with runs of adjacent ids
+// merged into a single request
+void UringReactor::provideReturnedBuffers() {
+    if (returned_buffers_.empty()) {
+        return;
+    }
+    std::sort(returned_buffers_.begin(), returned_buffers_.end());
+    size_t start = 0;
+    for (size_t i = 1; i <= returned_buffers_.size(); ++i) {
+        if (i == returned_buffers_.size() || returned_buffers_[i] != returned_buffers_[i - 1] + 1) {
+            provideBuffers(returned_buffers_[start], static_cast<uint16_t>(i - start));
+            start = i;
+        }
+    }
+    returned_buffers_.clear();
+}
+
+// The eventfd is drained before the ring is read, so a completion posted
+// while reaping signals it again and wakes us for another pass
+void UringReactor::waitForCompletions() {
+    if (waiting_ || active_requests_ == 0 || !event_.is_open()) {
+        return;
+    }
+    waiting_ = true;
+    event_.async_wait(boost::asio::posix::descriptor_base::wait_read,
+        makeCustomAllocHandler(handler_memory_, [this](const boost::system::error_code& ec) {
+            waiting_ = false;
+            if (ec) {
+                return;
+            }
+            uint64_t count;
+            while (::read(event_fd_, &count, sizeof(count)) < 0 && errno == EINTR) {
+            }
+            reap();
+            waitForCompletions();
+        }));
+}
+
+void UringReactor::reap() {
+    reaping_ = true;
+    unsigned head = *cq_head_;
+    unsigned tail;
+    while ((tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) != head) {
+        while (head != tail) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+            switch (cqe.user_data >> 62) {
+            case KIND_RECEIVE:
+                dispatchReceive(cqe);
+                break;
+            case KIND_ACCEPT:
+                dispatchAccept(cqe);
+                break;
+            case KIND_BUFFERS:
+                if (cqe.res < 0) {
+                    Debug::log("Failed to return receive buffers: " + std::string(std::strerror(-cqe.res)));
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    reaping_ = false;
+    // Starved receives resume behind the buffers just returned
+    provideReturnedBuffers();
+    for (Token token : starved_receives_) {
+        uint32_t index = static_cast<uint32_t>(token);
+        ReceiveSlot& slot = receives_[index];
+        if (slot.generation == ((token >> 32) & 0x3FFFFFFF) && slot.receiver && !slot.active) {
+            armReceive(index);
+        }
+    }
+    starved_receives_.clear();
+    submit();
+}
+
+// A multishot receive ends when the peer closes, on an error, or when the
+// buffer pool ran dry; only the last is resumed. Callbacks may stop or
+// start receives, so the slot is looked up again after each one.
+void UringReactor::dispatchReceive(const io_uring_cqe& cqe) {
+    uint32_t index = static_cast<uint32_t>(cqe.user_data);
+    uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32) & 0x3FFFFFFF;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    bool current = index < receives_.size() && receives_[index].generation == generation;
+    if (!current) {
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            recycle(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        return;
+    }
+    if (!more) {
+        receives_[index].active = false;
+        --active_requests_;
+    }
+
+    Receiver* receiver = receives_[index].receiver;
+    if (receiver) {
+        if (cqe.res > 0) {
+            uint16_t buffer = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            receiver->onReceive(buffers_ + static_cast<size_t>(buffer) * BUFFER_SIZE, static_cast<size_t>(cqe.res));
+        } else if (cqe.res == 0 || (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)) {
+            receiver->onReceiveError(-cqe.res);
+        }
+    }
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        recycle(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+
+    ReceiveSlot& slot = receives_[index];
+    if (slot.active || slot.generation != generation) {
+        return;
+    }
+    if (!slot.receiver) {
+        releaseSlot(index);
+    } else if (cqe.res > 0) {
+        armReceive(index);
+    } else if (cqe.res == -ENOBUFS) {
+        starved_receives_.push_back(cqe.user_data);
+    }
+}
+
+void UringReactor::dispatchAccept(const io_uring_cqe& cqe) {
+    uint32_t index = static_cast<uint32_t>(cqe.user_data);
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        --active_requests_;
+    }
+    if (index >= accepts_.size()) {
+        if (cqe.res >= 0) {
+            ::close(cqe.res);
+        }
+        return;
+    }
+    if (cqe.res >= 0) {
+        accepts_[index].handler(cqe.res);
+    } else if (cqe.res != -ECANCELED) {
+        Debug::log("Accept failed: " + std::string(std::strerror(-cqe.res)));
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE) && index < accepts_.size()) {
+        armAccept(index);
+    }
+}
@@ -0,0 +1,102 @@
+#include "WorkerPool.h"
+#include "Debug.h"
+#include <chrono>
+#include <stdexcept>
+
+WorkerPool::WorkerPool(size_t threads, size_t capacity, Handler handler)
+    : queue_(capacity), handler_(std::move(handler)) {
+    if (threads == 0) {
+        throw std::runtime_error("A worker pool needs at least one thread");
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this]() { run(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        stopping_ = true;
+    }
+    idle_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+// A worker going to sleep raises sleepers_ before its last look at the
+// queue, and submit reads sleepers_ after pushing, so one side always sees
+// the other and a message is never left waiting for a sleeping pool.
+bool WorkerPool::submit(Message msg) {
+    size_t bytes = footprint(msg);
+    size_t budget = byte_budget_.load();
+    if (budget != 0 && queued_bytes_.load() + bytes > budget) {
+        ++dropped_;
+        return false;
+    }
+    queued_bytes_ += bytes;
+    if (!queue_.tryPush(msg)) {
+        queued_bytes_ -= bytes;
+        ++dropped_;
+        return false;
+    }
+    ++submitted_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load() > 0) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        idle_.notify_one();
+    }
+    return true;
+}
+
+WorkerPool::Stats WorkerPool::stats() const {
+    Stats stats;
+    stats.submitted = submitted_.load();
+    stats.delivered = delivered_.load();
+    stats.dropped = dropped_.load();
+    stats.backlog = queue_.sizeApprox();
+    return stats;
+}
+
+size_t WorkerPool::footprint(const Message& msg) {
+    return msg.getContent().size() + msg.getChunkIds().size() * sizeof(MessageId);
+}
+
+size_t WorkerPool::memoryUsage() const {
+    return queue_.capacity() * sizeof(Message) + queued_bytes_.load();
+}
+
+void WorkerPool::run() {
+    std::vector<Message> batch(BATCH_SIZE);
+    for (;;) {
+        size_t count = 0;
+        while (count < BATCH_SIZE && queue_.tryPop(batch[count])) {
+            ++count;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            try {
+                handler_(batch[i]);
+            } catch (const std::exception& e) {
+                Debug::log("Delivery handler failed: " + std::string(e.what()));
+            }
+            queued_bytes_ -= footprint(batch[i]);
+            batch[i] = Message();
+        }
+        delivered_ += count;
+        if (count > 0) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        ++sleepers_;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (queue_.sizeApprox() == 0) {
+            if (stopping_) {
+                --sleepers_;
+                return;
+            }
+            idle_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        --sleepers_;
+    }
+}
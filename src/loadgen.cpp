@@ -0,0 +1,549 @@
+// Load generator for nodes that speak the TeleLibre wire protocol.
+//
+// Opens many concurrent connections to one endpoint, typically a local
+// seed_node, and drives them with either PeerRequest round trips or
+// sequenced Data frames of a chosen size. Open loop sends on a fixed
+// schedule whatever the server does; closed loop keeps a fixed number of
+// requests outstanding per connection. Latency is measured from when a
+// request was due to be sent, not from when it actually went out, so a
+// server that stalls is charged for the requests it held back
+// (coordinated-omission correction). For the same reason requests still
+// unanswered when the run stops are counted at the latency they had
+// reached by then, and a closed-loop request unanswered after --timeout-s
+// is counted at that latency and its slot handed to the next request.
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Admission.h"
+#include "Debug.h"
+#include "HandlerAllocator.h"
+#include "Message.h"
+#include "Packet.h"
+#include "SecureSession.h"
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+enum class LoadMode {
+    Request,  // PeerRequest, completed by the PeerExchange reply
+    Message,  // Sequenced Data frame, completed by the Ack covering it
+};
+
+struct LoadConfig {
+    std::string host = "127.0.0.1";
+    std::string port = "6881";
+    size_t connections = 100;
+    size_t threads = 1;
+    double duration_s = 10.0;
+    double warmup_s = 1.0;  // Requests due before this are not recorded
+    LoadMode mode = LoadMode::Request;
+    size_t size = 256;      // Message content bytes in message mode
+    double rate = 0.0;      // Requests per second over all connections; 0 is unpaced
+    bool open_loop = false;
+    size_t depth = 1;       // Outstanding requests per connection in closed loop
+    double timeout_s = 5.0; // Closed loop gives up on a request after this
+    bool secure = false;
+};
+
+// Results of the connections run by one thread
+struct LoadStats {
+    std::vector<uint64_t> latencies_us;
+    uint64_t sent = 0;
+    uint64_t completed = 0;
+    uint64_t answered = 0;   // Completed and due inside the measured window
+    uint64_t timed_out = 0;
+    uint64_t bytes_sent = 0;
+    size_t connected = 0;
+    size_t failed = 0;
+    size_t outstanding = 0;  // Still unanswered when the run stopped
+    size_t challenged = 0;   // Had to solve an admission puzzle
+
+    void merge(const LoadStats& other) {
+        latencies_us.insert(latencies_us.end(), other.latencies_us.begin(), other.latencies_us.end());
+        sent += other.sent;
+        completed += other.completed;
+        answered += other.answered;
+        timed_out += other.timed_out;
+        bytes_sent += other.bytes_sent;
+        connected += other.connected;
+        failed += other.failed;
+        outstanding += other.outstanding;
+        challenged += other.challenged;
+    }
+};
+
+// State shared by every connection: the schedule and when to stop
+struct LoadRun {
+    LoadConfig config;
+    Clock::time_point start;
+    Clock::time_point measure_from;
+    Clock::time_point measure_until;
+    Clock::time_point collect_until;  // End of the grace period for replies
+    std::atomic<bool> stopping{false};
+    std::shared_ptr<const NodeIdentity> identity;
+};
+
+class LoadConnection : public std::enable_shared_from_this<LoadConnection> {
+public:
+    LoadConnection(boost::asio::io_context& io_context, LoadRun& run, LoadStats& stats,
+                   Clock::duration first_offset)
+        : socket_(io_context), timer_(io_context), timeout_timer_(io_context), run_(run), stats_(stats) {
+        if (run_.config.rate > 0) {
+            interval_ = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(run_.config.connections / run_.config.rate));
+        }
+        timeout_ = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(run_.config.timeout_s));
+        next_due_ = run_.start + first_offset;
+        if (run_.config.mode == LoadMode::Message) {
+            // One encoded frame is reused; only the header's sequence changes
+            Message msg("loadgen", "loadgen", std::string(run_.config.size, 'x'));
+            frame_ = msg.encode();
+        } else {
+            frame_ = makeFrame(PacketType::PeerRequest, {});
+        }
+    }
+
+    void start(const tcp::resolver::results_type& endpoints) {
+        boost::asio::async_connect(socket_, endpoints,
+            makeCustomAllocHandler(handler_memory_,
+                [this, self = shared_from_this()](boost::system::error_code ec, const tcp::endpoint&) {
+                    if (ec) {
+                        ++stats_.failed;
+                        return;
+                    }
+                    ++stats_.connected;
+                    socket_.set_option(tcp::no_delay(true));
+                    readHeader();
+                    if (run_.config.secure) {
+                        session_ = std::make_unique<SecureSession>(run_.identity);
+                        writeBytes(serializePacket(session_->hello()));
+                    } else {
+                        ready();
+                    }
+                }));
+    }
+
+    // Requests still waiting for a reply once the run stops are recorded
+    // as if answered at the end of the grace period, the least they took
+    void finish() {
+        stats_.outstanding += pending_.size();
+        for (const Pending& pending : pending_) {
+            record(pending, run_.collect_until);
+        }
+        pending_.clear();
+    }
+
+    void stop() {
+        boost::system::error_code ignored;
+        timer_.cancel(ignored);
+        timeout_timer_.cancel(ignored);
+        socket_.close(ignored);
+    }
+
+private:
+    struct Pending {
+        uint32_t sequence;
+        Clock::time_point due;
+    };
+
+    tcp::socket socket_;
+    boost::asio::steady_timer timer_;
+    boost::asio::steady_timer timeout_timer_;
+    LoadRun& run_;
+    LoadStats& stats_;
+    HandlerMemory handler_memory_;
+    std::unique_ptr<SecureSession> session_;
+    FramePtr frame_;
+    bool closed_ = false;
+
+    Clock::duration interval_{0};
+    Clock::duration timeout_{0};
+    bool timeout_armed_ = false;
+    Clock::time_point next_due_;
+    uint32_t next_sequence_ = 1;
+    std::deque<Pending> pending_;
+    size_t abandoned_ = 0;  // Timed-out requests whose replies may still come
+
+    std::array<uint8_t, PACKET_HEADER_SIZE> header_buffer_;
+    std::vector<uint8_t> payload_buffer_;
+    std::deque<std::vector<uint8_t>> write_queue_;
+
+    void ready() {
+        if (run_.config.open_loop) {
+            tick();
+        } else {
+            for (size_t i = 0; i < run_.config.depth; ++i) {
+                sendNextClosed();
+            }
+        }
+    }
+
+    // Open loop: everything that has fallen due is sent now, late or not,
+    // and keeps its original due time
+    void tick() {
+        if (closed_ || run_.stopping) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        while (next_due_ <= now) {
+            sendRequest(next_due_);
+            next_due_ += interval_;
+        }
+        timer_.expires_at(next_due_);
+        timer_.async_wait(makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](const boost::system::error_code& ec) {
+                if (!ec) {
+                    tick();
+                }
+            }));
+    }
+
+    // Closed loop: a reply releases the next request. With a rate it waits
+    // for its slot in the schedule; without one it is due immediately.
+    void sendNextClosed() {
+        if (closed_ || run_.stopping) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        if (interval_ == Clock::duration::zero()) {
+            sendRequest(now);
+            return;
+        }
+        Clock::time_point due = next_due_;
+        next_due_ += interval_;
+        if (due <= now) {
+            sendRequest(due);
+            return;
+        }
+        auto timer = std::make_shared<boost::asio::steady_timer>(socket_.get_executor(), due);
+        timer->async_wait([this, self = shared_from_this(), timer, due](const boost::system::error_code& ec) {
+            if (!ec && !closed_ && !run_.stopping) {
+                sendRequest(due);
+            }
+        });
+    }
+
+    void sendRequest(Clock::time_point due) {
+        uint32_t sequence = 0;
+        if (run_.config.mode == LoadMode::Message) {
+            sequence = next_sequence_++;
+        }
+        pending_.push_back({sequence, due});
+        if (!run_.config.open_loop) {
+            armTimeout();
+        }
+
+        std::vector<uint8_t> bytes;
+        if (session_) {
+            PacketHeader header = session_->seal(*frame_, sequence, bytes);
+            bytes.insert(bytes.begin(), header.begin(), header.end());
+        } else {
+            PacketHeader header = makePacketHeader(*frame_, sequence);
+            bytes.reserve(PACKET_HEADER_SIZE + frame_->payload.size());
+            bytes.insert(bytes.end(), header.begin(), header.end());
+            bytes.insert(bytes.end(), frame_->payload.begin(), frame_->payload.end());
+        }
+        ++stats_.sent;
+        stats_.bytes_sent += bytes.size();
+        writeBytes(std::move(bytes));
+    }
+
+    // Returns whether the request was due inside the measured window
+    bool record(const Pending& pending, Clock::time_point end) {
+        if (pending.due < run_.measure_from || pending.due >= run_.measure_until) {
+            return false;
+        }
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(end - pending.due);
+        stats_.latencies_us.push_back(static_cast<uint64_t>(latency.count()));
+        return true;
+    }
+
+    void complete(const Pending& pending) {
+        ++stats_.completed;
+        if (record(pending, Clock::now())) {
+            ++stats_.answered;
+        }
+        if (!run_.config.open_loop) {
+            sendNextClosed();
+        }
+    }
+
+    // Closed loop: the oldest request is given up once it is timeout_ past
+    // due, so a lost reply cannot stall its slot for the rest of the run
+    void armTimeout() {
+        if (timeout_armed_ || pending_.empty()) {
+            return;
+        }
+        timeout_armed_ = true;
+        timeout_timer_.expires_at(pending_.front().due + timeout_);
+        timeout_timer_.async_wait([this, self = shared_from_this()](const boost::system::error_code& ec) {
+            timeout_armed_ = false;
+            if (ec || closed_) {
+                return;
+            }
+            Clock::time_point now = Clock::now();
+            while (!pending_.empty() && pending_.front().due + timeout_ <= now) {
+                Pending expired = pending_.front();
+                pending_.pop_front();
+                ++stats_.timed_out;
+                record(expired, now);
+                if (run_.config.mode == LoadMode::Request) {
+                    ++abandoned_;
+                }
+                sendNextClosed();
+            }
+            armTimeout();
+        });
+    }
+
+    // Admission puzzles are solved inline, spending the CPU a joining node
+    // would; requests already sent wait at the server until it is solved
+    void handlePacket(const Packet& packet) {
+        if (packet.type == PacketType::Admission) {
+            ++stats_.challenged;
+            writeBytes(serializePacket(AdmissionChallenge::fromPacket(packet).solve()));
+        } else if (packet.type == PacketType::Handshake && session_ && !session_->established()) {
+            session_->accept(packet);
+            ready();
+        } else if (packet.type == PacketType::PeerExchange && run_.config.mode == LoadMode::Request) {
+            // Replies carry nothing to match them by, but both servers answer
+            // every request in order. A reply arriving after its request timed
+            // out is taken by that request; if it was lost instead, each later
+            // reply is charged to the request before its own, which can only
+            // overstate latency.
+            if (abandoned_ > 0) {
+                --abandoned_;
+            } else if (!pending_.empty()) {
+                Pending done = pending_.front();
+                pending_.pop_front();
+                complete(done);
+            }
+        } else if (packet.type == PacketType::Ack && run_.config.mode == LoadMode::Message) {
+            // The cumulative sequence covers every frame up to it
+            while (!pending_.empty() && pending_.front().sequence <= packet.sequence) {
+                Pending done = pending_.front();
+                pending_.pop_front();
+                complete(done);
+            }
+        }
+    }
+
+    void readHeader() {
+        boost::asio::async_read(socket_, boost::asio::buffer(header_buffer_),
+            makeCustomAllocHandler(handler_memory_,
+                [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                    if (ec || !isValidHeader(header_buffer_.data())) {
+                        fail();
+                        return;
+                    }
+                    readPayload(readUint32(header_buffer_.data(), 4));
+                }));
+    }
+
+    void readPayload(uint32_t length) {
+        payload_buffer_.resize(length);
+        boost::asio::async_read(socket_, boost::asio::buffer(payload_buffer_),
+            makeCustomAllocHandler(handler_memory_,
+                [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                    if (ec) {
+                        fail();
+                        return;
+                    }
+                    try {
+                        bool sealed = header_buffer_[17] & PACKET_FLAG_SEALED;
+                        handlePacket(sealed && session_ ? session_->open(header_buffer_.data(), payload_buffer_)
+                                                        : deserializePacket(header_buffer_.data(), payload_buffer_));
+                    } catch (const std::exception& e) {
+                        Debug::log("Load connection failed: " + std::string(e.what()));
+                        fail();
+                        return;
+                    }
+                    readHeader();
+                }));
+    }
+
+    void writeBytes(std::vector<uint8_t> bytes) {
+        bool idle = write_queue_.empty();
+        write_queue_.push_back(std::move(bytes));
+        if (idle) {
+            writeNext();
+        }
+    }
+
+    void writeNext() {
+        boost::asio::async_write(socket_, boost::asio::buffer(write_queue_.front()),
+            makeCustomAllocHandler(handler_memory_,
+                [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                    if (ec) {
+                        fail();
+                        return;
+                    }
+                    write_queue_.pop_front();
+                    if (!write_queue_.empty()) {
+                        writeNext();
+                    }
+                }));
+    }
+
+    void fail() {
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        // An orderly close after the run is not a failure
+        if (!run_.stopping) {
+            ++stats_.failed;
+        }
+        stop();
+    }
+};
+
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[index] / 1000.0;
+}
+
+void report(const LoadConfig& config, LoadStats& stats) {
+    std::sort(stats.latencies_us.begin(), stats.latencies_us.end());
+    double measured_s = config.duration_s;
+    double throughput = stats.answered / measured_s;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Connections: " << stats.connected << " open, " << stats.failed << " failed, "
+              << stats.challenged << " challenged" << std::endl;
+    std::cout << "Mode: " << (config.mode == LoadMode::Request ? "request" : "message")
+              << (config.mode == LoadMode::Message ? " (" + std::to_string(config.size) + " bytes)" : "")
+              << ", " << (config.open_loop ? "open" : "closed") << " loop";
+    if (config.rate > 0) {
+        std::cout << " at " << config.rate << "/s";
+    }
+    std::cout << (config.secure ? ", sealed" : "") << std::endl;
+    std::cout << "Sent: " << stats.sent << ", completed: " << stats.completed
+              << ", timed out: " << stats.timed_out << ", unanswered: " << stats.outstanding << std::endl;
+    std::cout << "Throughput: " << throughput << " req/s, "
+              << stats.bytes_sent / (config.warmup_s + config.duration_s) / (1024 * 1024) << " MiB/s sent" << std::endl;
+    std::cout << "Latency ms: p50 " << percentile(stats.latencies_us, 0.50)
+              << ", p99 " << percentile(stats.latencies_us, 0.99)
+              << ", p999 " << percentile(stats.latencies_us, 0.999)
+              << ", max " << percentile(stats.latencies_us, 1.0) << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    LoadConfig config;
+    std::string loop;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+        if (option == "--host") config.host = value;
+        else if (option == "--port") config.port = value;
+        else if (option == "--connections") config.connections = std::stoul(value);
+        else if (option == "--threads") config.threads = std::stoul(value);
+        else if (option == "--duration-s") config.duration_s = std::stod(value);
+        else if (option == "--warmup-s") config.warmup_s = std::stod(value);
+        else if (option == "--mode" && (value == "request" || value == "message"))
+            config.mode = value == "request" ? LoadMode::Request : LoadMode::Message;
+        else if (option == "--size") config.size = std::stoul(value);
+        else if (option == "--rate") config.rate = std::stod(value);
+        else if (option == "--loop" && (value == "open" || value == "closed")) config.open_loop = value == "open";
+        else if (option == "--depth") config.depth = std::stoul(value);
+        else if (option == "--timeout-s") config.timeout_s = std::stod(value);
+        else if (option == "--secure") config.secure = value != "0";
+        else {
+            std::cerr << "Unknown option " << option << " " << value << std::endl;
+            return 1;
+        }
+    }
+    if (argc % 2 == 0 || config.connections == 0 || config.threads == 0 || config.depth == 0 ||
+        config.duration_s <= 0 || config.timeout_s <= 0 || (config.open_loop && config.rate <= 0)) {
+        std::cerr << "Usage: telelibre_loadgen [--host H] [--port P] [--connections N] [--threads T]\n"
+                  << "                         [--duration-s S] [--warmup-s S] [--mode request|message]\n"
+                  << "                         [--size B] [--rate R] [--loop open|closed] [--depth D] [--secure 0|1]\n"
+                  << "                         [--timeout-s S]\n"
+                  << "Open loop needs --rate, the total requests per second over all connections.\n";
+        return 1;
+    }
+
+    Debug::enabled = false;
+    LoadRun run;
+    run.config = config;
+    if (config.secure) {
+        run.identity = NodeIdentity::generate();
+    }
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+    std::vector<LoadStats> stats(config.threads);
+    std::vector<std::shared_ptr<LoadConnection>> connections;
+    for (size_t i = 0; i < config.threads; ++i) {
+        contexts.push_back(std::make_unique<boost::asio::io_context>());
+    }
+
+    tcp::resolver resolver(*contexts[0]);
+    auto endpoints = resolver.resolve(config.host, config.port);
+
+    // Each connection starts at a random point in its first interval, so
+    // open-loop sends are spread out rather than arriving in lockstep
+    std::mt19937_64 rng(std::random_device{}());
+    double interval_s = config.rate > 0 ? config.connections / config.rate : 0.0;
+    std::uniform_real_distribution<double> offset(0.0, interval_s);
+
+    run.start = Clock::now();
+    auto seconds = [](double s) {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(s));
+    };
+    run.measure_from = run.start + seconds(config.warmup_s);
+    run.measure_until = run.measure_from + seconds(config.duration_s);
+    run.collect_until = run.measure_until + std::chrono::seconds(1);
+    for (size_t i = 0; i < config.connections; ++i) {
+        size_t thread = i % config.threads;
+        auto connection = std::make_shared<LoadConnection>(*contexts[thread], run, stats[thread], seconds(offset(rng)));
+        connection->start(endpoints);
+        connections.push_back(std::move(connection));
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& context : contexts) {
+        threads.emplace_back([&context]() {
+            auto guard = boost::asio::make_work_guard(*context);
+            context->run();
+        });
+    }
+
+    // Sending stops at the end of the window; replies to requests already
+    // sent are collected for a short grace period before everything closes
+    std::this_thread::sleep_until(run.measure_until);
+    run.stopping = true;
+    std::this_thread::sleep_until(run.collect_until);
+    for (auto& context : contexts) {
+        context->stop();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    LoadStats total;
+    for (size_t i = 0; i < connections.size(); ++i) {
+        connections[i]->finish();
+        connections[i]->stop();
+    }
+    for (const auto& thread_stats : stats) {
+        total.merge(thread_stats);
+    }
+    report(config, total);
+    return 0;
+}
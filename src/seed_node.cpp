@@ -2,28 +2,111 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <deque>
+#include <ctime>
 #include "Message.h"
 #include "Debug.h"
 #include "Packet.h"
+#include "HandlerAllocator.h"
+#include "Reliability.h"
+#include "PeerExchange.h"
+#include "SecureSession.h"
+#include "SeedRegistry.h"
+#include "Admission.h"
+#ifdef TELELIBRE_IO_URING
+#include <cstring>
+#include "FrameParser.h"
+#include "UringReactor.h"
+#endif
 
 using boost::asio::ip::tcp;
 
-class Session : public std::enable_shared_from_this<Session> {
+class Session : public std::enable_shared_from_this<Session>
+#ifdef TELELIBRE_IO_URING
+    , private UringReactor::Receiver
+#endif
+{
 public:
-    Session(tcp::socket socket) : socket_(std::move(socket)) {}
+    Session(tcp::socket socket, std::shared_ptr<const NodeIdentity> identity, SeedRegistry& registry,
+            AdmissionControl& admission)
+        : socket_(std::move(socket)), ack_timer_(socket_.get_executor()), admission_timer_(socket_.get_executor()),
+          identity_(std::move(identity)), registry_(registry), admission_(admission) {}
 
     void start() {
         Debug::log("New session started");
+        boost::system::error_code ec;
+        auto endpoint = socket_.remote_endpoint(ec);
+        if (ec) {
+            close();
+            return;
+        }
+        address_ = {endpoint.address(), endpoint.port()};
+        // Under load a new peer must solve a puzzle before anything else
+        admitted_ = admission_.difficulty() == 0;
+        if (!admitted_) {
+            do_write_frame(serializePacket(admission_.challengeFor(address_, std::time(nullptr)).toPacket()));
+            admission_timer_.expires_after(AdmissionControl::CHALLENGE_LIFETIME);
+            admission_timer_.async_wait(makeCustomAllocHandler(handler_memory_,
+                [this, self = shared_from_this()](const boost::system::error_code& ec) {
+                    if (!ec && !admitted_) {
+                        Debug::log("Admission timed out");
+                        close();
+                    }
+                }));
+        }
+#ifdef TELELIBRE_IO_URING
+        // No read handler holds the session, so it holds itself until closed
+        self_ = shared_from_this();
+        receive_token_ = reactor().startReceive(socket_.native_handle(), this);
+        receiving_ = true;
+#else
         do_read_header();
+#endif
     }
 
 private:
+#ifdef TELELIBRE_IO_URING
+    UringReactor& reactor() {
+        return UringReactor::of(static_cast<boost::asio::io_context&>(socket_.get_executor().context()));
+    }
+
+    // Frames are cut from whatever the kernel delivered, with the same
+    // byte-by-byte resync as do_resync on a bad magic or length
+    void onReceive(const uint8_t* data, size_t size) override {
+        auto self = shared_from_this();
+        parser_.feed(data, size);
+        while (socket_.is_open() && parser_.peekHeader(header_buffer_)) {
+            uint32_t payload_length = readUint32(header_buffer_.data(), 4);
+            if (readUint32(header_buffer_.data(), 0) != MAGIC_NUMBER || payload_length > 1000000) {
+                parser_.skip(1);
+                continue;
+            }
+            if (!parser_.takeFrame(payload_length, payload_buffer_)) {
+                break;
+            }
+            process_packet();
+        }
+        if (socket_.is_open()) {
+            parser_.keepRest();
+        }
+    }
+
+    void onReceiveError(int error) override {
+        auto self = shared_from_this();
+        Debug::log("Error reading: " + std::string(error ? std::strerror(error) : "connection closed"));
+        close();
+    }
+#endif
+
     void do_read_header() {
-        auto self(shared_from_this());
+#ifdef TELELIBRE_IO_URING
+        return;  // onReceive moves on to the next frame itself
+#endif
         Debug::log("Reading header");
         boost::asio::async_read(socket_, boost::asio::buffer(header_buffer_),
-            [this, self](boost::system::error_code ec, std::size_t length) {
-                if (!ec && length == 16) {
+            makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length) {
+                if (!ec && length == PACKET_HEADER_SIZE) {
                     uint32_t magic = (static_cast<uint32_t>(header_buffer_[0]) << 24) |
                                      (static_cast<uint32_t>(header_buffer_[1]) << 16) |
                                      (static_cast<uint32_t>(header_buffer_[2]) << 8) |
@@ -53,19 +136,19 @@ private:
                     do_read_payload(payload_length);
                 } else {
                     Debug::log("Error reading header: " + ec.message() + ". Bytes read: " + std::to_string(length));
-                    do_resync();
+                    close();
                 }
-            });
+            }));
     }
 
     void do_resync() {
-        auto self(shared_from_this());
         boost::asio::async_read(socket_, boost::asio::buffer(resync_buffer_, 1),
-            [this, self](boost::system::error_code ec, std::size_t length) {
+            makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, std::size_t) {
                 if (!ec) {
                     // Shift the header buffer
-                    std::memmove(header_buffer_.data(), header_buffer_.data() + 1, 15);
-                    header_buffer_[15] = resync_buffer_[0];
+                    std::memmove(header_buffer_.data(), header_buffer_.data() + 1, PACKET_HEADER_SIZE - 1);
+                    header_buffer_[PACKET_HEADER_SIZE - 1] = resync_buffer_[0];
                     
                     // Check if we've found the magic number
                     uint32_t magic = (static_cast<uint32_t>(header_buffer_[0]) << 24) |
@@ -81,105 +164,410 @@ private:
                     }
                 } else {
                     Debug::log("Error during resync: " + ec.message());
-                    do_read_header();
+                    close();
                 }
-            });
+            }));
     }
 
     void do_read_payload(uint32_t payload_length) {
-        auto self(shared_from_this());
         Debug::log("Reading payload of length " + std::to_string(payload_length));
         payload_buffer_.resize(payload_length);
         boost::asio::async_read(socket_, boost::asio::buffer(payload_buffer_),
-            [this, self](boost::system::error_code ec, std::size_t length) {
+            makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length) {
                 if (!ec) {
                     Debug::log("Payload read successfully. Bytes read: " + std::to_string(length));
                     process_packet();
                 } else {
                     Debug::log("Error reading payload: " + ec.message() + ". Bytes read: " + std::to_string(length));
-                    do_read_header();
+                    close();
                 }
-            });
+            }));
+    }
+
+    // Clients that open with a Handshake get one back, and every later frame
+    // in both directions is sealed. Plain clients are served unsealed.
+    Packet read_packet() {
+        bool sealed = header_buffer_[17] & PACKET_FLAG_SEALED;
+        if (session_) {
+            if (!sealed) {
+                throw std::runtime_error("Unsealed frame on a secure session");
+            }
+            return session_->open(header_buffer_.data(), payload_buffer_);
+        }
+        return deserializePacket(header_buffer_.data(), payload_buffer_);
     }
 
     void process_packet() {
-        std::vector<uint8_t> packet_data(header_buffer_.begin(), header_buffer_.end());
-        packet_data.insert(packet_data.end(), payload_buffer_.begin(), payload_buffer_.end());
+        if (admitted_) {
+            handle_packet();
+        } else {
+            screen_early_frame();
+        }
+        if (socket_.is_open()) {
+            do_read_header();  // Prepare to receive the next message
+        }
+    }
+
+    // Until the peer is admitted only its Admission solution is parsed.
+    // Anything it sent ahead of that is held unread, up to MAX_EARLY_FRAMES
+    // small frames, and handled once it is in; beyond that it is dropped.
+    void screen_early_frame() {
+        if (static_cast<PacketType>(header_buffer_[16]) != PacketType::Admission) {
+            if (payload_buffer_.size() > MAX_EARLY_PAYLOAD) {
+                Debug::log("Oversized frame before admission");
+                close();
+            } else if (early_frames_.size() < MAX_EARLY_FRAMES) {
+                early_frames_.emplace_back(header_buffer_, payload_buffer_);
+            }
+            return;
+        }
+        try {
+            Packet solution = deserializePacket(header_buffer_.data(), payload_buffer_);
+            if (!admission_.verify(solution, address_, std::time(nullptr))) {
+                throw std::runtime_error("wrong or expired solution");
+            }
+        } catch (const std::exception& e) {
+            Debug::log("Admission failed: " + std::string(e.what()));
+            close();
+            return;
+        }
+        admitted_ = true;
+        admission_timer_.cancel();
+        auto early = std::move(early_frames_);
+        for (auto& frame : early) {
+            if (!socket_.is_open()) {
+                return;
+            }
+            header_buffer_ = frame.first;
+            payload_buffer_ = std::move(frame.second);
+            handle_packet();
+        }
+    }
 
+    void handle_packet() {
         try {
-            Packet packet = deserializePacket(packet_data);
+            Packet packet = read_packet();
+            note_alive();
+            if ((packet.flags & PACKET_FLAG_FRAGMENT) && !reassembler_.add(packet, !session_)) {
+                return;
+            }
+            if (packet.type == PacketType::Handshake) {
+                if (session_) {
+                    throw std::runtime_error("Handshake repeated");
+                }
+                auto session = std::make_unique<SecureSession>(identity_);
+                session->accept(packet);
+                do_write_frame(serializePacket(session->hello()));
+                session_ = std::move(session);
+                Debug::log("Secure session established");
+                return;
+            }
+            if (packet.type == PacketType::Ack) {
+                // Responses are unsequenced, so there is nothing to retire
+                return;
+            }
+            if (packet.type == PacketType::Keepalive) {
+                if (!packet.payload.empty() && packet.payload[0] == KEEPALIVE_PING) {
+                    send_packet(createPacket(PacketType::Keepalive, {KEEPALIVE_PONG}, 0));
+                }
+                return;
+            }
+            if (packet.type == PacketType::Datagram) {
+                // Left unanswered, so the node keeps the seed on the stream
+                return;
+            }
+            if (packet.type == PacketType::PeerRequest) {
+                advertise(PeerRequest::fromPacket(packet).listen_port);
+                // Plain sessions are sent the shared frame itself
+                auto response = registry_.responseFor(registered_ ? advertised_ : address_,
+                                                      SeedRegistry::Clock::now());
+                if (session_) {
+                    send_packet(response->packet);
+                } else {
+                    do_write_frame(OutgoingFrame{{}, std::move(response)});
+                }
+                return;
+            }
+            if (packet.sequence != 0) {
+                AckTracker::Result result = ack_tracker_.record(packet.sequence);
+                if (result == AckTracker::Result::Full) {
+                    Debug::log("Too many gaps, leaving frame " + std::to_string(packet.sequence) +
+                               " for a retransmit");
+                    return;
+                }
+                schedule_ack();
+                if (result == AckTracker::Result::Duplicate) {
+                    return;
+                }
+            }
+
             Message msg = Message::deserialize({packet});
             
             Debug::log("Received message: " + msg.getContent());
-
-            if (msg.getContent() == "RequestPeers") {
-                do_write("PeerList: 127.0.0.1:6881,127.0.0.1:6882");
-            } else {
-                do_write("Message received");
-            }
         } catch (const std::exception& e) {
             Debug::log("Error processing packet: " + std::string(e.what()));
+            if (session_) {
+                // A sealed stream that fails to authenticate cannot recover
+                close();
+                return;
+            }
             do_write("Error: Invalid message format");
         }
-
-        do_read_header();  // Prepare to receive the next message
     }
 
     void do_write(const std::string& response) {
-        auto self(shared_from_this());
         Message responseMsg("", "", response);
         std::vector<Packet> packets = responseMsg.serialize();
-        
+
         for (const auto& packet : packets) {
-            std::vector<uint8_t> serialized = serializePacket(packet);
-            Debug::log("Sending response of size " + std::to_string(serialized.size()) + " bytes");
-            boost::asio::async_write(socket_, boost::asio::buffer(serialized),
-                [this, self](boost::system::error_code ec, std::size_t length) {
-                    if (ec) {
-                        Debug::log("Error writing response: " + ec.message());
-                    } else {
-                        Debug::log("Response sent successfully. Bytes sent: " + std::to_string(length));
-                    }
-                });
+            send_packet(packet);
+        }
+    }
+
+    void send_packet(Packet packet) {
+        if (!session_) {
+            do_write_frame(serializePacket(packet));
+            return;
+        }
+        std::vector<uint8_t> sealed;
+        uint32_t sequence = packet.sequence;
+        PacketHeader header = session_->seal(*makeFrame(std::move(packet)), sequence, sealed);
+        sealed.insert(sealed.begin(), header.begin(), header.end());
+        do_write_frame(std::move(sealed));
+    }
+
+    // A frame of its own, or a response shared with other sessions
+    struct OutgoingFrame {
+        std::vector<uint8_t> bytes;
+        SeedRegistry::ResponsePtr response;
+
+        const std::vector<uint8_t>& data() const { return response ? response->frame : bytes; }
+    };
+
+    void do_write_frame(std::vector<uint8_t> frame) {
+        do_write_frame(OutgoingFrame{std::move(frame), nullptr});
+    }
+
+    void do_write_frame(OutgoingFrame frame) {
+        bool idle = write_queue_.empty();
+        Debug::log("Sending response of size " + std::to_string(frame.data().size()) + " bytes");
+        write_queue_.push_back(std::move(frame));
+        if (idle) {
+            do_write_next();
+        }
+    }
+
+    // One cumulative ack per ACK_DELAY instead of a reply per message
+    void schedule_ack() {
+        if (ack_tracker_.pendingCount() >= ACK_EVERY_FRAMES) {
+            send_packet(ack_tracker_.buildAck());
+            return;
+        }
+        if (ack_timer_armed_) {
+            return;
+        }
+        ack_timer_armed_ = true;
+        ack_timer_.expires_after(ACK_DELAY);
+        ack_timer_.async_wait(makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](const boost::system::error_code& ec) {
+                ack_timer_armed_ = false;
+                if (!ec && socket_.is_open() && ack_tracker_.pendingCount() > 0) {
+                    send_packet(ack_tracker_.buildAck());
+                }
+            }));
+    }
+
+    // Only a node that advertises the port it accepts connections on is
+    // registered, under that port: the source port of its connection to us
+    // is not one anybody else could dial
+    void advertise(uint16_t listen_port) {
+        if (listen_port == 0 || (registered_ && advertised_.port == listen_port)) {
+            return;
         }
+        if (registered_) {
+            registry_.remove(advertised_);
+        }
+        advertised_ = {address_.address, listen_port};
+        registry_.touch(advertised_, SeedRegistry::Clock::now());
+        registered_ = true;
+        last_touch_ = SeedRegistry::Clock::now();
+    }
+
+    // Any valid frame keeps a registered node live; the registry hears of
+    // it at most once per TOUCH_INTERVAL
+    void note_alive() {
+        auto now = SeedRegistry::Clock::now();
+        if (!registered_ || now - last_touch_ < TOUCH_INTERVAL) {
+            return;
+        }
+        registry_.touch(advertised_, now);
+        last_touch_ = now;
+    }
+
+    void close() {
+        boost::system::error_code ignored;
+        ack_timer_.cancel(ignored);
+        admission_timer_.cancel(ignored);
+        if (registered_) {
+            registered_ = false;
+            registry_.remove(advertised_);
+        }
+#ifdef TELELIBRE_IO_URING
+        if (receiving_) {
+            receiving_ = false;
+            reactor().stopReceive(receive_token_);
+        }
+#endif
+        socket_.close(ignored);
+#ifdef TELELIBRE_IO_URING
+        self_.reset();
+#endif
+    }
+
+    void do_write_next() {
+        if (write_queue_.empty()) {
+            return;
+        }
+        boost::asio::async_write(socket_, boost::asio::buffer(write_queue_.front().data()),
+            makeCustomAllocHandler(handler_memory_,
+            [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    Debug::log("Error writing response: " + ec.message());
+                    close();
+                    return;
+                }
+                Debug::log("Response sent successfully. Bytes sent: " + std::to_string(length));
+                write_queue_.pop_front();
+                do_write_next();
+            }));
     }
 
+    static constexpr std::chrono::milliseconds ACK_DELAY{20};
+    static constexpr size_t ACK_EVERY_FRAMES = 32;
+    static constexpr std::chrono::seconds TOUCH_INTERVAL{1};
+    static constexpr size_t MAX_EARLY_FRAMES = 16;
+    static constexpr size_t MAX_EARLY_PAYLOAD = 4096;
+
     tcp::socket socket_;
-    std::array<uint8_t, 16> header_buffer_;
+    std::array<uint8_t, PACKET_HEADER_SIZE> header_buffer_;
     std::vector<uint8_t> payload_buffer_;
     std::array<uint8_t, 1> resync_buffer_;
+    std::deque<OutgoingFrame> write_queue_;
+    HandlerMemory handler_memory_;
+    AckTracker ack_tracker_;
+    FragmentReassembler reassembler_;
+    boost::asio::steady_timer ack_timer_;
+    bool ack_timer_armed_ = false;
+    boost::asio::steady_timer admission_timer_;
+    std::shared_ptr<const NodeIdentity> identity_;
+    std::unique_ptr<SecureSession> session_;
+    SeedRegistry& registry_;
+    AdmissionControl& admission_;
+    bool admitted_ = false;
+    std::vector<std::pair<PacketHeader, std::vector<uint8_t>>> early_frames_;
+    PeerAddress address_;     // Where the connection comes from
+    PeerAddress advertised_;  // Where the node accepts connections, once registered
+    bool registered_ = false;
+    SeedRegistry::Clock::time_point last_touch_;
+#ifdef TELELIBRE_IO_URING
+    std::shared_ptr<Session> self_;
+    UringReactor::Token receive_token_ = 0;
+    bool receiving_ = false;
+    FrameParser parser_;
+#endif
 };
 
 class Server {
 public:
     Server(boost::asio::io_context& io_context, short port)
-        : acceptor_(io_context, tcp::endpoint(tcp::v4(), port)) {
+        : acceptor_(io_context, tcp::endpoint(tcp::v4(), port)), identity_(NodeIdentity::generate()),
+          expiry_timer_(io_context), load_timer_(io_context) {
+        schedule_expiry();
+        schedule_load_sample();
+#ifdef TELELIBRE_IO_URING
+        UringReactor::of(io_context).startAccept(acceptor_.native_handle(), [this, &io_context](int fd) {
+            boost::system::error_code ec;
+            tcp::socket socket(io_context);
+            socket.assign(tcp::v4(), fd, ec);
+            if (ec) {
+                ::close(fd);
+                return;
+            }
+            std::make_shared<Session>(std::move(socket), identity_, registry_, admission_)->start();
+        });
+#else
         do_accept();
+#endif
     }
 
 private:
     void do_accept() {
         acceptor_.async_accept(
+            makeCustomAllocHandler(handler_memory_,
             [this](boost::system::error_code ec, tcp::socket socket) {
                 if (!ec) {
-                    std::make_shared<Session>(std::move(socket))->start();
+                    std::make_shared<Session>(std::move(socket), identity_, registry_, admission_)->start();
                 }
 
                 do_accept();
-            });
+            }));
+    }
+
+    // Nodes that went quiet without closing their connection
+    void schedule_expiry() {
+        expiry_timer_.expires_after(SeedRegistry::LIVENESS_TIMEOUT / 4);
+        expiry_timer_.async_wait(makeCustomAllocHandler(handler_memory_,
+            [this](const boost::system::error_code& ec) {
+                if (ec) {
+                    return;
+                }
+                size_t expired = registry_.expire(SeedRegistry::Clock::now());
+                if (expired > 0) {
+                    Debug::log("Expired " + std::to_string(expired) + " silent nodes, " +
+                               std::to_string(registry_.size()) + " live");
+                }
+                schedule_expiry();
+            }));
     }
 
+    void schedule_load_sample() {
+        load_timer_.expires_after(LOAD_SAMPLE_INTERVAL);
+        load_timer_.async_wait(makeCustomAllocHandler(handler_memory_,
+            [this](const boost::system::error_code& ec) {
+                if (ec) {
+                    return;
+                }
+                int before = admission_.difficulty();
+                admission_.updateLoad(admission_.sampleLoad(acceptor_.native_handle()));
+                if (admission_.difficulty() != before) {
+                    std::cout << "Admission difficulty now " << admission_.difficulty() << " bits" << std::endl;
+                }
+                schedule_load_sample();
+            }));
+    }
+
+    static constexpr std::chrono::milliseconds LOAD_SAMPLE_INTERVAL{250};
+
     tcp::acceptor acceptor_;
+    HandlerMemory handler_memory_;
+    std::shared_ptr<const NodeIdentity> identity_;
+    SeedRegistry registry_;
+    AdmissionControl admission_;
+    boost::asio::steady_timer expiry_timer_;
+    boost::asio::steady_timer load_timer_;
 };
 
 int main(int argc, char* argv[]) {
     try {
-        if (argc != 2) {
-            std::cerr << "Usage: seed_node <port>\n";
+        bool quiet = argc == 3 && std::string(argv[2]) == "--quiet";
+        if (argc != 2 && !quiet) {
+            std::cerr << "Usage: seed_node <port> [--quiet]\n";
             return 1;
         }
 
-        Debug::enabled = true; // Enable debug output
+        // Per-frame logging dominates under load, so benchmarks turn it off
+        Debug::enabled = !quiet;
 
         boost::asio::io_context io_context;
         Server s(io_context, std::atoi(argv[1]));
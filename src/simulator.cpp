@@ -0,0 +1,577 @@
+// Deterministic discrete-event simulator for the TeleLibre overlay.
+//
+// Thousands of Network instances are wired together with in-memory SimPeer
+// links. Every send is turned into an event on a virtual clock with sampled
+// latency, loss and churn, so changes to forwarding or dedup sizing can be
+// measured without deploying them. The same --seed always yields the same run.
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Debug.h"
+#include "Message.h"
+#include "Networking.h"
+#include "Peer.h"
+
+struct SimConfig {
+    size_t nodes = 2000;
+    size_t degree = 8;
+    size_t messages = 50;
+    size_t content_bytes = 256;
+    size_t estimated_size = 0;  // Starting guess; 0 means the true node count
+    double subscribers = 0.0;  // Fraction of nodes joining the group; 0 floods to all
+    size_t exchange_rounds = 0;  // Peer exchange rounds before the first message
+    double exchange_interval_ms = 100.0;
+    double message_interval_ms = 200.0;
+    double latency_ms = 40.0;
+    double jitter_ms = 20.0;
+    double loss = 0.0;
+    double uplink_mbps = 0.0;  // Per node, shared by all its links; 0 is unlimited
+    size_t meme_bytes = 0;     // Publish progressive memes with a body this size instead
+    double churn = 0.0;  // Fraction of nodes offline at any time
+    double churn_interval_ms = 1000.0;
+    double trace_rate = 0.0;  // Fraction of messages traced hop by hop
+    std::string trace_file;   // Chrome trace of the traced messages, if set
+    uint32_t seed = 1;
+};
+
+class Simulation;
+
+// One direction of an in-memory link. Sends are scheduled on the
+// simulation clock and handed to the SimPeer on the other side, whose
+// handlers belong to the receiving Network.
+class SimPeer : public Peer {
+public:
+    SimPeer(Simulation& sim, size_t local, size_t remote, Clock::time_point connected_at)
+        : sim_(sim), local_(local), remote_(remote), connected_at_(connected_at) {}
+
+    void setReverse(const std::shared_ptr<SimPeer>& reverse) { reverse_ = reverse; }
+
+    void start() override {}
+    bool sendMessage(const Message& msg) override;
+    void sendControl(Packet packet) override;
+
+    std::string getAddress() const override { return remoteEndpoint().address().to_string() + ":7000"; }
+    bool isConnected() const override;
+    boost::asio::ip::tcp::endpoint remoteEndpoint() const override {
+        boost::asio::ip::address_v4::bytes_type bytes = {
+            10, static_cast<uint8_t>(remote_ >> 16), static_cast<uint8_t>(remote_ >> 8), static_cast<uint8_t>(remote_)};
+        return {boost::asio::ip::address_v4(bytes), 7000};
+    }
+    Clock::time_point connectedAt() const override { return connected_at_; }
+
+    void receiveMessage(const Message& msg);
+    void receiveControl(const Packet& packet);
+
+private:
+    Simulation& sim_;
+    size_t local_;
+    size_t remote_;
+    Clock::time_point connected_at_;
+    std::weak_ptr<SimPeer> reverse_;
+};
+
+class Simulation {
+public:
+    explicit Simulation(const SimConfig& config) : config_(config), rng_(config.seed) {}
+
+    void build();
+    void run();
+    void report() const;
+
+    void transmit(size_t from, size_t to, size_t bytes, bool control, std::function<void()> deliver);
+    void recordReceipt(size_t node, const Message& msg);
+    bool isOnline(size_t node) const { return online_[node]; }
+    uint64_t traceNow() const { return SIM_EPOCH_START * 1000000ull + now_us_; }
+    // Starts a second in, so the first links made come after a peer's
+    // default last exchange time
+    Peer::Clock::time_point steadyNow() const {
+        return Peer::Clock::time_point(std::chrono::seconds(1) + std::chrono::microseconds(now_us_));
+    }
+    const TraceCollector* traces() const { return traces_.get(); }
+
+private:
+    struct Event {
+        uint64_t time_us;
+        uint64_t order;  // Keeps simultaneous events in scheduling order
+        std::function<void()> action;
+    };
+    struct Later {
+        bool operator()(const Event& a, const Event& b) const {
+            return a.time_us != b.time_us ? a.time_us > b.time_us : a.order > b.order;
+        }
+    };
+    // For a meme, receipts are of body chunks and a node is reached once it
+    // holds every chunk
+    struct TrackedMessage {
+        size_t origin;
+        uint64_t sent_at_us;
+        std::vector<uint64_t> first_receipt_us;
+        size_t receptions = 0;
+        size_t unique = 0;
+        size_t chunks = 0;
+        std::vector<std::vector<bool>> chunks_received;
+    };
+
+    static constexpr uint64_t NOT_RECEIVED = std::numeric_limits<uint64_t>::max();
+    static constexpr std::time_t SIM_EPOCH_START = 1700000000;
+    static constexpr uint64_t SUBSCRIBE_WARMUP_US = 2000000;
+    static constexpr uint64_t SWARM_TICK_US = 100000;
+    static constexpr uint64_t DRAIN_US = 60000000;  // Longest a meme may take after the last is published
+    static constexpr const char* GROUP = "sim";
+
+    SimConfig config_;
+    std::mt19937_64 rng_;
+    std::priority_queue<Event, std::vector<Event>, Later> events_;
+    uint64_t now_us_ = 0;
+    uint64_t next_order_ = 0;
+    uint64_t last_message_us_ = 0;
+
+    // Never run; Network needs one for its timers. Each node's own timers
+    // are stood in for by events, see README.
+    boost::asio::io_context io_context_;
+    std::vector<std::unique_ptr<Network>> networks_;
+    std::vector<bool> online_;
+    std::vector<uint64_t> uplink_free_us_;  // When each node's uplink is next idle
+    std::vector<bool> subscribed_;
+    size_t subscriber_count_ = 0;
+
+    std::unordered_map<MessageId, size_t> message_index_;
+    std::vector<TrackedMessage> tracked_;
+    uint64_t bytes_sent_ = 0;
+    uint64_t control_bytes_sent_ = 0;
+    uint64_t frames_sent_ = 0;
+    uint64_t frames_dropped_ = 0;
+    std::shared_ptr<TraceCollector> traces_;  // Shared by every node
+
+    void schedule(uint64_t delay_us, std::function<void()> action);
+    uint64_t sampleLatencyUs();
+    void publish(size_t index);
+    void exchangeRound();
+    void pollPieceRequests();
+    void churn();
+};
+
+bool SimPeer::sendMessage(const Message& msg) {
+    size_t bytes = PACKET_HEADER_SIZE + msg.encode()->payload.size();
+    sim_.transmit(local_, remote_, bytes, false, [reverse = reverse_, msg]() {
+        if (auto peer = reverse.lock()) {
+            peer->receiveMessage(msg);
+        }
+    });
+    return true;
+}
+
+void SimPeer::sendControl(Packet packet) {
+    size_t bytes = PACKET_HEADER_SIZE + packet.payload.size();
+    sim_.transmit(local_, remote_, bytes, true, [reverse = reverse_, packet]() {
+        if (auto peer = reverse.lock()) {
+            peer->receiveControl(packet);
+        }
+    });
+}
+
+bool SimPeer::isConnected() const {
+    return sim_.isOnline(local_) && sim_.isOnline(remote_);
+}
+
+void SimPeer::receiveMessage(const Message& msg) {
+    sim_.recordReceipt(local_, msg);
+    if (!message_handler_) {
+        return;
+    }
+    if (msg.getTrace()) {
+        Message stamped = msg;
+        stamped.setReceivedAt(sim_.traceNow());
+        message_handler_(shared_from_this(), stamped);
+        return;
+    }
+    message_handler_(shared_from_this(), msg);
+}
+
+void SimPeer::receiveControl(const Packet& packet) {
+    if (control_handler_) {
+        control_handler_(shared_from_this(), packet);
+    }
+}
+
+void Simulation::build() {
+    size_t estimated = config_.estimated_size ? config_.estimated_size : config_.nodes;
+    online_.assign(config_.nodes, true);
+    uplink_free_us_.assign(config_.nodes, 0);
+    if (config_.trace_rate > 0) {
+        traces_ = std::make_shared<TraceCollector>();
+    }
+    networks_.reserve(config_.nodes);
+    for (size_t i = 0; i < config_.nodes; ++i) {
+        networks_.push_back(std::make_unique<Network>(io_context_, estimated));
+        networks_.back()->seedRandom(static_cast<uint32_t>(config_.seed * 7919 + i));
+        // Size estimator epochs follow the virtual clock, from a fixed start
+        networks_.back()->setWallClock([this]() {
+            return static_cast<std::time_t>(SIM_EPOCH_START + now_us_ / 1000000);
+        });
+        networks_.back()->setSteadyClock([this]() { return steadyNow(); });
+        if (traces_) {
+            networks_.back()->setTraceClock([this]() { return traceNow(); });
+            networks_.back()->setTracing(config_.trace_rate, traces_);
+        }
+        // Topology is fixed by the simulation, so exchanges never dial out
+        networks_.back()->setPeerFactory([](const std::string&, const std::string&) {
+            return std::shared_ptr<Peer>();
+        });
+    }
+
+    // Random graph with an average degree of config_.degree
+    std::vector<std::set<size_t>> links(config_.nodes);
+    std::uniform_int_distribution<size_t> pick(0, config_.nodes - 1);
+    size_t edges = config_.nodes * config_.degree / 2;
+    for (size_t added = 0; added < edges;) {
+        size_t a = pick(rng_);
+        size_t b = pick(rng_);
+        if (a == b || links[a].count(b)) {
+            continue;
+        }
+        links[a].insert(b);
+        links[b].insert(a);
+        auto forward = std::make_shared<SimPeer>(*this, a, b, steadyNow());
+        auto backward = std::make_shared<SimPeer>(*this, b, a, steadyNow());
+        forward->setReverse(backward);
+        backward->setReverse(forward);
+        networks_[a]->addPeer(forward);
+        networks_[b]->addPeer(backward);
+        ++added;
+    }
+
+    // Joins at time zero; their adverts reach every node within
+    // InterestAdvert::DEPTH hops during the warmup below
+    subscribed_.assign(config_.nodes, false);
+    std::uniform_real_distribution<double> chance(0, 1);
+    for (size_t i = 0; i < config_.nodes; ++i) {
+        if (config_.subscribers > 0 && chance(rng_) < config_.subscribers) {
+            subscribed_[i] = true;
+            ++subscriber_count_;
+            networks_[i]->joinGroup(GROUP);
+        }
+    }
+
+    // Exchanges spread size sketches, so the estimate settles before messages
+    uint64_t exchange_us = static_cast<uint64_t>(config_.exchange_interval_ms * 1000);
+    for (size_t round = 0; round < config_.exchange_rounds; ++round) {
+        schedule(exchange_us * round, [this]() { exchangeRound(); });
+    }
+    uint64_t warmup_us = exchange_us * config_.exchange_rounds;
+    if (subscriber_count_ > 0) {
+        warmup_us = std::max<uint64_t>(warmup_us, SUBSCRIBE_WARMUP_US);
+    }
+
+    uint64_t interval_us = static_cast<uint64_t>(config_.message_interval_ms * 1000);
+    for (size_t i = 0; i < config_.messages; ++i) {
+        schedule(warmup_us + interval_us * (i + 1), [this, i]() { publish(i); });
+    }
+    last_message_us_ = warmup_us + interval_us * config_.messages;
+
+    if (config_.churn > 0) {
+        schedule(static_cast<uint64_t>(config_.churn_interval_ms * 1000), [this]() { churn(); });
+    }
+    if (config_.meme_bytes > 0) {
+        schedule(SWARM_TICK_US, [this]() { pollPieceRequests(); });
+    }
+}
+
+void Simulation::run() {
+    while (!events_.empty()) {
+        Event event = events_.top();
+        events_.pop();
+        now_us_ = event.time_us;
+        event.action();
+    }
+}
+
+void Simulation::schedule(uint64_t delay_us, std::function<void()> action) {
+    events_.push(Event{now_us_ + delay_us, next_order_++, std::move(action)});
+}
+
+uint64_t Simulation::sampleLatencyUs() {
+    std::uniform_real_distribution<double> jitter(-config_.jitter_ms, config_.jitter_ms);
+    double latency_ms = std::max(0.1, config_.latency_ms + jitter(rng_));
+    return static_cast<uint64_t>(latency_ms * 1000);
+}
+
+void Simulation::transmit(size_t from, size_t to, size_t bytes, bool control, std::function<void()> deliver) {
+    (control ? control_bytes_sent_ : bytes_sent_) += bytes;
+    ++frames_sent_;
+
+    std::uniform_real_distribution<double> chance(0, 1);
+    if (!online_[from] || !online_[to] || chance(rng_) < config_.loss) {
+        ++frames_dropped_;
+        return;
+    }
+    // Frames leave a node one after another at its uplink rate
+    uint64_t queued_us = 0;
+    if (config_.uplink_mbps > 0) {
+        uint64_t start_us = std::max(now_us_, uplink_free_us_[from]);
+        uplink_free_us_[from] = start_us + static_cast<uint64_t>(bytes * 8 / config_.uplink_mbps);
+        queued_us = uplink_free_us_[from] - now_us_;
+    }
+    schedule(queued_us + sampleLatencyUs(), [this, to, deliver = std::move(deliver)]() {
+        if (online_[to]) {
+            deliver();
+        } else {
+            ++frames_dropped_;
+        }
+    });
+}
+
+void Simulation::recordReceipt(size_t node, const Message& msg) {
+    auto it = message_index_.find(msg.getMessageId());
+    if (it == message_index_.end()) {
+        return;
+    }
+    TrackedMessage& tracked = tracked_[it->second];
+    if (tracked.chunks > 0) {
+        if (msg.getKind() != MessageKind::Chunk) {
+            return;
+        }
+        ++tracked.receptions;
+        std::vector<bool>& received = tracked.chunks_received[node];
+        if (received.empty()) {
+            received.assign(tracked.chunks, false);
+        }
+        if (received[msg.getChunkIndex()]) {
+            return;
+        }
+        received[msg.getChunkIndex()] = true;
+        ++tracked.unique;
+        if (std::count(received.begin(), received.end(), true) == static_cast<long>(tracked.chunks)) {
+            tracked.first_receipt_us[node] = now_us_;
+        }
+        return;
+    }
+    ++tracked.receptions;
+    if (tracked.first_receipt_us[node] == NOT_RECEIVED) {
+        tracked.first_receipt_us[node] = now_us_;
+        ++tracked.unique;
+    }
+}
+
+void Simulation::publish(size_t index) {
+    std::uniform_int_distribution<size_t> pick(0, config_.nodes - 1);
+    size_t origin = pick(rng_);
+    while (!online_[origin]) {
+        origin = pick(rng_);
+    }
+
+    MessageId id;
+    for (size_t i = 0; i < MessageId::SIZE; i += 8) {
+        uint64_t bits = rng_();
+        std::memcpy(id.bytes.data() + i, &bits, 8);
+    }
+    Message msg(GROUP, "node-" + std::to_string(origin), std::string(config_.content_bytes, 'x'));
+    msg.setMessageId(id);
+    std::vector<Message> parts = {msg};
+    if (config_.meme_bytes > 0) {
+        parts = Message::progressive(GROUP, "node-" + std::to_string(origin), std::string(config_.content_bytes, 'p'),
+                                     std::string(config_.meme_bytes, 'x'));
+    }
+
+    TrackedMessage tracked;
+    tracked.origin = origin;
+    tracked.sent_at_us = now_us_;
+    tracked.first_receipt_us.assign(config_.nodes, NOT_RECEIVED);
+    tracked.first_receipt_us[origin] = now_us_;
+    if (config_.meme_bytes > 0) {
+        tracked.chunks = parts.size() - 1;
+        tracked.chunks_received.resize(config_.nodes);
+    }
+    for (const auto& part : parts) {
+        message_index_[part.getMessageId()] = index;
+    }
+    tracked_.push_back(std::move(tracked));
+
+    for (const auto& part : parts) {
+        networks_[origin]->sendMessage(part);
+    }
+}
+
+// Stands in for each node's swarm timer, since the io_context never runs
+void Simulation::pollPieceRequests() {
+    for (size_t i = 0; i < config_.nodes; ++i) {
+        if (online_[i]) {
+            networks_[i]->pollPieceRequests();
+        }
+    }
+    if (now_us_ < last_message_us_ + DRAIN_US) {
+        schedule(SWARM_TICK_US, [this]() { pollPieceRequests(); });
+    }
+}
+
+void Simulation::exchangeRound() {
+    for (size_t i = 0; i < config_.nodes; ++i) {
+        if (online_[i]) {
+            networks_[i]->requestPeers();
+        }
+    }
+}
+
+// Each tick nodes leave and rejoin with probabilities chosen so that about
+// config_.churn of them are offline at any time.
+void Simulation::churn() {
+    std::uniform_real_distribution<double> chance(0, 1);
+    double leave = config_.churn * 0.2;
+    double rejoin = (1.0 - config_.churn) * 0.2;
+    for (size_t i = 0; i < config_.nodes; ++i) {
+        if (chance(rng_) < (online_[i] ? leave : rejoin)) {
+            online_[i] = !online_[i];
+        }
+    }
+    if (now_us_ < last_message_us_) {
+        schedule(static_cast<uint64_t>(config_.churn_interval_ms * 1000), [this]() { churn(); });
+    }
+}
+
+void Simulation::report() const {
+    std::vector<double> propagation_ms;
+    size_t receptions = 0;
+    size_t unique = 0;
+    size_t deliveries = 0;
+    double coverage_sum = 0;
+    double coverage_min = 1.0;
+
+    // With subscribers, coverage and cost are measured over the group's
+    // members only; relays that merely pass a message on do not count.
+    for (const auto& tracked : tracked_) {
+        receptions += tracked.receptions;
+        unique += tracked.unique;
+        size_t audience = 0;
+        size_t reached = 0;
+        for (size_t node = 0; node < config_.nodes; ++node) {
+            if (node == tracked.origin || (subscriber_count_ > 0 && !subscribed_[node])) {
+                continue;
+            }
+            ++audience;
+            uint64_t at = tracked.first_receipt_us[node];
+            if (at != NOT_RECEIVED) {
+                ++reached;
+                propagation_ms.push_back((at - tracked.sent_at_us) / 1000.0);
+            }
+        }
+        deliveries += reached;
+        double coverage = audience ? static_cast<double>(reached) / audience : 1.0;
+        coverage_sum += coverage;
+        coverage_min = std::min(coverage_min, coverage);
+    }
+    std::sort(propagation_ms.begin(), propagation_ms.end());
+    auto percentile = [&](double p) {
+        if (propagation_ms.empty()) {
+            return 0.0;
+        }
+        size_t rank = static_cast<size_t>(p * (propagation_ms.size() - 1));
+        return propagation_ms[rank];
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Nodes: " << config_.nodes << ", degree: " << config_.degree
+              << ", messages: " << tracked_.size() << ", seed: " << config_.seed << std::endl;
+    std::cout << "Coverage: mean " << (tracked_.empty() ? 0 : coverage_sum / tracked_.size())
+              << ", min " << coverage_min << std::endl;
+    std::cout << "Propagation ms: p50 " << percentile(0.50) << ", p90 " << percentile(0.90)
+              << ", p99 " << percentile(0.99) << ", max " << percentile(1.0) << std::endl;
+    if (subscriber_count_ > 0) {
+        std::cout << "Subscribers: " << subscriber_count_ << ", nodes reached per message: "
+                  << (tracked_.empty() ? 0.0 : static_cast<double>(unique) / tracked_.size()) << std::endl;
+    }
+    std::cout << "Duplicate ratio: "
+              << (receptions ? static_cast<double>(receptions - unique) / receptions : 0.0) << std::endl;
+    std::cout << "Bytes per delivered message: "
+              << (deliveries ? static_cast<double>(bytes_sent_) / deliveries : 0.0) << std::endl;
+    std::cout << "Control bytes: " << control_bytes_sent_ << std::endl;
+    std::cout << "Frames sent: " << frames_sent_ << ", dropped: " << frames_dropped_ << std::endl;
+
+    double estimate_sum = 0;
+    size_t estimate_min = std::numeric_limits<size_t>::max();
+    size_t estimate_max = 0;
+    for (const auto& network : networks_) {
+        size_t estimate = network->estimatedNetworkSize();
+        estimate_sum += estimate;
+        estimate_min = std::min(estimate_min, estimate);
+        estimate_max = std::max(estimate_max, estimate);
+    }
+    std::cout << "Size estimate: mean " << estimate_sum / networks_.size() << ", min " << estimate_min
+              << ", max " << estimate_max << " (true " << config_.nodes << ")" << std::endl;
+
+    // Handling takes no virtual time, so the hops' cost is all queueing and wire
+    if (traces_) {
+        TraceCollector::Breakdown breakdown = traces_->breakdown();
+        std::cout << "Traced messages: " << traces_->size() << ", hops: " << breakdown.hops
+                  << ", ms per hop: queue+wire " << breakdown.wire_us / 1000.0 << ", parse "
+                  << breakdown.parse_us / 1000.0 << ", handle " << breakdown.handle_us / 1000.0 << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    SimConfig config;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+        if (option == "--nodes") config.nodes = std::stoul(value);
+        else if (option == "--degree") config.degree = std::stoul(value);
+        else if (option == "--messages") config.messages = std::stoul(value);
+        else if (option == "--content-bytes") config.content_bytes = std::stoul(value);
+        else if (option == "--estimated-size") config.estimated_size = std::stoul(value);
+        else if (option == "--subscribers") config.subscribers = std::stod(value);
+        else if (option == "--exchange-rounds") config.exchange_rounds = std::stoul(value);
+        else if (option == "--exchange-interval-ms") config.exchange_interval_ms = std::stod(value);
+        else if (option == "--interval-ms") config.message_interval_ms = std::stod(value);
+        else if (option == "--latency-ms") config.latency_ms = std::stod(value);
+        else if (option == "--jitter-ms") config.jitter_ms = std::stod(value);
+        else if (option == "--loss") config.loss = std::stod(value);
+        else if (option == "--uplink-mbps") config.uplink_mbps = std::stod(value);
+        else if (option == "--meme-bytes") config.meme_bytes = std::stoul(value);
+        else if (option == "--churn") config.churn = std::stod(value);
+        else if (option == "--churn-interval-ms") config.churn_interval_ms = std::stod(value);
+        else if (option == "--trace-rate") config.trace_rate = std::stod(value);
+        else if (option == "--trace-file") config.trace_file = value;
+        else if (option == "--seed") config.seed = static_cast<uint32_t>(std::stoul(value));
+        else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+    if (argc % 2 == 0 || config.nodes < 2 || config.degree >= config.nodes) {
+        std::cerr << "Usage: telelibre_sim [--nodes N] [--degree D] [--messages M] [--content-bytes B]\n"
+                  << "                     [--estimated-size N] [--exchange-rounds R] [--exchange-interval-ms T]\n"
+                  << "                     [--interval-ms T] [--latency-ms T] [--jitter-ms T]\n"
+                  << "                     [--loss P] [--churn F] [--churn-interval-ms T] [--subscribers F] [--seed S]\n"
+                  << "                     [--uplink-mbps R] [--meme-bytes B] [--trace-rate F] [--trace-file PATH]\n";
+        return 1;
+    }
+
+    Debug::enabled = false;
+    Simulation simulation(config);
+    simulation.build();
+    simulation.run();
+    simulation.report();
+    if (!config.trace_file.empty() && simulation.traces()) {
+        try {
+            simulation.traces()->exportChromeTrace(config.trace_file);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}